@@ -0,0 +1,65 @@
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "config.h"
+#include "generators.h"
+
+using namespace std::literals;
+
+namespace pefti::bench {
+
+static constexpr std::size_t kNumChannels{10'000};
+
+static constexpr std::array kGroupTitles{
+    "USA"sv,    "United Kingdom"sv, "Canada"sv,   "Germany"sv,
+    "Adult"sv,  "Radio"sv,          "Shopping"sv, "Portugal"sv};
+
+static std::string make_config_file() {
+  return write_temp_file("pefti_bench_config.toml", generate_config(100));
+}
+
+static void BM_IsBlockedChannel(benchmark::State& state) {
+  auto filename = make_config_file();
+  ConfigType config(filename);
+  const auto names = generate_channel_names(kNumChannels);
+  for (auto _ : state) {
+    for (const auto& name : names)
+      benchmark::DoNotOptimize(config.is_blocked_channel(name));
+  }
+  state.SetItemsProcessed(state.iterations() * names.size());
+}
+BENCHMARK(BM_IsBlockedChannel)->Unit(benchmark::kMicrosecond);
+
+static void BM_IsBlockedGroup(benchmark::State& state) {
+  auto filename = make_config_file();
+  ConfigType config(filename);
+  for (auto _ : state) {
+    for (const auto group_title : kGroupTitles)
+      benchmark::DoNotOptimize(config.is_blocked_group(group_title));
+  }
+  state.SetItemsProcessed(state.iterations() * kGroupTitles.size());
+}
+BENCHMARK(BM_IsBlockedGroup);
+
+static void BM_IsBlockedUrl(benchmark::State& state) {
+  auto filename = make_config_file();
+  ConfigType config(filename);
+  std::vector<std::string> urls;
+  urls.reserve(kNumChannels);
+  for (std::size_t i{0}; i < kNumChannels; ++i)
+    urls.push_back("http://stream.example.com/live/user/pass/" +
+                   std::to_string(100'000 + i) + ".ts");
+  for (auto _ : state) {
+    for (const auto& url : urls)
+      benchmark::DoNotOptimize(config.is_blocked_url(url));
+  }
+  state.SetItemsProcessed(state.iterations() * urls.size());
+}
+BENCHMARK(BM_IsBlockedUrl)->Unit(benchmark::kMicrosecond);
+
+}  // namespace pefti::bench
@@ -0,0 +1,421 @@
+// End-to-end throughput harness. Serves generated playlists and EPGs from
+// a local stand-in for the upstream providers, runs pefti against them and
+// reports the wall time, peak RSS and stage times of each run. The outputs
+// of each run are checked against a reference run with an unshaped network,
+// which can itself be checked against golden files.
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cxxopts.hpp>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "generators.h"
+#include "upstream_server.h"
+
+extern char** environ;
+
+using namespace std::literals;
+namespace fs = std::filesystem;
+
+namespace pefti::bench {
+
+static constexpr std::size_t kMiB{1024 * 1024};
+
+// Stages of the --stats=json report that are shown, in milliseconds
+static constexpr std::array kStages{
+    "loader"sv,     "parser"sv,    "filter"sv,     "transformer"sv,
+    "transform"sv,  "epg_load"sv,  "epg_index"sv,  "epg_output"sv};
+
+// Every duplicate is written, so the new playlist does not depend on which
+// of the playlists that are processed concurrently has a channel first
+static constexpr int kNumDuplicates{1'000'000};
+
+struct Settings {
+  std::string pefti;
+  fs::path work_directory;
+  std::size_t num_playlists;
+  std::size_t num_channels;
+  std::size_t num_epgs;
+  std::size_t epg_size;
+  std::size_t num_epg_channels;
+  std::size_t num_templates;
+  std::size_t num_runs;
+  // A run of pefti that takes longer is stopped and fails the harness
+  std::chrono::seconds timeout;
+  bool is_warm;
+  std::string golden_directory;
+  bool update_golden;
+  std::string config_append;
+  std::uint32_t seed;
+  NetworkShape shape;
+};
+
+struct RunResult {
+  double wall_time;
+  long max_rss;
+  std::array<double, kStages.size()> stage_times{};
+  bool has_succeeded{true};
+  bool is_correct{true};
+};
+
+static std::string read_file(const fs::path& filename) {
+  std::ifstream file{filename, std::ios::binary};
+  if (!file) throw std::runtime_error("Failed to open "s + filename.string());
+  std::ostringstream stream;
+  stream << file.rdbuf();
+  return stream.str();
+}
+
+static void write_file(const fs::path& filename, std::string_view content) {
+  std::ofstream file{filename, std::ios::binary | std::ios::trunc};
+  file.write(content.data(), static_cast<std::streamsize>(content.size()));
+  if (!file) throw std::runtime_error("Failed to write "s + filename.string());
+}
+
+// Returns the channels of an M3U playlist sorted and without their tvg-id
+// tags, only the first of the duplicates of a channel has its tvg-id
+static std::vector<std::string> get_sorted_channels(std::string_view m3u) {
+  std::vector<std::string> channels;
+  std::istringstream stream{std::string{m3u}};
+  std::string extinf;
+  std::string url;
+  std::getline(stream, extinf);
+  while (std::getline(stream, extinf) && std::getline(stream, url)) {
+    const auto start = extinf.find(" tvg-id=\""sv);
+    if (start != std::string::npos)
+      extinf.erase(start, extinf.find('"', start + 9) + 1 - start);
+    channels.push_back(extinf + '\n' + url);
+  }
+  std::ranges::sort(channels);
+  return channels;
+}
+
+// The channels of the new playlists are compared in sorted order, the EPGs
+// byte for byte
+static bool are_outputs_equal(const fs::path& directory,
+                              const fs::path& reference_directory) {
+  const auto m3u = read_file(directory / "new.m3u");
+  const auto reference_m3u = read_file(reference_directory / "new.m3u");
+  if (get_sorted_channels(m3u) != get_sorted_channels(reference_m3u))
+    return false;
+  const auto xml = directory / "new.xml";
+  const auto reference_xml = reference_directory / "new.xml";
+  if (fs::exists(xml) != fs::exists(reference_xml)) return false;
+  return !fs::exists(xml) || read_file(xml) == read_file(reference_xml);
+}
+
+static double get_stage_time(std::string_view stats, std::string_view stage) {
+  const auto start = stats.find("\""s + std::string{stage} + "\": {"s);
+  if (start == std::string_view::npos) return 0.0;
+  const auto field = stats.find("\"time_ns\": "sv, start);
+  if (field == std::string_view::npos) return 0.0;
+  std::uint64_t time_ns{0};
+  const auto value = stats.substr(field + 11);
+  std::from_chars(value.data(), value.data() + value.size(), time_ns);
+  return static_cast<double>(time_ns) / 1e6;
+}
+
+static std::string get_playlist_path(std::size_t index) {
+  return "/playlist"s + std::to_string(index) + ".m3u"s;
+}
+
+// Without snapshots a playlist that fails has nothing to fall back to, so
+// the run must fail without writing outputs
+static bool is_failure_expected(const Settings& settings,
+                                const UpstreamServer& server) {
+  if (settings.is_warm) return false;
+  for (std::size_t i{0}; i < settings.num_playlists; ++i) {
+    if (server.is_failing(get_playlist_path(i), settings.shape)) return true;
+  }
+  return false;
+}
+
+static bool has_outputs(const fs::path& directory) {
+  return fs::exists(directory / "new.m3u") || fs::exists(directory / "new.xml");
+}
+
+static void write_config(const Settings& settings,
+                         const UpstreamServer& server,
+                         const fs::path& directory) {
+  ConfigOptions options;
+  options.playlists.clear();
+  for (std::size_t i{0}; i < settings.num_playlists; ++i)
+    options.playlists.push_back(server.get_url(get_playlist_path(i)));
+  for (std::size_t i{0}; i < settings.num_epgs; ++i)
+    options.epgs.push_back(
+        server.get_url("/epg"s + std::to_string(i) + ".xml"s));
+  options.new_playlist = (directory / "new.m3u").string();
+  options.new_epg = (directory / "new.xml").string();
+  options.number_of_duplicates = kNumDuplicates;
+  write_file(directory / "config.toml",
+             generate_config(settings.num_templates, settings.seed, options) +
+                 settings.config_append + '\n');
+}
+
+// Runs pefti in `directory` with --stats=json. Its output is written to
+// stats.json and stderr.txt in the directory. Throws if pefti fails
+// unexpectedly or does not finish within the timeout.
+static RunResult run_pefti(const Settings& settings, const fs::path& directory,
+                           bool is_failure_expected) {
+  const auto config = (directory / "config.toml").string();
+  const auto stats = (directory / "stats.json").string();
+  const auto errors = (directory / "stderr.txt").string();
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 1, stats.c_str(),
+                                   O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  posix_spawn_file_actions_addopen(&actions, 2, errors.c_str(),
+                                   O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  std::string stats_option{"--stats=json"};
+  std::vector<char*> argv{const_cast<char*>(settings.pefti.c_str()),
+                          stats_option.data(),
+                          const_cast<char*>(config.c_str()), nullptr};
+  const auto start = std::chrono::steady_clock::now();
+  pid_t pid;
+  const int error = posix_spawn(&pid, settings.pefti.c_str(), &actions,
+                                nullptr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (error != 0)
+    throw std::runtime_error("Failed to run "s + settings.pefti + ": "s +
+                             std::strerror(error));
+  int status{0};
+  rusage usage{};
+  while (true) {
+    const auto waited = wait4(pid, &status, WNOHANG, &usage);
+    if (waited < 0) throw std::runtime_error("wait4() failed"s);
+    if (waited == pid) break;
+    if (std::chrono::steady_clock::now() - start > settings.timeout) {
+      kill(pid, SIGKILL);
+      wait4(pid, &status, 0, &usage);
+      throw std::runtime_error("pefti did not finish within "s +
+                               std::to_string(settings.timeout.count()) +
+                               " s, see "s + errors);
+    }
+    std::this_thread::sleep_for(10ms);
+  }
+  const std::chrono::duration<double> wall_time =
+      std::chrono::steady_clock::now() - start;
+  RunResult result{wall_time.count(), usage.ru_maxrss};
+  result.has_succeeded = WIFEXITED(status) &&
+                         WEXITSTATUS(status) == EXIT_SUCCESS;
+  if (!result.has_succeeded && !is_failure_expected)
+    throw std::runtime_error("pefti failed, see "s + errors);
+  if (!result.has_succeeded) return result;
+  const auto report = read_file(stats);
+  for (std::size_t i{0}; i < kStages.size(); ++i)
+    result.stage_times[i] = get_stage_time(report, kStages[i]);
+  return result;
+}
+
+static int get_column_width(std::string_view stage) {
+  return std::max(static_cast<int>(stage.size()) + 5, 10);
+}
+
+static void print_header() {
+  std::cout << std::left << std::setw(10) << "run" << std::right
+            << std::setw(10) << "wall_s" << std::setw(10) << "rss_mib";
+  for (const auto stage : kStages)
+    std::cout << std::setw(get_column_width(stage))
+              << std::string{stage} + "_ms"s;
+  std::cout << "  output\n";
+}
+
+static void print_result(std::string_view name, const RunResult& result) {
+  std::cout << std::left << std::setw(10) << name << std::right << std::fixed
+            << std::setprecision(2) << std::setw(10) << result.wall_time
+            << std::setprecision(1) << std::setw(10)
+            << static_cast<double>(result.max_rss) / 1024.0;
+  for (std::size_t i{0}; i < kStages.size(); ++i)
+    std::cout << std::setw(get_column_width(kStages[i]))
+              << result.stage_times[i];
+  std::cout << "  "
+            << (!result.is_correct      ? "MISMATCH"
+                : result.has_succeeded ? "ok"
+                                       : "failed as expected")
+            << std::endl;
+}
+
+// The reference run sees no network shaping and no failures, it also saves
+// the snapshots that a warm run starts from
+static bool run(const Settings& settings) {
+  fs::remove_all(settings.work_directory);
+  fs::create_directories(settings.work_directory);
+  UpstreamServer server;
+  std::cerr << "Generating " << settings.num_playlists << " playlists and "
+            << settings.num_epgs << " EPGs\n";
+  for (std::size_t i{0}; i < settings.num_playlists; ++i) {
+    server.add(get_playlist_path(i),
+               generate_playlist(settings.num_channels,
+                                 settings.seed + static_cast<std::uint32_t>(i)),
+               true);
+  }
+  for (std::size_t i{0}; i < settings.num_epgs; ++i) {
+    server.add("/epg"s + std::to_string(i) + ".xml"s,
+               generate_epg(settings.epg_size, settings.num_epg_channels,
+                            settings.seed + 1000 +
+                                static_cast<std::uint32_t>(i)),
+               false);
+  }
+  print_header();
+  const auto reference_directory = settings.work_directory / "reference";
+  fs::create_directories(reference_directory);
+  write_config(settings, server, reference_directory);
+  auto reference = run_pefti(settings, reference_directory, false);
+  if (!settings.golden_directory.empty()) {
+    const fs::path golden_directory{settings.golden_directory};
+    if (settings.update_golden) {
+      fs::create_directories(golden_directory);
+      for (const auto* name : {"new.m3u", "new.xml"}) {
+        if (fs::exists(reference_directory / name))
+          fs::copy_file(reference_directory / name, golden_directory / name,
+                        fs::copy_options::overwrite_existing);
+      }
+    } else {
+      reference.is_correct =
+          are_outputs_equal(reference_directory, golden_directory);
+    }
+  }
+  print_result("reference", reference);
+  bool is_correct{reference.is_correct};
+  server.set_shape(settings.shape);
+  const bool is_failure{is_failure_expected(settings, server)};
+  for (std::size_t i{0}; i < settings.num_runs; ++i) {
+    const auto directory =
+        settings.work_directory / ("run"s + std::to_string(i));
+    fs::create_directories(directory);
+    write_config(settings, server, directory);
+    if (settings.is_warm) {
+      fs::copy(reference_directory / "config.toml.snapshots",
+               directory / "config.toml.snapshots",
+               fs::copy_options::recursive);
+    }
+    auto result = run_pefti(settings, directory, is_failure);
+    result.is_correct =
+        is_failure ? !result.has_succeeded && !has_outputs(directory)
+                   : are_outputs_equal(directory, reference_directory);
+    is_correct = is_correct && result.is_correct;
+    print_result("run"s + std::to_string(i), result);
+  }
+  return is_correct;
+}
+
+static void print_usage(const cxxopts::Options& options) {
+  std::cout << options.help() << '\n';
+}
+
+}  // namespace pefti::bench
+
+int main(int argc, char* argv[]) {
+  using pefti::bench::kMiB;
+  try {
+    cxxopts::Options options(
+        "pefti_e2e", "Runs pefti against a local stand-in for IPTV providers");
+    options.add_options()("h,help", "Print usage")(
+        "pefti", "The pefti executable",
+        cxxopts::value<std::string>()->default_value("./pefti"))(
+        "work-dir", "Directory of the configurations and outputs",
+        cxxopts::value<std::string>()->default_value(
+            (fs::temp_directory_path() / "pefti_e2e").string()))(
+        "playlists", "Number of playlists",
+        cxxopts::value<std::size_t>()->default_value("50"))(
+        "channels", "Channels per playlist",
+        cxxopts::value<std::size_t>()->default_value("20000"))(
+        "epgs", "Number of EPGs",
+        cxxopts::value<std::size_t>()->default_value("5"))(
+        "epg-size", "Size of each EPG in MiB",
+        cxxopts::value<std::size_t>()->default_value("64"))(
+        "epg-channels", "Channels per EPG",
+        cxxopts::value<std::size_t>()->default_value("20000"))(
+        "templates", "Channel templates in the configuration",
+        cxxopts::value<std::size_t>()->default_value("1000"))(
+        "runs", "Runs after the reference run",
+        cxxopts::value<std::size_t>()->default_value("3"))(
+        "timeout", "Seconds before a run of pefti is stopped",
+        cxxopts::value<int>()->default_value("600"))(
+        "bandwidth", "MiB per second of each response, 0 is unlimited",
+        cxxopts::value<double>()->default_value("0"))(
+        "latency", "Milliseconds before each response",
+        cxxopts::value<int>()->default_value("0"))(
+        "chunk-size", "Send bodies in chunks of this many bytes",
+        cxxopts::value<std::size_t>()->default_value("0"))(
+        "gzip", "Send bodies gzip encoded to clients that accept it")(
+        "failure-rate", "Fraction of playlists answered with a 503",
+        cxxopts::value<double>()->default_value("0"))(
+        "snapshots", "Start each run with no snapshots (cold) or with the "
+        "snapshots of the reference run (warm)",
+        cxxopts::value<std::string>()->default_value("cold"))(
+        "golden", "Directory of the golden outputs of the reference run",
+        cxxopts::value<std::string>()->default_value(""))(
+        "update-golden", "Save the outputs of the reference run as golden")(
+        "config-append", "TOML appended to the configuration",
+        cxxopts::value<std::string>()->default_value(""))(
+        "seed", "Seed of the generated inputs",
+        cxxopts::value<std::uint32_t>()->default_value("1"));
+    auto result = options.parse(argc, argv);
+    if (result.count("help")) {
+      pefti::bench::print_usage(options);
+      return EXIT_SUCCESS;
+    }
+    pefti::bench::Settings settings;
+    settings.pefti = result["pefti"].as<std::string>();
+    settings.work_directory = result["work-dir"].as<std::string>();
+    settings.num_playlists = result["playlists"].as<std::size_t>();
+    settings.num_channels = result["channels"].as<std::size_t>();
+    settings.num_epgs = result["epgs"].as<std::size_t>();
+    settings.epg_size = result["epg-size"].as<std::size_t>() * kMiB;
+    settings.num_epg_channels = result["epg-channels"].as<std::size_t>();
+    settings.num_templates = result["templates"].as<std::size_t>();
+    settings.num_runs = result["runs"].as<std::size_t>();
+    settings.timeout = std::chrono::seconds{result["timeout"].as<int>()};
+    if (settings.timeout <= std::chrono::seconds{0})
+      throw std::runtime_error("--timeout must be a positive number");
+    const auto snapshots = result["snapshots"].as<std::string>();
+    if (snapshots != "cold" && snapshots != "warm")
+      throw std::runtime_error("--snapshots must be cold or warm");
+    settings.is_warm = snapshots == "warm";
+    settings.golden_directory = result["golden"].as<std::string>();
+    settings.update_golden = result.count("update-golden") > 0;
+    settings.config_append = result["config-append"].as<std::string>();
+    settings.seed = result["seed"].as<std::uint32_t>();
+    auto& shape = settings.shape;
+    shape.bandwidth =
+        static_cast<std::size_t>(result["bandwidth"].as<double>() * kMiB);
+    shape.latency = std::chrono::milliseconds{result["latency"].as<int>()};
+    shape.chunk_size = result["chunk-size"].as<std::size_t>();
+    shape.is_gzip = result.count("gzip") > 0;
+    shape.failure_rate = result["failure-rate"].as<double>();
+    shape.seed = settings.seed;
+    if (settings.update_golden && settings.golden_directory.empty())
+      throw std::runtime_error("--update-golden requires --golden");
+    if (!pefti::bench::run(settings)) {
+      std::cerr << "The outputs differ from the reference\n";
+      return EXIT_FAILURE;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
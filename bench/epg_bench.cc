@@ -0,0 +1,66 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <exception>
+#include <sstream>
+#include <string>
+
+#include "config.h"
+#include "epg_index.h"
+#include "generators.h"
+#include "playlist.h"
+#include "sax_fsm.h"
+
+namespace pefti::bench {
+
+static constexpr std::size_t kMiB{1024 * 1024};
+
+// Channels in the generated EPGs, the playlist has half of them
+static constexpr std::size_t kNumEpgChannels{2'000};
+
+// Copies the nodes of the channels in the playlist with SaxFsm, as
+// Filter::copy_xml_nodes does. libxml2 takes the size of the document as an
+// int, so the largest EPG is 1 GiB.
+static void BM_SaxFsm(benchmark::State& state) {
+  const auto size = static_cast<std::size_t>(state.range(0)) * kMiB;
+  const auto epg = generate_epg(size, kNumEpgChannels);
+  auto filename = write_temp_file("pefti_bench_epg.toml", generate_config(10));
+  ConfigType config(filename);
+  Playlist playlist(config);
+  add_channels(playlist, kNumEpgChannels / 2);
+  for (auto _ : state) {
+    std::ostringstream channel_stream;
+    std::ostringstream programme_stream;
+    SaxFsm fsm(channel_stream, programme_stream, playlist);
+    try {
+      fsm.parse(epg);
+    } catch (const std::exception& e) {
+      state.SkipWithError(e.what());
+      break;
+    }
+    benchmark::DoNotOptimize(programme_stream.tellp());
+  }
+  state.SetBytesProcessed(state.iterations() * epg.size());
+}
+BENCHMARK(BM_SaxFsm)
+    ->RangeMultiplier(16)
+    ->Range(1, 1024)
+    ->Unit(benchmark::kMillisecond);
+
+// Indexes the EPG with XmltvScanner, sizes are up to 2 GiB
+static void BM_EpgIndexBuild(benchmark::State& state) {
+  const auto size = static_cast<std::size_t>(state.range(0)) * kMiB;
+  const auto epg = generate_epg(size, kNumEpgChannels);
+  for (auto _ : state) {
+    EpgIndex epg_index;
+    epg_index.build(epg, {}, true);
+    benchmark::DoNotOptimize(epg_index);
+  }
+  state.SetBytesProcessed(state.iterations() * epg.size());
+}
+BENCHMARK(BM_EpgIndexBuild)
+    ->RangeMultiplier(16)
+    ->Range(1, 2048)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace pefti::bench
@@ -0,0 +1,266 @@
+#include "generators.h"
+
+#include <array>
+#include <cppcoro/sync_wait.hpp>
+#include <cppcoro/task.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "iptv_channel.h"
+#include "playlist.h"
+
+using namespace std::literals;
+
+namespace pefti::bench {
+
+static constexpr std::array kCountries{"US"sv, "UK"sv, "CA"sv, "DE"sv,
+                                       "FR"sv, "ES"sv, "IT"sv, "PT"sv};
+static constexpr std::array kGroups{
+    "USA"sv,    "United Kingdom"sv, "Canada"sv, "Germany"sv,
+    "France"sv, "Spain"sv,          "Italy"sv,  "Portugal"sv};
+static constexpr std::array kNetworks{
+    "CNN"sv,       "BBC"sv,         "Fox"sv,      "ESPN"sv,
+    "Sky"sv,       "Discovery"sv,   "History"sv,  "HBO"sv,
+    "Eurosport"sv, "Canal+"sv,      "RTL"sv,      "TF1"sv,
+    "Rai"sv,       "TVE"sv,         "ARD"sv,      "ZDF"sv,
+    "MTV"sv,       "Nickelodeon"sv, "CBS"sv,      "NBC"sv};
+static constexpr std::array kGenres{
+    "News"sv,   "Sports"sv, "Movies"sv, "Kids"sv,        "Music"sv,
+    "Series"sv, "Comedy"sv, "Weather"sv, "Documentary"sv};
+static constexpr std::array kQualities{
+    ""sv, " SD"sv, " HD"sv, " FHD"sv, " 4K"sv, " 720"sv, " 1080"sv};
+static constexpr std::array kExcludedQualities{"SD"sv, "4K"sv, "720"sv};
+static constexpr std::array kWords{
+    "the"sv,     "news"sv,    "tonight"sv, "live"sv,    "world"sv,
+    "match"sv,   "season"sv,  "episode"sv, "final"sv,   "report"sv,
+    "journey"sv, "history"sv, "wild"sv,    "city"sv,    "family"sv,
+    "music"sv,   "special"sv, "morning"sv, "weekend"sv, "story"sv};
+
+// Start of the generated programme schedules
+static constexpr std::int64_t kEpgStart{1'700'000'000};
+
+template <std::size_t size>
+static std::string_view pick(const std::array<std::string_view, size>& words,
+                             std::mt19937& random) {
+  return words[std::uniform_int_distribution<std::size_t>{0, size - 1}(
+      random)];
+}
+
+static void append_words(std::string& text, std::size_t num_words,
+                         std::mt19937& random) {
+  for (std::size_t i{0}; i < num_words; ++i) {
+    if (i > 0) text += ' ';
+    text += pick(kWords, random);
+  }
+}
+
+// Formats a time as an XMLTV date, e.g. "20231114221320 +0000"
+static std::string format_xmltv_time(std::int64_t time) {
+  const auto seconds = static_cast<std::time_t>(time);
+  std::tm tm{};
+  gmtime_r(&seconds, &tm);
+  std::array<char, 32> text{};
+  std::strftime(text.data(), text.size(), "%Y%m%d%H%M%S +0000", &tm);
+  return text.data();
+}
+
+std::vector<std::string> generate_channel_names(std::size_t num_channels,
+                                                std::uint32_t seed) {
+  std::mt19937 random{seed};
+  std::vector<std::string> names;
+  names.reserve(num_channels);
+  for (std::size_t i{0}; i < num_channels; ++i) {
+    std::string name{pick(kCountries, random)};
+    name += ": "sv;
+    name += pick(kNetworks, random);
+    name += ' ';
+    name += pick(kGenres, random);
+    // Most providers number the variants of a channel
+    if (i % 3 != 0) name += ' ' + std::to_string(i % 97);
+    name += pick(kQualities, random);
+    names.push_back(std::move(name));
+  }
+  return names;
+}
+
+std::string get_tvg_id(std::size_t index) {
+  return "channel"s + std::to_string(index) + ".tv"s;
+}
+
+std::string generate_playlist(std::size_t num_channels, std::uint32_t seed) {
+  std::mt19937 random{seed};
+  const auto names = generate_channel_names(num_channels, seed);
+  std::string playlist{"#EXTM3U\n"};
+  playlist.reserve(num_channels * 220);
+  for (std::size_t i{0}; i < num_channels; ++i) {
+    playlist += "#EXTINF:-1 tvg-id=\""sv;
+    playlist += get_tvg_id(i);
+    playlist += "\" tvg-name=\""sv;
+    playlist += names[i];
+    playlist += "\" tvg-logo=\"http://logos.example.com/"sv;
+    playlist += std::to_string(random() % 10'000);
+    playlist += ".png\" group-title=\""sv;
+    playlist += pick(kGroups, random);
+    playlist += "\","sv;
+    playlist += names[i];
+    playlist += "\nhttp://stream.example.com/live/user/pass/"sv;
+    playlist += std::to_string(100'000 + i);
+    playlist += ".ts\n"sv;
+  }
+  return playlist;
+}
+
+// Channels are written first, then the programmes are written in rounds of
+// one programme per channel until the document reaches `size`
+std::string generate_epg(std::size_t size, std::size_t num_channels,
+                         std::uint32_t seed) {
+  if (num_channels == 0)
+    throw std::invalid_argument("An EPG needs at least one channel"s);
+  std::mt19937 random{seed};
+  const auto names = generate_channel_names(num_channels, seed);
+  std::string epg{
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<!DOCTYPE tv SYSTEM \"xmltv.dtd\">\n"
+      "<tv generator-info-name=\"pefti-bench\">\n"};
+  epg.reserve(size + 4096);
+  for (std::size_t i{0}; i < num_channels; ++i) {
+    epg += "  <channel id=\""sv;
+    epg += get_tvg_id(i);
+    epg += "\">\n    <display-name lang=\"en\">"sv;
+    epg += names[i];
+    epg += "</display-name>\n    <icon src=\"http://logos.example.com/"sv;
+    epg += std::to_string(i);
+    epg += ".png\" />\n  </channel>\n"sv;
+  }
+  std::vector<std::int64_t> next_start(num_channels, kEpgStart);
+  std::uniform_int_distribution<int> num_slots{1, 6};
+  std::string title;
+  for (std::size_t i{0}; epg.size() < size; i = (i + 1) % num_channels) {
+    const auto start = next_start[i];
+    const auto stop = start + num_slots(random) * 1800;
+    next_start[i] = stop;
+    title.clear();
+    append_words(title, 2 + random() % 4, random);
+    epg += "  <programme start=\""sv;
+    epg += format_xmltv_time(start);
+    epg += "\" stop=\""sv;
+    epg += format_xmltv_time(stop);
+    epg += "\" channel=\""sv;
+    epg += get_tvg_id(i);
+    epg += "\">\n    <title lang=\"en\">"sv;
+    epg += title;
+    epg += "</title>\n    <desc lang=\"en\">"sv;
+    append_words(epg, 12 + random() % 30, random);
+    epg += " &amp; more.</desc>\n    <category lang=\"en\">"sv;
+    epg += pick(kGenres, random);
+    epg += "</category>\n  </programme>\n"sv;
+  }
+  epg += "</tv>\n"sv;
+  return epg;
+}
+
+// Each template includes a network and a genre, some also exclude a
+// quality, as in configurations that pick one variant of each channel
+// Returns `strings` as a TOML array of strings
+static std::string to_toml_array(const std::vector<std::string>& strings) {
+  std::string array{"["};
+  for (std::size_t i{0}; i < strings.size(); ++i) {
+    if (i > 0) array += ", "sv;
+    array += '"' + strings[i] + '"';
+  }
+  return array + ']';
+}
+
+std::string generate_config(std::size_t num_templates, std::uint32_t seed,
+                            const ConfigOptions& options) {
+  std::mt19937 random{seed};
+  std::string config{"[resources]\nplaylists = "};
+  config += to_toml_array(options.playlists);
+  config += "\nnew_playlist = \""sv;
+  config += options.new_playlist;
+  config += "\"\n"sv;
+  if (!options.epgs.empty()) {
+    config += "epgs = "sv;
+    config += to_toml_array(options.epgs);
+    config += "\nnew_epg = \""sv;
+    config += options.new_epg;
+    config += "\"\n"sv;
+  }
+  config +=
+      "[groups]\n"
+      "block = [\"Adult\", \"Radio\", \"Religious\", \"Shopping\"]\n"
+      "allow = []\n"
+      "[urls]\n"
+      "block = [\"http://stream.example.com/live/user/pass/100000.ts\"]\n"
+      "[channels]\n"
+      "number_of_duplicates = "sv;
+  config += std::to_string(options.number_of_duplicates);
+  config +=
+      "\nsort_qualities = [\"4K\", \"FHD\", \"1080\", \"HD\", \"720\"]\n"
+      "tags_block = [\"tvg-logo\"]\n"
+      "block = [\"XXX\", \"PPV\", \"Backup\", \"Test\"]\n"
+      "allow = [\n"sv;
+  for (std::size_t i{0}; i < num_templates; ++i) {
+    config += "  {i = [\""sv;
+    config += pick(kNetworks, random);
+    config += "\", \""sv;
+    config += pick(kGenres, random);
+    if (i >= kNetworks.size() * kGenres.size()) {
+      // Keeps the templates distinct when there are more of them than
+      // combinations of networks and genres
+      config += " "sv;
+      config += std::to_string(i % 97);
+    }
+    config += "\"]"sv;
+    if (random() % 4 == 0) {
+      config += ", e = [\""sv;
+      config += pick(kExcludedQualities, random);
+      config += "\"]"sv;
+    }
+    config += ", n = \"Channel "sv;
+    config += std::to_string(i);
+    config += "\"},\n"sv;
+  }
+  config += "]\n"sv;
+  return config;
+}
+
+static cppcoro::task<> push_back_channels(Playlist& playlist,
+                                          std::vector<std::string> names) {
+  for (std::size_t i{0}; i < names.size(); ++i) {
+    IptvChannel channel;
+    channel.set_original_name(names[i]);
+    channel.set_new_name(names[i]);
+    channel.set_url("http://stream.example.com/live/user/pass/"s +
+                    std::to_string(100'000 + i) + ".ts"s);
+    channel.set_tag(IptvChannel::kTagTvgId, get_tvg_id(i));
+    channel.set_tag(IptvChannel::kTagGroupTitle, "USA"sv);
+    co_await playlist.push_back(std::move(channel));
+  }
+}
+
+void add_channels(Playlist& playlist, std::size_t num_channels,
+                  std::uint32_t seed) {
+  cppcoro::sync_wait(
+      push_back_channels(playlist, generate_channel_names(num_channels, seed)));
+  playlist.freeze_tvg_ids();
+}
+
+std::string write_temp_file(std::string_view name, std::string_view content) {
+  const auto filename =
+      (std::filesystem::temp_directory_path() / name).string();
+  std::ofstream file{filename, std::ios::binary | std::ios::trunc};
+  file.write(content.data(), static_cast<std::streamsize>(content.size()));
+  if (!file) throw std::runtime_error("Failed to write "s + filename);
+  return filename;
+}
+
+}  // namespace pefti::bench
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "playlist.h"
+
+namespace pefti::bench {
+
+// Generators of synthetic inputs for the benchmarks. The same seed always
+// produces the same output, so runs can be compared.
+
+// Channel names in the style of IPTV providers, e.g. "US: CNN News HD"
+std::vector<std::string> generate_channel_names(std::size_t num_channels,
+                                                std::uint32_t seed = 1);
+
+// Returns the tvg-id of the channel at `index`, channel IDs in generated
+// EPGs use the same scheme
+std::string get_tvg_id(std::size_t index);
+
+// An M3U playlist with tvg-id, tvg-name, tvg-logo and group-title tags
+std::string generate_playlist(std::size_t num_channels,
+                              std::uint32_t seed = 1);
+
+// An XMLTV document of about `size` bytes for `num_channels` channels, with
+// the programmes of each channel in time order
+std::string generate_epg(std::size_t size, std::size_t num_channels,
+                         std::uint32_t seed = 1);
+
+// Settings of a generated configuration that are not generated
+struct ConfigOptions {
+  std::vector<std::string> playlists{"http://example.com/playlist.m3u"};
+  std::vector<std::string> epgs;
+  std::string new_playlist{"new.m3u"};
+  std::string new_epg;
+  int number_of_duplicates{0};
+};
+
+// A TOML configuration with `num_templates` channel templates and the block
+// lists of a typical configuration
+std::string generate_config(std::size_t num_templates, std::uint32_t seed = 1,
+                            const ConfigOptions& options = {});
+
+// Adds the channels of a generated playlist to `playlist` and builds its
+// tvg-id lookup table
+void add_channels(Playlist& playlist, std::size_t num_channels,
+                  std::uint32_t seed = 1);
+
+// Writes `content` to a file in the temporary directory and returns the
+// name of the file
+std::string write_temp_file(std::string_view name, std::string_view content);
+
+}  // namespace pefti::bench
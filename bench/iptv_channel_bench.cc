@@ -0,0 +1,44 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "generators.h"
+#include "iptv_channel.h"
+
+using namespace std::literals;
+
+namespace pefti::bench {
+
+static constexpr std::size_t kNumChannels{10'000};
+
+// Writes channels with the tags of a typical playlist in M3U format
+static void BM_WriteIptvChannel(benchmark::State& state) {
+  const auto names = generate_channel_names(kNumChannels);
+  std::vector<IptvChannel> channels(kNumChannels);
+  for (std::size_t i{0}; i < kNumChannels; ++i) {
+    auto& channel = channels[i];
+    channel.set_original_name(names[i]);
+    channel.set_new_name(names[i]);
+    channel.set_url("http://stream.example.com/live/user/pass/" +
+                    std::to_string(100'000 + i) + ".ts");
+    channel.set_tag(IptvChannel::kTagTvgId, get_tvg_id(i));
+    channel.set_tag("tvg-name", names[i]);
+    channel.set_tag("tvg-logo", "http://logos.example.com/" +
+                                    std::to_string(i) + ".png");
+    channel.set_tag(IptvChannel::kTagGroupTitle, "USA"sv);
+  }
+  std::ostringstream stream;
+  for (auto _ : state) {
+    stream.str({});
+    for (auto& channel : channels) stream << channel;
+    benchmark::DoNotOptimize(stream.tellp());
+  }
+  state.SetItemsProcessed(state.iterations() * kNumChannels);
+}
+BENCHMARK(BM_WriteIptvChannel)->Unit(benchmark::kMicrosecond);
+
+}  // namespace pefti::bench
@@ -0,0 +1,70 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "generators.h"
+#include "iptv_channel.h"
+#include "mapper.h"
+
+namespace pefti::bench {
+
+// Channel names matched against the templates in each iteration
+static constexpr std::size_t kNumChannels{10'000};
+
+static std::vector<IptvChannel> make_channels(std::size_t num_channels) {
+  std::vector<IptvChannel> channels(num_channels);
+  const auto names = generate_channel_names(num_channels);
+  for (std::size_t i{0}; i < num_channels; ++i)
+    channels[i].set_original_name(names[i]);
+  return channels;
+}
+
+static std::string make_config_file(std::size_t num_templates) {
+  return write_temp_file(
+      "pefti_bench_mapper_" + std::to_string(num_templates) + ".toml",
+      generate_config(num_templates));
+}
+
+// Every name is matched against the templates, as in the first run over a
+// playlist
+static void BM_MapChannelToTemplateCold(benchmark::State& state) {
+  auto filename = make_config_file(static_cast<std::size_t>(state.range(0)));
+  ConfigType config(filename);
+  auto channels = make_channels(kNumChannels);
+  for (auto _ : state) {
+    ChannelsMapper mapper;
+    mapper.set_config(config);
+    for (auto& channel : channels)
+      benchmark::DoNotOptimize(mapper.map_channel_to_template(channel));
+  }
+  state.SetItemsProcessed(state.iterations() * channels.size());
+}
+BENCHMARK(BM_MapChannelToTemplateCold)
+    ->RangeMultiplier(10)
+    ->Range(10, 10'000)
+    ->Unit(benchmark::kMillisecond);
+
+// Every name is found in the memo table, as for names repeated across
+// playlists and runs in daemon mode
+static void BM_MapChannelToTemplateWarm(benchmark::State& state) {
+  auto filename = make_config_file(static_cast<std::size_t>(state.range(0)));
+  ConfigType config(filename);
+  auto channels = make_channels(kNumChannels);
+  ChannelsMapper mapper;
+  mapper.set_config(config);
+  for (auto& channel : channels) mapper.map_channel_to_template(channel);
+  for (auto _ : state) {
+    for (auto& channel : channels)
+      benchmark::DoNotOptimize(mapper.map_channel_to_template(channel));
+  }
+  state.SetItemsProcessed(state.iterations() * channels.size());
+}
+BENCHMARK(BM_MapChannelToTemplateWarm)
+    ->RangeMultiplier(10)
+    ->Range(10, 10'000)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace pefti::bench
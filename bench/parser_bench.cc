@@ -0,0 +1,95 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cppcoro/static_thread_pool.hpp>
+#include <cppcoro/sync_wait.hpp>
+#include <cppcoro/task.hpp>
+#include <cppcoro/when_all.hpp>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "buffers.h"
+#include "generators.h"
+#include "parser.h"
+#include "playlist_snapshot.h"
+
+using namespace std::literals;
+
+namespace pefti::bench {
+
+// Written after the playlist, as by the Loader
+static constexpr auto kPlaylistSentinel = "\x89\x89"sv;
+
+// Writes `text` to the ring buffer in the chunk size of the Loader
+static cppcoro::task<> produce(cppcoro::static_thread_pool& tp,
+                               PlaylistLoaderParserBuffer& buffer,
+                               std::string_view text) {
+  co_await tp.schedule();
+  const auto kBufferSize = buffer.get_size();
+  const auto kIndexMask = buffer.get_index_mask();
+  while (!text.empty()) {
+    const auto range = co_await buffer.claim_up_to(
+        std::min(text.size(), kBufferSize >> 1), tp);
+    const auto start = *range.begin() & kIndexMask;
+    const auto num_chars = *range.end() - *range.begin();
+    const auto num_chars_to_end = std::min(num_chars, kBufferSize - start);
+    std::memcpy(&buffer.data[start], text.data(), num_chars_to_end);
+    std::memcpy(&buffer.data[0], text.data() + num_chars_to_end,
+                num_chars - num_chars_to_end);
+    text.remove_prefix(num_chars);
+    buffer.sequencer.publish(*range.end() - 1);
+  }
+}
+
+// Reads the parsed channels until the sentinel
+static cppcoro::task<> consume(cppcoro::static_thread_pool& tp,
+                               PlaylistParserFilterBuffer& buffer) {
+  co_await tp.schedule();
+  const auto kIndexMask = buffer.get_index_mask();
+  std::size_t read_index{0};
+  while (true) {
+    const std::size_t write_index =
+        co_await buffer.wait_until_published(read_index, tp);
+    do {
+      auto& channel = buffer.data[read_index & kIndexMask];
+      if (channel.get_original_name() == kSentinel) co_return;
+      benchmark::DoNotOptimize(channel);
+    } while (read_index++ != write_index);
+    buffer.barrier.publish(read_index);
+  }
+}
+
+// Line splitting and EXTINF attribute extraction, the Parser is fed from a
+// ring buffer as in the playlist pipeline
+static void BM_Parse(benchmark::State& state) {
+  const auto num_channels = static_cast<std::size_t>(state.range(0));
+  const auto playlist = generate_playlist(num_channels) +
+                        std::string{kPlaylistSentinel};
+  const auto directory =
+      (std::filesystem::temp_directory_path() / "pefti_bench_snapshots")
+          .string();
+  cppcoro::static_thread_pool tp;
+  for (auto _ : state) {
+    auto lp_buffer = std::make_unique<PlaylistLoaderParserBuffer>();
+    auto pf_buffer = std::make_unique<PlaylistParserFilterBuffer>();
+    auto parser = std::make_unique<Parser>();
+    PlaylistSnapshot snapshot(directory, "http://example.com/bench.m3u");
+    cppcoro::sync_wait(cppcoro::when_all(
+        produce(tp, *lp_buffer, playlist),
+        parser->parse(tp, *lp_buffer, *pf_buffer, snapshot),
+        consume(tp, *pf_buffer)));
+  }
+  state.SetItemsProcessed(state.iterations() * num_channels);
+  state.SetBytesProcessed(state.iterations() * playlist.size());
+}
+BENCHMARK(BM_Parse)
+    ->RangeMultiplier(10)
+    ->Range(1'000, 1'000'000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace pefti::bench
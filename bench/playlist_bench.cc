@@ -0,0 +1,37 @@
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "generators.h"
+#include "playlist.h"
+
+namespace pefti::bench {
+
+// Looks up the channel IDs of an EPG with twice as many channels as the
+// playlist, so half of the lookups fail
+static void BM_IsTvgIdInPlaylist(benchmark::State& state) {
+  const auto num_channels = static_cast<std::size_t>(state.range(0));
+  auto filename =
+      write_temp_file("pefti_bench_playlist.toml", generate_config(10));
+  ConfigType config(filename);
+  Playlist playlist(config);
+  add_channels(playlist, num_channels);
+  std::vector<std::string> tvg_ids;
+  tvg_ids.reserve(2 * num_channels);
+  for (std::size_t i{0}; i < 2 * num_channels; ++i)
+    tvg_ids.push_back(get_tvg_id(i));
+  for (auto _ : state) {
+    for (const auto& tvg_id : tvg_ids)
+      benchmark::DoNotOptimize(playlist.is_tvg_id_in_playlist(tvg_id));
+  }
+  state.SetItemsProcessed(state.iterations() * tvg_ids.size());
+}
+BENCHMARK(BM_IsTvgIdInPlaylist)
+    ->RangeMultiplier(10)
+    ->Range(1'000, 1'000'000)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace pefti::bench
@@ -0,0 +1,242 @@
+#include "upstream_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <gsl/gsl>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "hash.h"
+
+using namespace std::literals;
+
+namespace pefti::bench {
+
+// Largest request line and headers that are accepted
+static constexpr std::size_t kMaxRequestSize{16 * 1024};
+// Size of the pieces of a body that is sent at a limited bandwidth
+static constexpr std::size_t kSliceSize{16 * 1024};
+
+static void check(int result, std::string_view what) {
+  if (result < 0)
+    throw std::runtime_error(std::string{what} + ": "s +
+                             std::strerror(errno));
+}
+
+static std::string compress_gzip(std::string_view content) {
+  z_stream stream{};
+  // Window bits of 15 + 16 write a gzip header and trailer
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    throw std::runtime_error("deflateInit2() failed"s);
+  auto end_stream = gsl::finally([&stream]() { deflateEnd(&stream); });
+  std::string output(deflateBound(&stream, content.size()), '\0');
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(content.data()));
+  stream.avail_in = static_cast<uInt>(content.size());
+  stream.next_out = reinterpret_cast<Bytef*>(output.data());
+  stream.avail_out = static_cast<uInt>(output.size());
+  if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+    throw std::runtime_error("deflate() failed"s);
+  output.resize(stream.total_out);
+  return output;
+}
+
+static bool send_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    const auto num_sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (num_sent < 0 && errno == EINTR) continue;
+    if (num_sent <= 0) return false;
+    data.remove_prefix(static_cast<std::size_t>(num_sent));
+  }
+  return true;
+}
+
+// Returns the request line and headers, or an empty string if the client
+// closed the connection or sent too much
+static std::string receive_head(int fd) {
+  std::string head;
+  std::array<char, 4096> buffer;
+  while (head.find("\r\n\r\n"sv) == std::string::npos) {
+    const auto num_received = recv(fd, buffer.data(), buffer.size(), 0);
+    if (num_received < 0 && errno == EINTR) continue;
+    if (num_received <= 0 || head.size() > kMaxRequestSize) return {};
+    head.append(buffer.data(), static_cast<std::size_t>(num_received));
+  }
+  return head;
+}
+
+static bool accepts_gzip(std::string head) {
+  std::ranges::transform(head, head.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  const auto start = head.find("\r\naccept-encoding:"sv);
+  if (start == std::string::npos) return false;
+  const auto end = head.find("\r\n"sv, start + 2);
+  return std::string_view{head}.substr(start, end - start).find("gzip"sv) !=
+         std::string_view::npos;
+}
+
+static void send_status(int fd, std::string_view status) {
+  send_all(fd, "HTTP/1.1 "s + std::string{status} +
+                   "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"s);
+}
+
+UpstreamServer::UpstreamServer() {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  check(listen_fd_, "socket()"sv);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  try {
+    check(bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+               sizeof(address)),
+          "bind()"sv);
+    check(listen(listen_fd_, SOMAXCONN), "listen()"sv);
+    socklen_t size{sizeof(address)};
+    check(getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+                      &size),
+          "getsockname()"sv);
+  } catch (...) {
+    close(listen_fd_);
+    throw;
+  }
+  port_ = ntohs(address.sin_port);
+  accept_thread_ = std::thread([this]() { accept_connections(); });
+}
+
+// Shutting down the listening socket wakes the thread blocked in accept()
+UpstreamServer::~UpstreamServer() {
+  shutdown(listen_fd_, SHUT_RDWR);
+  accept_thread_.join();
+  for (auto& thread : connection_threads_) thread.join();
+  close(listen_fd_);
+}
+
+void UpstreamServer::add(std::string path, std::string content,
+                         bool can_fail) {
+  resources_.insert_or_assign(std::move(path),
+                              Resource{std::move(content), {}, can_fail});
+}
+
+std::string UpstreamServer::get_url(std::string_view path) const {
+  return "http://127.0.0.1:"s + std::to_string(port_) + std::string{path};
+}
+
+void UpstreamServer::set_shape(const NetworkShape& shape) {
+  std::lock_guard lock{mutex_};
+  shape_ = shape;
+}
+
+void UpstreamServer::accept_connections() {
+  while (true) {
+    const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0 && errno == EINTR) continue;
+    if (fd < 0) break;
+    std::lock_guard lock{mutex_};
+    connection_threads_.emplace_back(
+        [this, fd, shape = shape_]() { serve(fd, shape); });
+  }
+}
+
+// Compressed on first use, so that generating large inputs is not slowed
+// down when gzip is not used
+std::string_view UpstreamServer::get_gzip_content(Resource& resource) {
+  std::lock_guard lock{mutex_};
+  if (resource.gzip_content.empty())
+    resource.gzip_content = compress_gzip(resource.content);
+  return resource.gzip_content;
+}
+
+bool UpstreamServer::is_failing(std::string_view path,
+                                const NetworkShape& shape) const {
+  constexpr std::uint64_t kScale{1'000'000};
+  const auto iter = resources_.find(path);
+  if (iter == resources_.end() || !iter->second.can_fail) return false;
+  return hash_bytes(path, shape.seed) % kScale <
+         static_cast<std::uint64_t>(shape.failure_rate * kScale);
+}
+
+// The body is sent in slices that are paced to the bandwidth of the shape
+void UpstreamServer::serve(int fd, NetworkShape shape) {
+  auto close_fd = gsl::finally([fd]() { close(fd); });
+  const auto head = receive_head(fd);
+  if (head.empty()) return;
+  const std::string_view request_line{head.data(), head.find("\r\n"sv)};
+  if (!request_line.starts_with("GET "sv)) {
+    send_status(fd, "405 Method Not Allowed"sv);
+    return;
+  }
+  const auto target = request_line.substr(4, request_line.find(' ', 4) - 4);
+  std::this_thread::sleep_for(shape.latency);
+  const auto iter = resources_.find(target);
+  if (iter == resources_.end()) {
+    send_status(fd, "404 Not Found"sv);
+    return;
+  }
+  auto& resource = iter->second;
+  if (is_failing(target, shape)) {
+    send_status(fd, "503 Service Unavailable"sv);
+    return;
+  }
+  const bool is_gzip = shape.is_gzip && accepts_gzip(head);
+  const std::string_view body =
+      is_gzip ? get_gzip_content(resource) : resource.content;
+  const bool is_chunked = shape.chunk_size > 0;
+  std::string response_head{"HTTP/1.1 200 OK\r\nContent-Type: "};
+  response_head += target.ends_with(".xml"sv) ? "application/xml"sv
+                                              : "audio/x-mpegurl"sv;
+  if (is_gzip) response_head += "\r\nContent-Encoding: gzip"sv;
+  if (is_chunked)
+    response_head += "\r\nTransfer-Encoding: chunked"sv;
+  else
+    response_head += "\r\nContent-Length: "s + std::to_string(body.size());
+  response_head += "\r\nConnection: close\r\n\r\n"sv;
+  if (!send_all(fd, response_head)) return;
+  std::size_t slice_size{body.size()};
+  if (is_chunked)
+    slice_size = shape.chunk_size;
+  else if (shape.bandwidth > 0)
+    slice_size = kSliceSize;
+  const auto start = std::chrono::steady_clock::now();
+  std::array<char, 24> chunk_head;
+  for (std::size_t sent{0}; sent < body.size();) {
+    const auto slice = body.substr(sent, slice_size);
+    if (shape.bandwidth > 0) {
+      std::this_thread::sleep_until(
+          start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::duration<double>(
+                          static_cast<double>(sent) / shape.bandwidth)));
+    }
+    if (is_chunked) {
+      const auto size = std::snprintf(chunk_head.data(), chunk_head.size(),
+                                      "%zx\r\n", slice.size());
+      if (!send_all(fd, {chunk_head.data(), static_cast<std::size_t>(size)}))
+        return;
+    }
+    if (!send_all(fd, slice)) return;
+    if (is_chunked && !send_all(fd, "\r\n"sv)) return;
+    sent += slice.size();
+  }
+  if (is_chunked) send_all(fd, "0\r\n\r\n"sv);
+}
+
+}  // namespace pefti::bench
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace pefti::bench {
+
+// How the responses of an UpstreamServer are sent
+struct NetworkShape {
+  // Bytes per second of each response, 0 is unlimited
+  std::size_t bandwidth{0};
+  // Delay before the response headers are sent
+  std::chrono::milliseconds latency{0};
+  // Size of the pieces that the body is sent in. If it is not 0 then the
+  // body is sent with chunked transfer encoding.
+  std::size_t chunk_size{0};
+  // Bodies are sent gzip encoded to clients that accept gzip
+  bool is_gzip{false};
+  // Fraction of the resources that can fail which are answered with a 503
+  double failure_rate{0.0};
+  std::uint32_t seed{1};
+};
+
+// A stand-in for the servers of IPTV providers, serves resources from
+// memory over HTTP/1.1 on localhost. Each connection is handled on a thread
+// of its own and closed after one response. Which resources fail is decided
+// by a hash of their path and the seed, so the same resources fail in every
+// run.
+class UpstreamServer {
+ public:
+  // Listens on an ephemeral port of 127.0.0.1. Throws std::runtime_error if
+  // the socket cannot be set up.
+  UpstreamServer();
+  ~UpstreamServer();
+  UpstreamServer(UpstreamServer&) = delete;
+  UpstreamServer(UpstreamServer&&) = delete;
+  UpstreamServer& operator=(UpstreamServer&) = delete;
+  UpstreamServer& operator=(UpstreamServer&&) = delete;
+
+  // Serves `content` at `path`. Must be called before the server is used.
+  void add(std::string path, std::string content, bool can_fail);
+  // Returns the URL of `path`
+  std::string get_url(std::string_view path) const;
+  // Returns true if `path` is answered with a 503 under `shape`
+  bool is_failing(std::string_view path, const NetworkShape& shape) const;
+  // Applies to the connections accepted after the call
+  void set_shape(const NetworkShape& shape);
+
+ private:
+  struct Resource {
+    std::string content;
+    // Empty until a client accepts gzip
+    std::string gzip_content;
+    bool can_fail;
+  };
+
+ private:
+  void accept_connections();
+  std::string_view get_gzip_content(Resource& resource);
+  void serve(int fd, NetworkShape shape);
+
+ private:
+  int listen_fd_{-1};
+  std::uint16_t port_{0};
+  std::map<std::string, Resource, std::less<>> resources_;
+  // Guards the shape, the connection threads and the gzip variants
+  std::mutex mutex_;
+  NetworkShape shape_;
+  std::vector<std::thread> connection_threads_;
+  std::thread accept_thread_;
+};
+
+}  // namespace pefti::bench
@@ -4,9 +4,13 @@
 #include <cppcoro/single_producer_sequencer.hpp>
 #include <cppcoro/static_thread_pool.hpp>
 #include <cppcoro/task.hpp>
+#include <string>
+#include <vector>
 
 #include "config.h"
 #include "filter.h"
+#include "http_client.h"
+#include "http_server.h"
 #include "loader.h"
 #include "mapper.h"
 #include "parser.h"
@@ -22,21 +26,43 @@ class Application {
   Application(const Application&&) = delete;
   void operator=(Application&) = delete;
   void operator=(Application&&) = delete;
+  // Returns the URLs of the playlists and EPGs
+  std::vector<std::string> get_urls();
   void run();
+  // Runs again in daemon mode, using the thread pool and the downloads of
+  // the daemon
+  void refresh(cppcoro::static_thread_pool& tp, const HttpClient& http_client);
+  // Serves the outputs of later runs from `http_server`
+  void set_http_server(HttpServer& http_server) {
+    http_server_ = &http_server;
+  }
 
  private:
-  cppcoro::task<> process_playlists(cppcoro::static_thread_pool& tp);
-  cppcoro::task<> process_epgs(cppcoro::static_thread_pool& tp);
+  // Set by process_playlists() when the channels of the new playlist are
+  // complete, or when processing the playlists has failed and the EPG is
+  // not written. Each run has its own event, so an event that a failed run
+  // left set cannot release the EPGs of the next run early.
+  struct IptvChannelsEvent {
+    cppcoro::single_consumer_async_auto_reset_event event;
+    bool has_failed{false};
+  };
+
+ private:
+  cppcoro::task<> process(cppcoro::static_thread_pool& tp);
+  cppcoro::task<> process_playlists(cppcoro::static_thread_pool& tp,
+                                    IptvChannelsEvent& have_iptv_channels);
+  cppcoro::task<> process_epgs(cppcoro::static_thread_pool& tp,
+                               IptvChannelsEvent& have_iptv_channels);
 
  private:
   ConfigType config_;
   Playlist playlist_;
   Loader loader_;
-  Parser parser_;
   Filter filter_;
   Transformer transformer_;
   ChannelsMapper channels_mapper_;
-  cppcoro::single_consumer_async_auto_reset_event have_iptv_channels_;
+  const HttpClient* http_client_{nullptr};
+  HttpServer* http_server_{nullptr};
 };
 
 }  // namespace pefti
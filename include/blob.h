@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+using namespace std::literals;
+
+namespace pefti {
+
+// Binary format used to cache data between runs. A blob consists of a
+// header, a table of interned strings and the data. Values are stored in
+// native byte order, so blobs are only valid on the machine that wrote
+// them. The header identifies the type of blob, its version and a key,
+// e.g. the hash of the file that the blob was derived from.
+struct BlobHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t reserved;
+  std::uint64_t key;
+  std::uint64_t strings_size;
+  std::uint64_t data_size;
+  std::uint64_t checksum;
+};
+
+class BlobWriter {
+ public:
+  template <typename T>
+  void write(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  // Writes the number of elements followed by the elements. The elements
+  // are aligned to 8 bytes so that they can be used in place when the blob
+  // is mapped into memory.
+  template <typename T>
+  void write_array(std::span<const T> values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    write(static_cast<std::uint64_t>(values.size()));
+    data_.append(reinterpret_cast<const char*>(values.data()),
+                 values.size_bytes());
+    pad();
+  }
+
+  // Strings are interned, each distinct string is stored once
+  void write_string(std::string_view string) { write(add_string(string)); }
+
+  // Interns a string and returns its ID, for records that refer to strings
+  std::uint32_t add_string(std::string_view string);
+
+  template <typename Range>
+  void write_strings(const Range& strings) {
+    write(static_cast<std::uint64_t>(std::size(strings)));
+    for (const auto& string : strings) write_string(string);
+  }
+
+  // Returns the complete blob
+  std::string finish(std::string_view magic, std::uint32_t version,
+                     std::uint64_t key) const;
+
+ private:
+  void pad();
+
+ private:
+  std::string data_;
+  std::vector<std::string_view> strings_;
+  std::unordered_map<std::string, std::uint32_t> string_ids_;
+};
+
+class BlobReader {
+ public:
+  // Throws std::runtime_error if `blob` is not a valid blob with the
+  // expected magic, version and key. `blob` must stay valid while the
+  // reader and the strings and arrays that it returns are in use.
+  BlobReader(std::string_view blob, std::string_view magic,
+             std::uint32_t version, std::uint64_t key);
+
+  template <typename T>
+  T read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    std::memcpy(&value, consume(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  // Returns a view of an array written by BlobWriter::write_array()
+  template <typename T>
+  std::span<const T> view_array() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const auto size = read<std::uint64_t>();
+    if (size > data_.size() / sizeof(T))
+      throw std::runtime_error("Invalid array in cached data"s);
+    const auto elements = consume(size * sizeof(T));
+    skip_padding();
+    return {reinterpret_cast<const T*>(elements), size};
+  }
+
+  template <typename T>
+  void read_array(std::vector<T>& values) {
+    const auto view = view_array<T>();
+    values.assign(view.begin(), view.end());
+  }
+
+  std::string_view read_string() { return get_string(read<std::uint32_t>()); }
+
+  // Returns a string by the ID returned by BlobWriter::add_string()
+  std::string_view get_string(std::uint32_t id) const;
+
+  // Reads strings into a vector or a set
+  template <typename Container>
+  void read_strings(Container& strings) {
+    const auto size = read<std::uint64_t>();
+    for (std::uint64_t i{0}; i < size; ++i) {
+      if constexpr (requires { strings.push_back(std::string{}); })
+        strings.push_back(std::string{read_string()});
+      else
+        strings.insert(std::string{read_string()});
+    }
+  }
+
+  bool is_at_end() const { return data_.empty(); }
+
+ private:
+  const char* consume(std::size_t size);
+  void skip_padding();
+
+ private:
+  std::string_view data_;
+  std::size_t offset_{0};
+  std::vector<std::string_view> strings_;
+};
+
+}  // namespace pefti
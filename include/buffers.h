@@ -3,14 +3,71 @@
 #include <array>
 #include <cppcoro/single_producer_sequencer.hpp>
 #include <cppcoro/static_thread_pool.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
 
 #include "iptv_channel.h"
+#include "stats.h"
+#include "trace.h"
 
 using namespace std::literals;
 
 namespace pefti {
 
-template <typename T, std::size_t size>
+// Awaits an operation of a ring buffer, recording how long the awaiting
+// coroutine was suspended for if stats or tracing are enabled. The
+// operation is constructed in place because cppcoro operations cannot be
+// moved once they are awaited.
+template <typename Operation, Stats::Ring ring, bool is_claim>
+class TimedRingOperation {
+ public:
+  template <typename MakeOperation>
+  TimedRingOperation(MakeOperation make_operation, std::size_t index,
+                     std::size_t size, std::uint32_t source_id)
+      : operation_(make_operation()),
+        index_(index),
+        size_(size),
+        source_id_(source_id) {}
+
+  bool await_ready() { return operation_.await_ready(); }
+
+  template <typename Handle>
+  decltype(auto) await_suspend(Handle handle) {
+    if (Stats::is_enabled() || Trace::is_enabled()) {
+      start_ = Stats::Clock::now();
+      if (Trace::is_enabled()) start_thread_ = Trace::get_thread_id();
+    }
+    return operation_.await_suspend(handle);
+  }
+
+  decltype(auto) await_resume() {
+    if (start_ == Stats::Clock::time_point{})
+      return operation_.await_resume();
+    const auto end = Stats::Clock::now();
+    decltype(auto) result = operation_.await_resume();
+    if constexpr (is_claim)
+      Stats::add_claim_wait(ring, end - start_);
+    else
+      Stats::add_publish_wait(ring, end - start_, result + 1 - index_, size_);
+    Trace::add_ring_wait(ring, is_claim, source_id_, start_, end,
+                         start_thread_);
+    return result;
+  }
+
+ private:
+  Operation operation_;
+  std::size_t index_;
+  std::size_t size_;
+  std::uint32_t source_id_;
+  Stats::Clock::time_point start_;
+  std::uint32_t start_thread_{0};
+};
+
+// Producers claim slots and consumers wait for published slots through the
+// member functions, so that the time that the stages wait for each other is
+// recorded. `source_id` identifies the playlist in traces.
+template <typename T, std::size_t size, Stats::Ring ring>
 class CoroutineSingleProducerBuffer {
  public:
   CoroutineSingleProducerBuffer() : sequencer(barrier, size) {}
@@ -18,18 +75,41 @@ class CoroutineSingleProducerBuffer {
   cppcoro::sequence_barrier<std::size_t> barrier;
   cppcoro::single_producer_sequencer<size_t> sequencer;
   cppcoro::static_thread_pool* thread_pool;
+  std::uint32_t source_id{0};
   constexpr auto get_index_mask() { return size - 1; };
   constexpr auto get_size() { return size; };
 
+  auto claim_one(cppcoro::static_thread_pool& tp) {
+    auto make_operation = [&] { return sequencer.claim_one(tp); };
+    return TimedRingOperation<decltype(make_operation()), ring, true>(
+        make_operation, 0, size, source_id);
+  }
+  auto claim_up_to(std::size_t count, cppcoro::static_thread_pool& tp) {
+    auto make_operation = [&] { return sequencer.claim_up_to(count, tp); };
+    return TimedRingOperation<decltype(make_operation()), ring, true>(
+        make_operation, 0, size, source_id);
+  }
+  auto wait_until_published(std::size_t index,
+                            cppcoro::static_thread_pool& tp) {
+    auto make_operation = [&] {
+      return sequencer.wait_until_published(index, tp);
+    };
+    return TimedRingOperation<decltype(make_operation()), ring, false>(
+        make_operation, index, size, source_id);
+  }
+
  private:
 };
 
 using PlaylistLoaderParserBuffer =
-    CoroutineSingleProducerBuffer<char8_t, 64 * 1024>;
+    CoroutineSingleProducerBuffer<char8_t, 64 * 1024,
+                                  Stats::Ring::kLoaderParser>;
 using PlaylistParserFilterBuffer =
-    CoroutineSingleProducerBuffer<IptvChannel, 64>;
+    CoroutineSingleProducerBuffer<IptvChannel, 64,
+                                  Stats::Ring::kParserFilter>;
 using PlaylistFilterTransformerBuffer =
-    CoroutineSingleProducerBuffer<IptvChannel, 64>;
+    CoroutineSingleProducerBuffer<IptvChannel, 64,
+                                  Stats::Ring::kFilterTransformer>;
 
 static constexpr auto kSentinel = "SENTINEL"sv;
 
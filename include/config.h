@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <ranges>
 #include <string>
 #include <string_view>
@@ -9,6 +12,8 @@
 
 #include "config_reader.h"
 #include "iptv_channel.h"
+#include "template_matcher.h"
+#include "xmltv_time.h"
 
 using namespace std::literals;
 
@@ -29,6 +34,8 @@ template <typename ConfigReader>
 class Config : public ConfigReader {
  public:
   enum class DuplicatesLocation { kNone, kInline, kAppend };
+  enum class EpgOutputMode { kRebuild, kVerbatim };
+  enum class EpgParser { kLibxml2, kScanner };
 
  public:
   explicit Config(std::string& config_filename);
@@ -45,6 +52,11 @@ class Config : public ConfigReader {
     return config_.blocked_tags | std::ranges::views::all;
   }
 
+  const ChannelTemplate& get_channel_template(
+      IptvChannel::TemplateId template_id) {
+    return config_.channels_templates[template_id];
+  }
+
   decltype(auto) get_channels_templates() {
     return config_.channels_templates | std::ranges::views::all;
   }
@@ -54,6 +66,24 @@ class Config : public ConfigReader {
   // Returns an enum representing the value of [channels].duplicates_location
   const DuplicatesLocation& get_duplicates_location() noexcept;
 
+  // Returns an enum representing the value of [epg].output
+  EpgOutputMode get_epg_output_mode() const noexcept {
+    return epg_output_mode_;
+  }
+
+  // Returns an enum representing the value of [epg].parser
+  EpgParser get_epg_parser() const noexcept { return epg_parser_; }
+
+  // Returns the times of the programmes to keep, from [epg].past_hours and
+  // [epg].future_hours relative to [epg].reference_time or the current time
+  TimeWindow get_epg_time_window();
+
+  // Returns the memory budget in bytes for sorting programmes when merging
+  // EPGs, from [epg].merge_memory_mb
+  std::size_t get_epg_merge_memory_budget() const noexcept {
+    return std::size_t(std::max(config_.epg_merge_memory_mb, 1)) << 20;
+  }
+
   const std::vector<std::string>& get_epgs_urls() noexcept;
 
   // Returns number of channels in [channels].allow in configuration file
@@ -75,26 +105,66 @@ class Config : public ConfigReader {
   // Returns the filenames specified in [files].playlists
   const std::vector<std::string>& get_playlists_urls();
 
+  // Returns the directory for the snapshots of the parsed playlists and the
+  // indexes of the EPGs, next to the configuration file
+  const std::string& get_snapshot_directory() const noexcept {
+    return snapshot_directory_;
+  }
+
+  // Returns the index of the first entry in [channels].sort_qualities that
+  // is contained in `channel_name`, lower is better. Returns the number of
+  // entries if there is no match. `channel_name` must be a normalized name.
+  int get_quality_rank(std::string_view channel_name);
+
+  // Returns the tags that are set on the channels of a template: the tags of
+  // the template, plus the copied group-title, minus the blocked tags
+  const std::vector<IptvChannel::Tag>& get_tag_patch(
+      IptvChannel::TemplateId template_id) {
+    return tag_patches_[template_id];
+  }
+
+  // Returns the matcher compiled from the channel templates
+  const TemplateMatcher& get_template_matcher() const noexcept {
+    return template_matcher_;
+  }
+
   decltype(auto) get_sort_qualities() {
     return config_.sort_qualities | std::ranges::views::all;
   }
 
   bool is_allowed_group(std::string_view group_name);
-  bool is_blocked_channel(std::string_view original_channel_name);
+  // `channel_name` must be a normalized name, see normalize_name()
+  bool is_blocked_channel(std::string_view channel_name);
   bool is_blocked_group(std::string_view group_name);
   bool is_blocked_url(std::string_view url);
 
+  // Returns the value of [epg].merge
+  bool is_epg_merge_enabled() const noexcept { return config_.epg_merge; }
+
+  // Returns the value of [epg].parallel_parse
+  bool is_epg_parallel_parse_enabled() const noexcept {
+    return config_.epg_parallel_parse;
+  }
+
  private:
   struct PeftiConfig {
     std::vector<std::string> playlists_urls;
     std::string new_playlist_filename;
     std::vector<std::string> epgs_urls;
     std::string new_epg_filename;
+    std::string epg_output_mode;
+    int epg_past_hours{-1};
+    int epg_future_hours{-1};
+    std::string epg_reference_time;
+    bool epg_merge{false};
+    int epg_merge_memory_mb{256};
+    std::string epg_parser;
+    bool epg_parallel_parse{false};
     std::unordered_set<std::string> blocked_groups;
     std::unordered_set<std::string> allowed_groups;
     std::unordered_set<std::string> blocked_urls;
-    bool copy_group_title;
-    int num_duplicates;
+    bool copy_group_title{false};
+    int num_duplicates{0};
     std::string duplicates_location;
     std::vector<std::string> sort_qualities;
     std::vector<std::string> blocked_tags;
@@ -102,11 +172,21 @@ class Config : public ConfigReader {
     std::vector<ChannelTemplate> channels_templates;
   };
 
+  bool load_compiled_config(std::uint64_t source_hash);
+  void merge_tag_patches();
+  void normalize_names();
+  void read_config();
+  void store_compiled_config(std::uint64_t source_hash);
+
  private:
   PeftiConfig config_;
   DuplicatesLocation duplicates_location_;
-
-  friend class ChannelsMapper;
+  EpgOutputMode epg_output_mode_;
+  EpgParser epg_parser_;
+  TemplateMatcher template_matcher_;
+  std::vector<std::vector<IptvChannel::Tag>> tag_patches_;
+  std::string compiled_config_filename_;
+  std::string snapshot_directory_;
 };
 
 using ConfigType = Config<TomlConfigReader>;
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cppcoro/static_thread_pool.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "application.h"
+#include "http_client.h"
+#include "http_server.h"
+
+namespace pefti {
+
+// Runs the application periodically in one long-running process. The thread
+// pool, the HTTP connections and the downloaded resources are kept between
+// refreshes. The Application, with the compiled configuration and its
+// caches, is only created again when the configuration file changes. A
+// refresh is skipped when neither the configuration nor any resource has
+// changed. If a port is given then the outputs are also served over HTTP.
+class Daemon {
+ public:
+  // `port` is 0 if the outputs are not served, otherwise they are served
+  // on `listen_address`
+  Daemon(std::string config_filename, std::chrono::seconds interval,
+         const std::string& listen_address, std::uint16_t port);
+  Daemon(Daemon&) = delete;
+  Daemon(Daemon&&) = delete;
+  Daemon& operator=(Daemon&) = delete;
+  Daemon& operator=(Daemon&&) = delete;
+  // Refreshes the outputs every `interval` until SIGINT or SIGTERM is
+  // received. A failed refresh is reported and retried at the next interval.
+  void run();
+
+ private:
+  void refresh();
+
+ private:
+  std::string config_filename_;
+  std::chrono::seconds interval_;
+  cppcoro::static_thread_pool thread_pool_;
+  HttpClient http_client_;
+  std::unique_ptr<HttpServer> http_server_;
+  std::unique_ptr<Application> application_;
+  std::uint64_t config_hash_{0};
+  bool are_outputs_current_{false};
+};
+
+}  // namespace pefti
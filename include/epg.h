@@ -1,12 +1,33 @@
 #pragma once
 
+#include <cppcoro/static_thread_pool.hpp>
+#include <cppcoro/task.hpp>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "epg_index.h"
+#include "xmltv_time.h"
+
 namespace pefti {
 
 class Epg {};
 
+// Returns the file that the index of the EPG at `url` is saved to
+std::string get_epg_index_filename(const std::string& directory,
+                                   std::string_view url);
+
+// Indexes an EPG on a thread of the pool. If `is_parallel` is set then a
+// large EPG is split into chunks that are indexed on several threads. If
+// `index_filename` is not empty then the index is loaded from that file
+// when the EPG has not changed, and saved to it otherwise. `source_id` is
+// the position of the EPG in the configuration.
+cppcoro::task<> index_epg(cppcoro::static_thread_pool& tp,
+                          std::string_view epg, std::uint32_t source_id,
+                          const TimeWindow& time_window, bool use_scanner,
+                          bool is_parallel, const std::string& index_filename,
+                          EpgIndex& epg_index);
 std::vector<std::string> load_epgs(const std::vector<std::string>& urls);
 
 }  // namespace pefti
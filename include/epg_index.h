@@ -0,0 +1,156 @@
+#pragma once
+
+#include <libxml/parser.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "xmltv_time.h"
+
+namespace pefti {
+
+// Index of the <channel> and <programme> elements of an XMLTV document.
+// Each element is recorded with its channel ID and the location of its
+// bytes in the document, so the elements of the channels that are kept can
+// be copied without parsing the document again. Indexing does not depend on
+// the playlist, so it can run while the playlists are still being processed.
+class EpgIndex {
+ public:
+  using ChannelId = std::uint32_t;
+  static constexpr std::int64_t kNoTime = INT64_MIN;
+
+  struct Element {
+    std::uint64_t offset;
+    std::uint32_t size;
+    ChannelId channel_id;
+    // Start and stop times of programmes in seconds since the Unix epoch,
+    // kNoTime if missing or not valid
+    std::int64_t start;
+    std::int64_t stop;
+  };
+
+ public:
+  EpgIndex() = default;
+  EpgIndex(EpgIndex&) = delete;
+  EpgIndex(EpgIndex&&) = delete;
+  EpgIndex& operator=(EpgIndex&) = delete;
+  EpgIndex& operator=(EpgIndex&&) = delete;
+
+  // Parses `epg` and indexes its elements. Documents that are not UTF-8 are
+  // converted first. Programmes outside `time_window` are not indexed.
+  // If `use_scanner` is set then UTF-8 documents are indexed with
+  // XmltvScanner, falling back to libxml2 if the scanner does not support
+  // the document. `epg` must outlive the index.
+  void build(std::string_view epg, const TimeWindow& time_window = {},
+             bool use_scanner = false);
+
+  // Indexing a large EPG can be split into chunks that are indexed
+  // concurrently:
+  // - split() returns consecutive ranges of the content of the root
+  //   element. The first range starts after the start tag of the root
+  //   element, the others start at a <channel> or <programme> start tag.
+  //   Returns an empty vector if `epg` is not UTF-8 or cannot be split.
+  // - build_chunk() indexes one range on its own, as a document made of the
+  //   bytes of `epg` up to the first range, the range and the end tag of the
+  //   root element. Throws if this document cannot be parsed, e.g. because
+  //   a range ends in a comment or CDATA section, in which case `epg` must
+  //   be indexed with build() instead.
+  // - join() builds the index of `epg` from the indexes of its ranges, the
+  //   result is the same as from build().
+  static std::vector<std::string_view> split(std::string_view epg,
+                                             std::size_t num_chunks);
+  void build_chunk(std::string_view epg, std::size_t header_size,
+                   std::string_view chunk, const TimeWindow& time_window = {},
+                   bool use_scanner = false);
+  void join(std::string_view epg, std::span<const EpgIndex> chunk_indexes);
+
+  // The index of an EPG can be saved and loaded instead of parsing the EPG
+  // again when it has not changed. `epg_hash` is the hash of `epg`, an index
+  // is only loaded for the EPG that it was saved for. load() returns false
+  // if there is no valid index in the file. save() does nothing if the EPG
+  // was converted to UTF-8, and errors are ignored. Time windows move, so
+  // an index that is saved should be built without one and the window
+  // applied with apply_time_window() afterwards.
+  bool load(const std::string& filename, std::string_view epg,
+            std::uint64_t epg_hash);
+  void save(const std::string& filename, std::uint64_t epg_hash) const;
+
+  // Removes the programmes outside `time_window`, the result is the same
+  // as building the index with `time_window`
+  void apply_time_window(const TimeWindow& time_window);
+
+  // Channel IDs in order of first appearance, indexed by ChannelId
+  const std::vector<std::string>& get_channel_ids() const noexcept {
+    return channel_ids_;
+  }
+  // Elements in document order
+  std::span<const Element> get_channels() const noexcept { return channels_; }
+  std::span<const Element> get_programmes() const noexcept {
+    return programmes_;
+  }
+  // Returns the bytes of the document from the end of the XML declaration
+  // up to the root element, e.g. the DOCTYPE declaration
+  std::string_view get_prolog() const noexcept { return prolog_; }
+  // Returns whether the DOCTYPE declaration in the prolog may have an
+  // internal subset, which can declare entities that the elements use. A
+  // '[' anywhere in the prolog counts, so this can be a false positive.
+  bool has_internal_subset() const noexcept {
+    return prolog_.find('[') != std::string_view::npos;
+  }
+  std::string_view get_text(const Element& element) const noexcept {
+    return source_.substr(element.offset, element.size);
+  }
+
+ private:
+  // Allows looking up channel IDs by std::string_view
+  struct StringHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view text) const noexcept {
+      return std::hash<std::string_view>{}(text);
+    }
+  };
+
+  // SAX handlers
+  static void handler_start_element(void* context, const xmlChar* localname,
+                                    const xmlChar*, const xmlChar*, int,
+                                    const xmlChar**, int nb_attributes, int,
+                                    const xmlChar** attributes);
+  static void handler_end_element(void* context, const xmlChar* localname,
+                                  const xmlChar*, const xmlChar*);
+
+  ChannelId add_channel_id(std::string_view channel_id);
+  void clear();
+  bool is_in_time_window(std::int64_t start, std::int64_t stop) const;
+  void parse_programme_times(int num_attributes, const xmlChar** attributes);
+  std::uint64_t get_parser_offset() const;
+  void parse(bool ignore_declared_encoding);
+  bool scan();
+
+ private:
+  std::string converted_source_;
+  std::string_view source_;
+  std::string_view prolog_;
+  std::vector<std::string> channel_ids_;
+  std::unordered_map<std::string, ChannelId, StringHash, std::equal_to<>>
+      channel_id_lookup_;
+  std::vector<Element> channels_;
+  std::vector<Element> programmes_;
+
+  // Parser state
+  TimeWindow time_window_;
+  xmlParserCtxtPtr parser_context_{nullptr};
+  int depth_{0};
+  std::uint64_t element_offset_{0};
+  ChannelId element_channel_id_{0};
+  std::int64_t element_start_{kNoTime};
+  std::int64_t element_stop_{kNoTime};
+  std::vector<Element>* element_list_{nullptr};
+};
+
+}  // namespace pefti
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "epg_index.h"
+#include "playlist.h"
+
+namespace pefti {
+
+// Merges EPGs that cover the same channels. The EPGs are in order of
+// priority, the first EPG has the highest priority.
+// - Each channel in the playlist is written once, from the first EPG that
+//   has it.
+// - Programmes are written in order of channel and start time. A programme
+//   is dropped if it overlaps a programme of the same channel from an EPG
+//   with a higher priority, or if it has the same start time as the
+//   previous programme of the same channel from the same EPG. Programmes
+//   without a valid start time are always written.
+// The programmes are sorted as fixed-size records. If the records do not
+// fit in the memory budget then sorted runs are spilled to a temporary file
+// and merged.
+class EpgMerger {
+ public:
+  // `source` is the position of the EPG of the element in `epg_indexes`
+  using WriteElement =
+      std::function<void(std::uint32_t source, std::string_view text)>;
+
+  EpgMerger(const std::vector<EpgIndex>& epg_indexes, const Playlist& playlist,
+            std::size_t memory_budget, std::string spill_filename);
+  EpgMerger(EpgMerger&) = delete;
+  EpgMerger(EpgMerger&&) = delete;
+  EpgMerger& operator=(EpgMerger&) = delete;
+  EpgMerger& operator=(EpgMerger&&) = delete;
+  ~EpgMerger();
+
+  void merge(const WriteElement& write_channel,
+             const WriteElement& write_programme);
+
+ private:
+  static constexpr std::uint32_t kNotKept = UINT32_MAX;
+
+  // Sort key and location of one programme
+  struct Record {
+    std::uint32_t channel_key;
+    std::uint32_t source;
+    std::uint32_t element;
+    std::int64_t start;
+    std::int64_t stop;
+
+    auto get_sort_key() const {
+      return std::tuple{channel_key, start, source, element};
+    }
+  };
+
+  // A sorted run of records in the spill file
+  struct Run {
+    std::uint64_t offset;
+    std::uint64_t num_records;
+  };
+
+  void add_record(const Record& record);
+  void assign_channel_keys();
+  void merge_runs(const WriteElement& write_programme);
+  void resolve_channel(std::vector<Record>& records,
+                       const WriteElement& write_programme);
+  void spill_run();
+  void write_channels(const WriteElement& write_channel);
+
+ private:
+  const std::vector<EpgIndex>& epg_indexes_;
+  const Playlist& playlist_;
+  std::size_t max_records_in_memory_;
+  std::string spill_filename_;
+  std::fstream spill_stream_;
+
+  // Channel key of each channel ID of each EPG, kNotKept if the channel is
+  // not in the playlist. Keys are assigned in order of EPG priority.
+  std::vector<std::vector<std::uint32_t>> channel_keys_;
+  std::uint32_t num_channel_keys_{0};
+
+  std::vector<Record> records_;
+  std::vector<Run> runs_;
+};
+
+}  // namespace pefti
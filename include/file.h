@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace pefti {
+
+// Read-only memory mapping of a whole file. The file is unmapped when the
+// object is destroyed.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  // Throws std::runtime_error if the file cannot be opened or mapped
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+  MappedFile(MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&) = delete;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  std::string_view get_data() const { return {data_, size_}; }
+
+ private:
+  void unmap() noexcept;
+
+ private:
+  const char* data_{nullptr};
+  std::size_t size_{0};
+};
+
+// Writes `data` to a temporary file in the same directory as `filename`
+// then renames it, so readers never see a partially written file.
+// Throws std::runtime_error on failure.
+void write_file_atomically(const std::string& filename, std::string_view data);
+
+}  // namespace pefti
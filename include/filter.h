@@ -2,6 +2,8 @@
 
 #include <cppcoro/static_thread_pool.hpp>
 #include <cppcoro/task.hpp>
+#include <ostream>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -9,6 +11,8 @@
 #include "buffers.h"
 #include "config.h"
 #include "epg.h"
+#include "epg_index.h"
+#include "http_server.h"
 #include "iptv_channel.h"
 #include "mapper.h"
 #include "playlist.h"
@@ -27,15 +31,34 @@ class Filter {
   Filter(Filter&&) = delete;
   Filter& operator=(Filter&) = delete;
   Filter& operator=(Filter&&) = delete;
-  void filter(std::vector<std::string>&& epgs,
-              std::string_view new_epg_filename);
+  cppcoro::task<> filter(cppcoro::static_thread_pool& tp,
+                         const std::vector<EpgIndex>& epg_indexes,
+                         std::string_view new_epg_filename,
+                         HttpServer* http_server);
   cppcoro::task<> filter(cppcoro::static_thread_pool& tp,
                          PlaylistParserFilterBuffer& pf_buffer,
                          PlaylistFilterTransformerBuffer& ft_buffer);
 
  private:
-  void copy_xml_nodes(const std::string& epg, std::string_view node_name,
-                      std::ofstream& new_epg_stream);
+  void copy_indexed_nodes(const EpgIndex& epg_index,
+                          std::span<const EpgIndex::Element> channels,
+                          std::span<const EpgIndex::Element> programmes,
+                          std::ostream& channel_destination,
+                          std::ostream& programme_destination);
+  void copy_xml_nodes(const std::string& epg,
+                      std::ostream& channel_destination,
+                      std::ostream& programme_destination);
+  cppcoro::task<> filter_epg(cppcoro::static_thread_pool& tp,
+                             const EpgIndex& epg_index,
+                             std::span<const EpgIndex::Element> channels,
+                             std::span<const EpgIndex::Element> programmes,
+                             std::ostream& channel_destination,
+                             std::ostream& programme_destination);
+  cppcoro::task<> merge_epgs(cppcoro::static_thread_pool& tp,
+                             const std::vector<EpgIndex>& epg_indexes,
+                             std::string spill_filename,
+                             std::ostream& channel_destination,
+                             std::ostream& programme_destination);
   cppcoro::task<> publish_sentinel(cppcoro::static_thread_pool& tp,
                                    PlaylistFilterTransformerBuffer& ft_buffer);
 
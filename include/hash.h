@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace pefti {
+
+// Computes the 64-bit XXH64 hash of data that can be supplied in pieces,
+// e.g. while it is being downloaded or written. Used to detect changes to
+// files and resources, it is not a cryptographic hash.
+class Hasher {
+ public:
+  explicit Hasher(std::uint64_t seed = 0);
+  void update(std::string_view data);
+  std::uint64_t digest() const;
+
+ private:
+  static constexpr std::size_t kStripeSize = 32;
+
+  std::array<std::uint64_t, 4> accumulators_;
+  std::array<char, kStripeSize> stripe_;
+  std::size_t stripe_size_{0};
+  std::uint64_t total_size_{0};
+  std::uint64_t seed_;
+};
+
+// Returns the XXH64 hash of `data`
+std::uint64_t hash_bytes(std::string_view data, std::uint64_t seed = 0);
+
+// Returns `hash` as 16 hexadecimal digits
+std::string to_hex(std::uint64_t hash);
+
+}  // namespace pefti
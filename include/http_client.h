@@ -0,0 +1,59 @@
+#pragma once
+
+#include <curl/curl.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace pefti {
+
+// Downloads resources for daemon mode, where the client is kept between
+// refreshes. Connections, DNS lookups and TLS sessions are reused by all
+// transfers. The body and validators (ETag, Last-Modified) of each resource
+// are kept, so a resource that has not changed is requested conditionally
+// and is not downloaded again.
+class HttpClient {
+ public:
+  HttpClient();
+  ~HttpClient();
+  HttpClient(HttpClient&) = delete;
+  HttpClient(HttpClient&&) = delete;
+  HttpClient& operator=(HttpClient&) = delete;
+  HttpClient& operator=(HttpClient&&) = delete;
+
+  // Downloads the resources concurrently. Returns true if any resource has
+  // changed since the previous call. If a resource cannot be downloaded
+  // then its previous body is kept, a warning is printed if there is no
+  // previous body.
+  bool fetch(const std::vector<std::string>& urls);
+
+  // Returns the body of a resource downloaded by fetch(), or nullptr if the
+  // resource has not been downloaded
+  const std::string* find_body(const std::string& url) const;
+  // Throws std::runtime_error if the resource has not been downloaded
+  const std::string& get_body(const std::string& url) const;
+  std::uint64_t get_hash(const std::string& url) const;
+
+ private:
+  struct Resource {
+    std::string body;
+    std::uint64_t hash{0};
+    std::string etag;
+    std::string last_modified;
+  };
+
+ private:
+  CURLM* multi_handle_;
+  CURLSH* share_handle_;
+  std::unordered_map<std::string, Resource> resources_;
+};
+
+// Stores the value of an ETag or Last-Modified header, `header` is a line
+// received by a CURLOPT_HEADERFUNCTION callback
+void read_validator(std::string_view header, std::string& etag,
+                    std::string& last_modified);
+
+}  // namespace pefti
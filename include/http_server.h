@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace pefti {
+
+// Serves the new playlist and EPG over HTTP/1.1 from memory, on a thread of
+// its own that waits for sockets with epoll. Each output is served at the
+// name of its file without the directory and without a .gz or .zst
+// extension, e.g. new_epg = "/srv/epg.xml.gz" is served at /epg.xml.
+//
+// Responses have an ETag and a 304 is sent for a matching If-None-Match.
+// A gzip variant that is compressed when the output is published is sent
+// to clients that accept gzip. A single byte range of the uncompressed
+// output is sent for a Range request. Publishing replaces the output with
+// a pointer swap, responses that are being sent keep the previous version.
+class HttpServer {
+ public:
+  // Listens on `address`, a numeric IPv4 or IPv6 address. "::" listens on
+  // all interfaces. Throws std::runtime_error if the socket cannot be set
+  // up.
+  HttpServer(const std::string& address, std::uint16_t port);
+  ~HttpServer();
+  HttpServer(HttpServer&) = delete;
+  HttpServer(HttpServer&&) = delete;
+  HttpServer& operator=(HttpServer&) = delete;
+  HttpServer& operator=(HttpServer&&) = delete;
+
+  // Replaces the output written to `filename`. Thread safe.
+  void publish(std::string_view filename, std::string content,
+               std::string gzip_content, std::uint64_t hash);
+
+ private:
+  struct Document {
+    std::string content;
+    std::string gzip_content;
+    std::string etag;
+    std::string gzip_etag;
+    std::string_view content_type;
+  };
+  struct Request;
+  struct Connection;
+
+ private:
+  void close_connection(Connection& connection);
+  void close_fds() noexcept;
+  std::shared_ptr<const Document> find_document(std::string_view path);
+  void handle_request(Connection& connection, const Request& request);
+  static Request parse_request(std::string_view head);
+  bool process(Connection& connection);
+  bool receive(Connection& connection);
+  bool send_response(Connection& connection);
+  void serve();
+  bool set_events(Connection& connection, std::uint32_t events);
+
+ private:
+  int listen_fd_{-1};
+  int epoll_fd_{-1};
+  // Written to stop the server thread
+  int event_fd_{-1};
+  std::mutex documents_mutex_;
+  std::map<std::string, std::shared_ptr<const Document>, std::less<>>
+      documents_;
+  std::thread thread_;
+};
+
+}  // namespace pefti
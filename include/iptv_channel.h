@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <fstream>
 #include <optional>
 #include <string>
@@ -20,6 +21,12 @@ class IptvChannel {
 
  public:
   using Tag = std::pair<std::string, std::string>;
+  using TemplateId = std::uint32_t;
+  static constexpr TemplateId kNoTemplate = UINT32_MAX;
+
+  // Why the Filter let the channel through
+  enum class AllowReason : std::uint8_t { kNone, kTemplate, kGroup, kAll };
+
   IptvChannel() = default;
   ~IptvChannel() = default;
   IptvChannel(const IptvChannel&) = default;
@@ -27,14 +34,34 @@ class IptvChannel {
   IptvChannel& operator=(const IptvChannel&) = default;
   IptvChannel& operator=(IptvChannel&&) = default;
   bool contains_tag(std::string_view tag_name);
+  AllowReason get_allow_reason() const noexcept { return allow_reason_; }
   void delete_tag(std::string_view tag_name);
   void delete_tags() { tags_.clear(); }
   const std::string& get_new_name() { return new_name_; }
+  // Returns the original name in the form used for matching, see
+  // normalize_name()
+  const std::string& get_normalized_name() { return normalized_name_; }
   const std::string& get_original_name() { return original_name_; }
+  int get_quality_rank() const noexcept { return quality_rank_; }
   std::optional<std::string> get_tag_value(std::string_view tag_name);
+  const std::unordered_map<std::string, std::string>& get_tags() const {
+    return tags_;
+  }
+  // Returns the index of the channel template that matched the channel,
+  // only valid if has_template() is true
+  TemplateId get_template_id() const noexcept { return template_id_; }
   const std::string& get_url() { return url_; }
+  bool has_template() const noexcept { return template_id_ != kNoTemplate; }
+  void set_allowed(AllowReason reason,
+                   TemplateId template_id = kNoTemplate) noexcept {
+    allow_reason_ = reason;
+    template_id_ = template_id;
+  }
   void set_new_name(std::string_view new_name) { new_name_ = new_name; }
   void set_original_name(std::string_view new_name);
+  void set_quality_rank(int quality_rank) noexcept {
+    quality_rank_ = quality_rank;
+  }
   void set_tag(std::string_view tag, std::string_view new_value);
   void set_tag(std::string_view tag, std::string& new_value);
   void set_tag(std::string_view tag, std::string&& new_value);
@@ -45,7 +72,11 @@ class IptvChannel {
  private:
   std::string new_name_;
   std::string original_name_;
+  std::string normalized_name_;
   std::string url_;
+  int quality_rank_{0};
+  TemplateId template_id_{kNoTemplate};
+  AllowReason allow_reason_{AllowReason::kNone};
   std::unordered_map<std::string, std::string> tags_{};
 
  public:
@@ -5,10 +5,17 @@
 #include <string>
 
 #include "buffers.h"
+#include "http_client.h"
+#include "playlist_snapshot.h"
 
 namespace pefti {
 
-// Loads playlists.
+// Loads playlists. If an HttpClient is set then the playlists are read from
+// its downloads instead of being downloaded.
+//
+// A playlist that is unchanged since its snapshot was saved, or that cannot
+// be downloaded, is not loaded. The snapshot is replayed by the Parser
+// instead.
 class Loader {
  public:
   Loader() {}
@@ -18,14 +25,22 @@ class Loader {
   Loader& operator=(Loader&&) = delete;
   cppcoro::task<> load(cppcoro::static_thread_pool& tp,
                        PlaylistLoaderParserBuffer& buffer,
-                       const std::string& url);
+                       PlaylistSnapshot& snapshot);
+  void set_http_client(const HttpClient& http_client) {
+    http_client_ = &http_client;
+  }
 
  private:
   static constexpr std::u8string kPlaylistSentinel = u8"\x89\x89";
   static constexpr auto kPlaylistSentinelSize = kPlaylistSentinel.length();
 
  private:
+  void load_from_http_client(PlaylistLoaderParserBuffer& buffer,
+                             PlaylistSnapshot& snapshot);
   void write_playlist_sentinel(PlaylistLoaderParserBuffer& buffer);
+
+ private:
+  const HttpClient* http_client_{nullptr};
 };
 
 }  // namespace pefti
@@ -1,46 +1,44 @@
 #pragma once
 
+#include <cstdint>
 #include <optional>
 #include <string>
 #include <string_view>
-#include <unordered_map>
 #include <vector>
 
 #include "config.h"
+#include "iptv_channel.h"
+#include "memo_table.h"
 
 namespace pefti {
 
-class IptvChannel;
 class Playlist;
 
 class ChannelsMapper {
  public:
-  const ChannelTemplate& get_channel_template(IptvChannel& iptv_channel);
-  bool is_allowed_channel(IptvChannel& iptv_channel);
-  std::vector<IptvChannel*>& map_template_to_channel(
-      ChannelTemplate& channel_template);
-  std::optional<ChannelTemplate*> map_channel_to_template(
-      IptvChannel& iptv_channel);
+  using TemplateId = IptvChannel::TemplateId;
+  // Index of a channel in the Playlist
+  using ChannelIndex = std::uint32_t;
+
+  // Returns the channels of a template, ordered by the Transformer
+  std::vector<ChannelIndex>& map_template_to_channel(TemplateId template_id);
+  // Returns the index of the first channel template that matches the
+  // channel name, if any
+  std::optional<TemplateId> map_channel_to_template(IptvChannel& iptv_channel);
   void populate_maps();
   void set_config(ConfigType& config);
   void set_playlist(Playlist& playlist);
-  void update_maps(IptvChannel* iptv_channel);
 
  private:
-  typedef std::unordered_map<ChannelTemplate*, std::vector<IptvChannel*>>
-      TemplateToChannelsMapper;
-  typedef std::unordered_map<IptvChannel*, ChannelTemplate*>
-      ChannelToTemplateMap;
-  typedef std::unordered_map<std::string, ChannelTemplate*> NameToTemplateMap;
+  // Channel names without a template map to IptvChannel::kNoTemplate
+  typedef ConcurrentMemoTable<TemplateId> NameToTemplateMap;
 
-  // Maps IPTV channel names to channel templates
+  // Maps IPTV channel names to channel templates, used by the Filter
+  // coroutines of all playlists
   NameToTemplateMap name_to_template_map_;
 
-  // Maps channel templates to IPTV channels
-  TemplateToChannelsMapper template_to_channels_map_;
-
-  // Maps IPTV channels to channel templates
-  ChannelToTemplateMap channel_to_template_map_;
+  // Maps template IDs to IPTV channels
+  std::vector<std::vector<ChannelIndex>> template_to_channels_map_;
 
   ConfigType* config_;
   Playlist* playlist_;
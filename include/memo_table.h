@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace pefti {
+
+// Thread-safe cache of values computed from strings. Keys are spread across
+// shards that each have their own reader/writer lock, so concurrent lookups
+// of cached keys rarely contend. Every result is cached, including "no
+// result" values, so each distinct key is computed exactly once.
+template <typename Value, std::size_t kNumShards = 64>
+class ConcurrentMemoTable {
+ public:
+  ConcurrentMemoTable() = default;
+  ConcurrentMemoTable(ConcurrentMemoTable&) = delete;
+  ConcurrentMemoTable(ConcurrentMemoTable&&) = delete;
+  ConcurrentMemoTable& operator=(ConcurrentMemoTable&) = delete;
+  ConcurrentMemoTable& operator=(ConcurrentMemoTable&&) = delete;
+
+  // Returns the cached value for `key`. If `key` has not been seen before
+  // then the value is computed by calling `compute()`. The shard is locked
+  // while computing so that racing callers do not compute the value twice.
+  template <typename Compute>
+  Value get_or_compute(const std::string& key, Compute&& compute) {
+    auto& shard = get_shard(key);
+    {
+      std::shared_lock lock(shard.mutex);
+      auto iter = shard.map.find(key);
+      if (iter != shard.map.end()) return iter->second;
+    }
+    std::unique_lock lock(shard.mutex);
+    auto iter = shard.map.find(key);
+    if (iter == shard.map.end())
+      iter = shard.map.emplace(key, std::invoke(compute)).first;
+    return iter->second;
+  }
+
+  void clear() {
+    for (auto& shard : shards_) {
+      std::unique_lock lock(shard.mutex);
+      shard.map.clear();
+    }
+  }
+
+ private:
+  struct alignas(64) Shard {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, Value> map;
+  };
+
+  Shard& get_shard(const std::string& key) {
+    return shards_[std::hash<std::string>{}(key) % kNumShards];
+  }
+
+ private:
+  std::array<Shard, kNumShards> shards_;
+};
+
+}  // namespace pefti
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace pefti {
+
+// Converts a channel name, or a text string from the configuration that is
+// compared with channel names, to the form used for matching:
+// - UTF-8 case folding for Latin, Greek and Cyrillic letters
+// - Accents are stripped, e.g. "É" becomes "e"
+// - Full-width ASCII variants are converted to ASCII, e.g. "２１" becomes "21"
+// - Runs of whitespace become a single space, leading and trailing
+//   whitespace is removed
+// Bytes that are not valid UTF-8 are copied unchanged.
+void normalize_name(std::string_view name, std::string& normalized);
+std::string normalize_name(std::string_view name);
+
+}  // namespace pefti
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cppcoro/static_thread_pool.hpp>
+#include <cppcoro/task.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "hash.h"
+#include "http_server.h"
+
+namespace pefti {
+
+// A new output file. A file named *.gz is written as gzip and a file named
+// *.zst as Zstandard, any other file is written as it is. Compressed data is
+// written in independent blocks, so the blocks are compressed concurrently
+// on the thread pool. A zstd block is a complete frame. A gzip block is a
+// deflate segment that ends with a sync flush, the segments are written in
+// a single gzip member, as pigz does, because many HTTP clients only
+// decompress the first member.
+//
+// Data written to get_stream() is buffered until flush() or close(), which
+// compress the buffered blocks and write them in order. Writers flush
+// periodically to bound the memory used by the buffer.
+//
+// The data is written to a temporary file and hashed while it is written.
+// close() renames the temporary file to the output file only if the hash
+// differs from the previous output, which is kept in a sidecar file named
+// *.hash. Clients never see a partially written file, and an unchanged
+// output keeps its modification time.
+class OutputFile {
+ public:
+  enum class Compression { kNone, kGzip, kZstd };
+
+ public:
+  // Throws std::runtime_error if the file cannot be created. If
+  // `http_server` is set then the data is also kept in memory, with a gzip
+  // variant, and published to the server on close().
+  explicit OutputFile(std::string_view filename,
+                      HttpServer* http_server = nullptr);
+  // Removes the temporary file if the output was not closed
+  ~OutputFile();
+  OutputFile(OutputFile&) = delete;
+  OutputFile(OutputFile&&) = delete;
+  OutputFile& operator=(OutputFile&) = delete;
+  OutputFile& operator=(OutputFile&&) = delete;
+
+  std::ostream& get_stream() noexcept;
+
+  // Writes all of the buffered data and publishes the file. Returns false if
+  // the data is the same as the previous output, which is then left as it
+  // is. Throws std::runtime_error if the file cannot be written.
+  cppcoro::task<bool> close(cppcoro::static_thread_pool& tp);
+
+  // Writes the rest of `source` to the file
+  cppcoro::task<> copy(cppcoro::static_thread_pool& tp, std::istream& source);
+
+  // Writes the buffered blocks that are complete
+  cppcoro::task<> flush(cppcoro::static_thread_pool& tp);
+
+ private:
+  std::string compress_block(std::string_view block,
+                             Compression compression) const;
+  std::string get_gzip_trailer() const;
+  bool publish();
+  cppcoro::task<> write_blocks(cppcoro::static_thread_pool& tp,
+                               bool is_last);
+
+ private:
+  std::string filename_;
+  std::string temp_filename_;
+  Compression compression_;
+  std::ofstream file_;
+  bool is_closed_{false};
+  // Hash of the uncompressed data
+  Hasher hasher_;
+  // CRC-32 and size of the uncompressed data, for the gzip trailer
+  std::uint32_t crc_{0};
+  std::uint64_t size_{0};
+  HttpServer* http_server_;
+  std::string content_;
+  std::string gzip_content_;
+  std::ostringstream buffer_{std::ios::out | std::ios::ate};
+};
+
+}  // namespace pefti
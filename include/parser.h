@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cppcoro/generator.hpp>
 #include <cppcoro/static_thread_pool.hpp>
 #include <cppcoro/task.hpp>
@@ -10,11 +11,14 @@
 
 #include "buffers.h"
 #include "iptv_channel.h"
+#include "playlist_snapshot.h"
 
 using namespace std::literals;
 
 namespace pefti {
 
+// Parses one playlist, a Parser keeps the position in its input buffer so
+// each playlist needs its own Parser.
 class Parser {
  private:
   enum class State { kWaitingForExtinf, kWaitingForUrl, kNumStates };
@@ -62,9 +66,13 @@ class Parser {
   Parser(Parser&&) = delete;
   Parser& operator=(Parser&) = delete;
   Parser& operator=(Parser&&) = delete;
+  // Parses the playlist in `lp_buffer` and records the channels in
+  // `snapshot`, or replays the channels of `snapshot` if the Loader has
+  // chosen to
   cppcoro::task<> parse(cppcoro::static_thread_pool& tp,
                         PlaylistLoaderParserBuffer& lp_buffer,
-                        PlaylistParserFilterBuffer& pf_buffer);
+                        PlaylistParserFilterBuffer& pf_buffer,
+                        PlaylistSnapshot& snapshot);
 
  private:
   static constexpr std::string_view kExtinf_ = "#EXTINF"sv;
@@ -72,10 +80,13 @@ class Parser {
 
   PlaylistLoaderParserBuffer* lp_buffer_;
   PlaylistParserFilterBuffer* pf_buffer_;
+  PlaylistSnapshot* snapshot_;
   size_t start_index_{0};
   size_t read_index_{0};
   std::array<StateBase*, static_cast<unsigned long>(State::kNumStates)> states_;
   StateBase* active_state_;
+  // Holds a line that wraps around the end of `lp_buffer_`
+  std::array<char8_t, 64 * 1024> line_buffer_;
 
   std::string_view get_line();
   bool have_received_line_feed();
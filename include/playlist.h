@@ -1,9 +1,12 @@
 #pragma once
 
 #include <cppcoro/task.hpp>
+#include <cstdint>
 #include <optional>
+#include <ostream>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -13,30 +16,85 @@
 
 namespace pefti {
 
+// The channels of the new playlist, stored as columns. Only the fields that
+// are needed after the Transformer are kept. The text of all channels is
+// appended to one buffer and the columns refer to it by offset, the tags
+// are stored already formatted for the output file.
 class Playlist {
+ public:
+  using Index = std::uint32_t;
+  using GroupId = std::uint32_t;
+  static constexpr GroupId kNoGroup = UINT32_MAX;
+
+ public:
+  Playlist(ConfigType& config) : config_(config) {}
+  Playlist(Playlist&) = delete;
+  Playlist(Playlist&&) = delete;
+  Playlist& operator=(Playlist&) = delete;
+  Playlist& operator=(Playlist&&) = delete;
+  // Removes all channels, the group-titles are kept so that group IDs stay
+  // the same between runs in daemon mode
+  void clear();
+  bool empty() const noexcept { return urls_.empty(); }
+  // Returns the ID of a group-title, if any channel has had it
+  std::optional<GroupId> find_group(std::string_view group_title) const;
+  GroupId get_group_id(Index index) const { return group_ids_[index]; }
+  std::string_view get_new_name(Index index) const {
+    return get_text(new_names_[index]);
+  }
+  int get_quality_rank(Index index) const { return quality_ranks_[index]; }
+  IptvChannel::TemplateId get_template_id(Index index) const {
+    return template_ids_[index];
+  }
+  std::string_view get_url(Index index) const { return get_text(urls_[index]); }
+  // Builds the tvg-id lookup table, must be called after the last channel
+  // is added and before is_tvg_id_in_playlist()
+  void freeze_tvg_ids();
+  // Thread safe once the lookup table is built
+  bool is_tvg_id_in_playlist(std::string_view tvg_id) const;
+  // `source_id` identifies the playlist that the channel came from in the
+  // trace, where the time spent waiting for the lock is recorded
+  cppcoro::task<> push_back(IptvChannel channel, std::uint32_t source_id = 0);
+  Index size() const noexcept { return static_cast<Index>(urls_.size()); }
+  // Writes a channel in M3U format, duplicates are written without tvg-id
+  void write_channel(std::ostream& stream, Index index,
+                     bool with_tvg_id) const;
+
  private:
-  using vi = std::vector<IptvChannel>::iterator;
+  // Location of a string in text_
+  struct TextRange {
+    std::uint32_t offset{0};
+    std::uint32_t size{0};
+  };
+  static constexpr TextRange kNoText{UINT32_MAX, 0};
+
+  TextRange append_text(std::string_view text);
+  std::string_view get_text(TextRange range) const {
+    return std::string_view{text_}.substr(range.offset, range.size);
+  }
 
  private:
   ConfigType& config_;
-  std::vector<IptvChannel> playlist_;
-  std::optional<std::unordered_set<std::string>> tvg_id_lookup_{};
 
- public:
-  Playlist(ConfigType& config) : config_(config) {}
-  decltype(playlist_.begin()) begin() { return playlist_.begin(); }
-  decltype(playlist_.cbegin()) cbegin() { return playlist_.cbegin(); }
-  decltype(playlist_.cend()) cend() { return playlist_.cend(); }
-  decltype(playlist_.empty()) empty() { return playlist_.empty(); }
-  decltype(playlist_.end()) end() { return playlist_.end(); }
-  vi erase(vi begin, vi end) { return playlist_.erase(begin, end); }
-  bool is_tvg_id_in_playlist(std::string_view tvg_id);
-  cppcoro::task<> push_back(IptvChannel channel);
-  decltype(playlist_.size()) size() { return playlist_.size(); }
+  // Columns, one entry per channel
+  std::vector<TextRange> new_names_;
+  std::vector<TextRange> urls_;
+  std::vector<GroupId> group_ids_;
+  std::vector<TextRange> tvg_ids_;
+  std::vector<IptvChannel::TemplateId> template_ids_;
+  std::vector<int> quality_ranks_;
+  // The tags except tvg-id, formatted as ` name="value"...`
+  std::vector<TextRange> tags_;
+
+  std::string text_;
+  std::vector<std::string> group_titles_;
+  std::unordered_map<std::string, GroupId> group_title_ids_;
+  std::optional<std::unordered_set<std::string_view>> tvg_id_lookup_{};
 };
 
 std::vector<std::string> load_playlists(const std::vector<std::string>& urls);
-void store_playlist(std::string_view filename, Playlist& playlist,
-                    ConfigType& config, ChannelsMapper& channels_mapperper);
+// Writes the new playlist to `file`
+void store_playlist(std::ostream& file, Playlist& playlist,
+                    ConfigType& config, ChannelsMapper& channels_mapper);
 
 }  // namespace pefti
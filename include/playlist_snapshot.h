@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cppcoro/static_thread_pool.hpp>
+#include <cppcoro/task.hpp>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "blob.h"
+#include "buffers.h"
+#include "file.h"
+#include "hash.h"
+
+namespace pefti {
+
+// The channels parsed from one playlist source, saved in a file so that an
+// unchanged playlist does not have to be parsed again. The file is a blob
+// of a string table and fixed-size records, it is mapped into memory and
+// the records are used in place. It also records the hash of the playlist
+// and its HTTP validators.
+//
+// A snapshot is shared by the Loader and the Parser of its source. The
+// Loader decides whether the saved channels are replayed instead of
+// parsing the playlist: when the playlist is unchanged, or when it cannot
+// be downloaded. Otherwise the Loader records the hash and validators of
+// the playlist, the Parser records the channels and saves the snapshot.
+class PlaylistSnapshot {
+ public:
+  // Loads the snapshot of `url` from `directory`, if there is a valid one
+  PlaylistSnapshot(const std::string& directory, const std::string& url);
+  PlaylistSnapshot(PlaylistSnapshot&) = delete;
+  PlaylistSnapshot(PlaylistSnapshot&&) = delete;
+  PlaylistSnapshot& operator=(PlaylistSnapshot&) = delete;
+  PlaylistSnapshot& operator=(PlaylistSnapshot&&) = delete;
+
+  // Returns true if a saved snapshot was loaded
+  bool is_loaded() const noexcept { return reader_.has_value(); }
+  std::uint64_t get_content_hash() const noexcept { return content_hash_; }
+  std::string_view get_etag() const noexcept { return etag_; }
+  std::string_view get_last_modified() const noexcept {
+    return last_modified_;
+  }
+  const std::string& get_url() const noexcept { return url_; }
+
+  // Used by the Loader
+  void add_content(std::string_view data) { hasher_.update(data); }
+  void set_content_hash(std::uint64_t hash) noexcept {
+    new_content_hash_ = hash;
+  }
+  void set_validators(std::string etag, std::string last_modified);
+  // The playlist was downloaded completely, so the snapshot can be saved
+  void set_complete() noexcept { is_complete_ = true; }
+  // The saved channels are used instead of parsing the playlist
+  void set_replayed() noexcept { is_replayed_ = true; }
+  bool is_replayed() const noexcept { return is_replayed_; }
+
+  // Used by the Parser, tags are added before the channel that has them
+  void add_tag(std::string_view name, std::string_view value);
+  void add_channel(std::string_view name, std::string_view url);
+  // Writes the saved channels to `pf_buffer`, as the Parser does
+  cppcoro::task<> replay(cppcoro::static_thread_pool& tp,
+                         PlaylistParserFilterBuffer& pf_buffer);
+  // Saves the recorded channels if the playlist was downloaded completely.
+  // Failing to save is not an error.
+  void save();
+
+ private:
+  struct ChannelRecord {
+    std::uint32_t name;
+    std::uint32_t url;
+    std::uint32_t first_tag;
+    std::uint32_t num_tags;
+  };
+  struct TagRecord {
+    std::uint32_t name;
+    std::uint32_t value;
+  };
+
+ private:
+  std::string filename_;
+  std::string url_;
+
+  // The saved snapshot
+  MappedFile file_;
+  std::optional<BlobReader> reader_;
+  std::uint64_t content_hash_{0};
+  std::string etag_;
+  std::string last_modified_;
+  std::span<const ChannelRecord> channels_;
+  std::span<const TagRecord> tags_;
+
+  // The new snapshot
+  bool is_complete_{false};
+  bool is_replayed_{false};
+  Hasher hasher_;
+  std::optional<std::uint64_t> new_content_hash_;
+  std::string new_etag_;
+  std::string new_last_modified_;
+  BlobWriter writer_;
+  std::vector<ChannelRecord> new_channels_;
+  std::vector<TagRecord> new_tags_;
+};
+
+}  // namespace pefti
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <curl/curl.h>
+
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace pefti {
@@ -9,4 +12,8 @@ namespace pefti {
 // in a string.
 std::vector<std::string> load_resources(const std::vector<std::string>& urls);
 
+// Records the timings of a finished transfer if stats or the trace are
+// enabled
+void add_download_stats(CURL* handle, std::string_view url);
+
 }  // namespace pefti
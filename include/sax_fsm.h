@@ -3,8 +3,9 @@
 #include <libxml/parser.h>
 #include <libxml/xmlmemory.h>
 
-#include <fstream>
+#include <ostream>
 #include <string>
+#include <string_view>
 
 #include "playlist.h"
 
@@ -12,7 +13,14 @@ using namespace std::string_view_literals;
 
 namespace pefti {
 
-// Finite state machine for XML SAX handlers
+// Returns an attribute value passed by libxml2 with the character reference
+// for "&" replaced
+std::string unescape_attribute_value(std::string_view value);
+
+// Finite state machine for XML SAX handlers. Copies the <channel> and
+// <programme> nodes of the channels in the playlist, in one pass over the
+// document, to separate streams. Entities declared in the internal subset
+// of the document are resolved.
 class SaxFsm {
  public:
   static constexpr auto KChannel = "channel"sv;
@@ -22,9 +30,22 @@ class SaxFsm {
   enum class ParentNode { kChannel, kProgramme };
 
  public:
-  SaxFsm(std::string_view parent_node, std::ofstream& stream,
-         Playlist& playlist);
-  // SAX handlers
+  SaxFsm(std::ostream& channel_stream, std::ostream& programme_stream,
+         const Playlist& playlist);
+  SaxFsm(SaxFsm&) = delete;
+  SaxFsm(SaxFsm&&) = delete;
+  SaxFsm& operator=(SaxFsm&) = delete;
+  SaxFsm& operator=(SaxFsm&&) = delete;
+
+  // Parses `document` and copies its nodes. Throws std::runtime_error if
+  // the document is not well-formed.
+  void parse(std::string_view document);
+
+  State state_{State::kWaitingForParentNode};
+
+ private:
+  // SAX handlers. Their context is the parser context, libxml2 only looks
+  // up the entities of the internal subset when it is the user data.
   static void handler_start_element(void* context, const xmlChar* localname,
                                     const xmlChar*, const xmlChar*, int,
                                     const xmlChar**, int nb_attributes, int,
@@ -33,20 +54,20 @@ class SaxFsm {
                                   const xmlChar*, const xmlChar*);
   static void handler_characters(void* context, const xmlChar* begin,
                                  int length);
-
-  State state_{State::kWaitingForParentNode};
-
- private:
   std::string get_attribute_value(std::string_view attribute_name,
                                   int num_attributes,
                                   const xmlChar** attributes);
 
  private:
-  const std::string_view parent_node_;
-  std::ofstream& stream_;
-  Playlist& playlist_;
+  std::ostream& channel_stream_;
+  std::ostream& programme_stream_;
+  const Playlist& playlist_;
+  // The node being copied and the stream it is copied to
+  std::string_view parent_node_;
+  std::ostream* stream_{nullptr};
   int indentation_{1};
   std::string characters_;
+  std::string escaped_;
   std::string current_node_name_;
 };
 
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+namespace pefti {
+
+// Metrics of the stages of a run, reported with --stats. Recording is
+// disabled unless enable() is called before the run starts, every recording
+// point then costs one well-predicted branch. Metrics of concurrent sources
+// are added together, so times can exceed the duration of the run.
+class Stats {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class Stage {
+    kLoader,
+    kParser,
+    kFilter,
+    kTransformer,
+    kPopulateMaps,
+    kTransform,
+    kStorePlaylist,
+    kEpgLoad,
+    kEpgIndex,
+    kEpgOutput,
+    kNumStages
+  };
+
+  // Ring buffers between the stages of the playlist pipeline
+  enum class Ring {
+    kLoaderParser,
+    kParserFilter,
+    kFilterTransformer,
+    kNumRings
+  };
+
+  // The stages that produce into and consume from each ring
+  static constexpr Stage get_producer(Ring ring) noexcept {
+    switch (ring) {
+      case Ring::kLoaderParser:
+        return Stage::kLoader;
+      case Ring::kParserFilter:
+        return Stage::kParser;
+      default:
+        return Stage::kFilter;
+    }
+  }
+  static constexpr Stage get_consumer(Ring ring) noexcept {
+    switch (ring) {
+      case Ring::kLoaderParser:
+        return Stage::kParser;
+      case Ring::kParserFilter:
+        return Stage::kFilter;
+      default:
+        return Stage::kTransformer;
+    }
+  }
+
+  // Occupancy of a ring is recorded when its consumer has waited for it, as
+  // the eighth of the ring that the available items fill
+  static constexpr std::size_t kNumOccupancyBuckets{8};
+
+  // Records the time from construction to destruction in a stage
+  class Timer {
+   public:
+    explicit Timer(Stage stage) noexcept : stage_(stage) {
+      if (is_enabled_) start_ = Clock::now();
+    }
+    ~Timer() {
+      if (is_enabled_) add_time(stage_, Clock::now() - start_);
+    }
+    Timer(Timer&) = delete;
+    Timer(Timer&&) = delete;
+    Timer& operator=(Timer&) = delete;
+    Timer& operator=(Timer&&) = delete;
+
+   private:
+    Stage stage_;
+    Clock::time_point start_;
+  };
+
+ public:
+  Stats() = delete;
+
+  static void enable() noexcept { is_enabled_ = true; }
+  static bool is_enabled() noexcept { return is_enabled_; }
+
+  static void add_items(Stage stage, std::uint64_t count) noexcept {
+    if (is_enabled_) record_items(stage, count);
+  }
+  static void add_bytes(Stage stage, std::uint64_t count) noexcept {
+    if (is_enabled_) record_bytes(stage, count);
+  }
+  static void add_time(Stage stage, Clock::duration time) noexcept {
+    if (is_enabled_) record_time(stage, time);
+  }
+
+  // A producer waited for free slots in `ring`
+  static void add_claim_wait(Ring ring, Clock::duration time) noexcept {
+    if (is_enabled_) record_claim_wait(ring, time);
+  }
+
+  // A consumer waited for `ring`, `num_available` of its `size` slots were
+  // available after the wait
+  static void add_publish_wait(Ring ring, Clock::duration time,
+                               std::size_t num_available,
+                               std::size_t size) noexcept {
+    if (is_enabled_) record_publish_wait(ring, time, num_available, size);
+  }
+
+  // Records a finished download. Times are in microseconds.
+  static void add_download(std::string_view url, long status,
+                           std::int64_t time_to_first_byte,
+                           std::int64_t total_time, std::uint64_t num_bytes);
+
+  // Names of stages and rings in reports, e.g. "loader_parser"
+  static std::string_view get_name(Stage stage) noexcept;
+  static std::string_view get_name(Ring ring) noexcept;
+
+  static void write_json(std::ostream& stream);
+
+ private:
+  static void record_items(Stage stage, std::uint64_t count) noexcept;
+  static void record_bytes(Stage stage, std::uint64_t count) noexcept;
+  static void record_time(Stage stage, Clock::duration time) noexcept;
+  static void record_claim_wait(Ring ring, Clock::duration time) noexcept;
+  static void record_publish_wait(Ring ring, Clock::duration time,
+                                  std::size_t num_available,
+                                  std::size_t size) noexcept;
+
+ private:
+  static inline bool is_enabled_{false};
+};
+
+}  // namespace pefti
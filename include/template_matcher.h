@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pefti {
+
+class BlobReader;
+class BlobWriter;
+struct ChannelTemplate;
+
+// Matches channel names against the channel templates in `channels.allow`.
+// The include and exclude terms of all templates are normalized once and
+// compiled into an Aho-Corasick automaton. An inverted index maps each term
+// to the templates that include it, so a single scan of the channel name
+// finds the candidate templates, which are then verified in priority order.
+class TemplateMatcher {
+ public:
+  using TemplateId = std::uint32_t;
+  using TermId = std::uint32_t;
+
+  TemplateMatcher() = default;
+  explicit TemplateMatcher(const std::vector<ChannelTemplate>& templates);
+
+  // Returns the index of the first template that matches `normalized_name`,
+  // which must have been converted by normalize_name(). A template matches
+  // if the name contains all of its include terms and none of its exclude
+  // terms, where a term only counts when its first occurrence in the name
+  // is not adjacent to an ASCII alphanumeric character.
+  std::optional<TemplateId> match(std::string_view normalized_name) const;
+
+  // Saves/loads the compiled matcher to/from the compiled config cache
+  void load(BlobReader& reader);
+  void save(BlobWriter& writer) const;
+
+ private:
+  static constexpr std::uint32_t kNone = UINT32_MAX;
+
+  void build_automaton(const std::vector<std::string>& terms);
+  std::uint32_t find_child(std::uint32_t node, unsigned char c) const;
+  std::uint32_t next_state(std::uint32_t node, unsigned char c) const;
+  void find_satisfied_terms(std::string_view name,
+                            std::vector<TermId>& satisfied) const;
+
+ private:
+  // Automaton nodes, node 0 is the root. Edges of node n are
+  // edge_bytes_/edge_targets_[first_edge_[n], first_edge_[n + 1]).
+  std::vector<std::uint32_t> first_edge_;
+  std::vector<unsigned char> edge_bytes_;
+  std::vector<std::uint32_t> edge_targets_;
+  std::vector<std::uint32_t> fail_;
+  std::vector<TermId> node_term_;
+  std::vector<std::uint32_t> dictionary_link_;
+  std::array<std::uint32_t, 256> root_next_{};
+
+  std::vector<std::uint32_t> term_lengths_;
+  TermId empty_term_{kNone};
+
+  // Include/exclude terms of template t are in
+  // include_terms_[include_offsets_[t], include_offsets_[t + 1]), etc.
+  std::vector<std::uint32_t> include_offsets_;
+  std::vector<TermId> include_terms_;
+  std::vector<std::uint32_t> exclude_offsets_;
+  std::vector<TermId> exclude_terms_;
+
+  // Templates including term t are in
+  // postings_[posting_offsets_[t], posting_offsets_[t + 1])
+  std::vector<std::uint32_t> posting_offsets_;
+  std::vector<TemplateId> postings_;
+
+  // Templates without include terms are candidates for every name
+  std::vector<TemplateId> unconditional_templates_;
+};
+
+}  // namespace pefti
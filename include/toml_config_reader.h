@@ -3,6 +3,7 @@
 #define TOML_HEADER_ONLY 0
 #include <exception>
 #include <gsl/gsl>
+#include <optional>
 #include <ranges>
 #include <string>
 #include <string_view>
@@ -16,16 +17,22 @@ using namespace std::literals;
 
 namespace pefti {
 
+// Reads the configuration from a TOML file. The file is only parsed when
+// data is first requested, so callers that can use a compiled copy of the
+// configuration never pay for parsing.
 class TomlConfigReader {
  public:
   explicit TomlConfigReader(std::string& filename);
   void check_required_element(std::string_view path);
 
+  // Returns the contents of the configuration file
+  std::string_view get_source() const noexcept { return source_; }
+
   // Get collections
   template <template <typename...> typename T, typename U>
   void get_data(std::string_view path, T<U>& destination) {
     Expects(destination.empty());
-    auto node = toml_config_[toml::path{path}];
+    auto node = get_table()[toml::path{path}];
     if (!node) return;
     if (!node.is_array()) throw std::runtime_error("Expected array"s);
     auto array = node.as_array();
@@ -60,7 +67,7 @@ class TomlConfigReader {
   // Get strings
   template <typename T>
   void get_data(std::string_view path, std::basic_string<T>& destination) {
-    auto node = toml_config_[toml::path{path}];
+    auto node = get_table()[toml::path{path}];
     if (!node) return;
     if (!node.is_string()) throw std::runtime_error("Expected text string"s);
     destination = **(node.as_string());
@@ -69,7 +76,7 @@ class TomlConfigReader {
   // Get integers and booleans
   template <typename T>
   void get_data(std::string_view path, T& destination) {
-    auto node = toml_config_[toml::path{path}];
+    auto node = get_table()[toml::path{path}];
     if (!node) return;
     if constexpr (std::is_integral_v<T>) {
       if (node.is_boolean()) {
@@ -125,7 +132,12 @@ class TomlConfigReader {
   }
 
  private:
-  toml::table toml_config_;
+  toml::table& get_table();
+
+ private:
+  std::string filename_;
+  std::string source_;
+  std::optional<toml::table> toml_config_;
 };
 
 }  // namespace pefti
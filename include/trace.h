@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+#include "stats.h"
+
+namespace pefti {
+
+// A trace of a run in the Chrome Trace Event format, written with --trace
+// and viewed in Perfetto. Recording is disabled unless enable() is called
+// before the run starts. Each thread appends events to a buffer of its own,
+// a lock is only taken when a thread records its first event.
+//
+// The coroutines of the stages resume on any thread of the pool, so the
+// spans of a stage are recorded as async events on a track of their own
+// for each source, e.g. the Parser of playlist 3. Work that stays on one
+// thread is recorded on the track of the thread. Names must be string
+// literals, events keep views of them.
+class Trace {
+ public:
+  using Clock = Stats::Clock;
+  using Stage = Stats::Stage;
+
+  // Records a span of a stage of a source from construction to destruction
+  class Span {
+   public:
+    // The span is named after the stage
+    Span(Stage stage, std::uint32_t source) noexcept
+        : Span(stage, source, Stats::get_name(stage)) {}
+    Span(Stage stage, std::uint32_t source, std::string_view name) noexcept
+        : stage_(stage), source_(source), name_(name) {
+      if (is_enabled_) {
+        start_ = Clock::now();
+        start_thread_ = get_thread_id();
+      }
+    }
+    ~Span() {
+      if (is_enabled_)
+        add_span(stage_, source_, name_, start_, Clock::now(), start_thread_);
+    }
+    Span(Span&) = delete;
+    Span(Span&&) = delete;
+    Span& operator=(Span&) = delete;
+    Span& operator=(Span&&) = delete;
+
+   private:
+    Stage stage_;
+    std::uint32_t source_;
+    std::string_view name_;
+    Clock::time_point start_;
+    std::uint32_t start_thread_{0};
+  };
+
+  // Records a span of work on the current thread from construction to
+  // destruction. There must be no co_await in its scope.
+  class ThreadSpan {
+   public:
+    ThreadSpan(std::string_view name, std::uint32_t source) noexcept
+        : name_(name), source_(source) {
+      if (is_enabled_) start_ = Clock::now();
+    }
+    ~ThreadSpan() {
+      if (is_enabled_) add_thread_span(name_, source_, start_, Clock::now());
+    }
+    ThreadSpan(ThreadSpan&) = delete;
+    ThreadSpan(ThreadSpan&&) = delete;
+    ThreadSpan& operator=(ThreadSpan&) = delete;
+    ThreadSpan& operator=(ThreadSpan&&) = delete;
+
+   private:
+    std::string_view name_;
+    std::uint32_t source_;
+    Clock::time_point start_;
+  };
+
+ public:
+  Trace() = delete;
+
+  static void enable() noexcept;
+  static bool is_enabled() noexcept { return is_enabled_; }
+
+  // Returns a small number that identifies the current thread in the trace
+  static std::uint32_t get_thread_id() noexcept;
+
+  static void add_span(Stage stage, std::uint32_t source,
+                       std::string_view name, Clock::time_point start,
+                       Clock::time_point end, std::uint32_t start_thread);
+  static void add_thread_span(std::string_view name, std::uint32_t source,
+                              Clock::time_point start, Clock::time_point end);
+  // A stage of a source waited for a ring buffer, as a producer if
+  // `is_claim` is set and as a consumer otherwise
+  static void add_ring_wait(Stats::Ring ring, bool is_claim,
+                            std::uint32_t source, Clock::time_point start,
+                            Clock::time_point end, std::uint32_t start_thread);
+  static void add_download(std::string_view url, Clock::time_point start,
+                           Clock::time_point end);
+
+  // Must not be called while events are being recorded
+  static void write_json(std::ostream& stream);
+
+ private:
+  static inline bool is_enabled_{false};
+};
+
+}  // namespace pefti
@@ -25,16 +25,19 @@ class Transformer {
   Transformer(Transformer&&) = delete;
   Transformer& operator=(Transformer&) = delete;
   Transformer& operator=(Transformer&&) = delete;
-  void transform();
+  cppcoro::task<> transform(cppcoro::static_thread_pool& tp);
   cppcoro::task<> transform(cppcoro::static_thread_pool& tp,
                             PlaylistFilterTransformerBuffer& buffer);
 
  private:
   void block_tags(IptvChannel& channel);
-  void copy_tags(IptvChannel& channel);
-  void copy_group_title_tag();
-  void order_by_sort_criteria();
-  void set_name(IptvChannel& channel);
+  void order_by_sort_criteria(
+      std::vector<ChannelsMapper::ChannelIndex>& channels);
+  void set_name(IptvChannel& channel,
+                const ChannelTemplate& channel_template);
+  cppcoro::task<> transform_templates(cppcoro::static_thread_pool& tp,
+                                      IptvChannel::TemplateId begin,
+                                      IptvChannel::TemplateId end);
 
  private:
   ConfigType& config_;
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace pefti {
+
+// Finds the <channel> and <programme> elements of an XMLTV document without
+// a general-purpose XML parser. Only the subset of XML that EPGs use in
+// practice is supported: a DOCTYPE without an internal subset, comments and
+// processing instructions outside of the elements, and indexed attribute
+// values without references or whitespace other than spaces. On anything
+// else, including undeclared entities, repeated attributes and mismatched
+// end tags, the scanner stops with kUnsupported and the document must be
+// parsed with libxml2 instead, which reports the errors. The document must
+// be UTF-8, and unlike libxml2 the scanner does not validate its characters
+// and names.
+class XmltvScanner {
+ public:
+  enum class Result { kElement, kEnd, kUnsupported };
+
+  struct Element {
+    std::size_t offset;
+    std::size_t size;
+    bool is_programme;
+    // Value of the id attribute of a channel, or the channel attribute of a
+    // programme
+    std::string_view channel_id;
+    // Values of the start and stop attributes of a programme
+    std::string_view start;
+    std::string_view stop;
+  };
+
+ public:
+  // `begin` is the offset of the first byte after the XML declaration
+  XmltvScanner(std::string_view document, std::size_t begin)
+      : document_(document), position_(begin), prolog_begin_(begin) {}
+  XmltvScanner(XmltvScanner&) = delete;
+  XmltvScanner(XmltvScanner&&) = delete;
+  XmltvScanner& operator=(XmltvScanner&) = delete;
+  XmltvScanner& operator=(XmltvScanner&&) = delete;
+
+  // Returns the bytes from `begin` up to the root element, valid after the
+  // first call to next()
+  std::string_view get_prolog() const noexcept { return prolog_; }
+
+  // Scans to the next <channel> or <programme> element in the root element
+  Result next(Element& element);
+
+ private:
+  enum class State { kProlog, kContent, kEnd };
+
+  std::size_t find(char c, std::size_t position) const noexcept;
+  bool is_at(std::string_view text) const noexcept;
+  std::string_view scan_name();
+  bool scan_element_content(std::string_view name);
+  bool scan_start_tag(Element* element, bool& is_empty);
+  bool skip_misc();
+  bool skip_past(std::string_view text);
+  void skip_whitespace() noexcept;
+
+ private:
+  std::string_view document_;
+  std::size_t position_;
+  std::size_t prolog_begin_;
+  std::string_view prolog_;
+  State state_{State::kProlog};
+  // Reused by scan_element_content() and scan_start_tag()
+  std::vector<std::string_view> open_elements_;
+  std::vector<std::string_view> attribute_names_;
+};
+
+}  // namespace pefti
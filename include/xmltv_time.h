@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string_view>
+
+namespace pefti {
+
+// Converts an XMLTV date, "YYYYMMDDhhmmss +zzzz", to seconds since the Unix
+// epoch. Trailing fields of the date may be omitted and the time zone
+// defaults to UTC. Returns std::nullopt if the date is not valid. Does not
+// allocate, it is called for every programme in the EPGs.
+std::optional<std::int64_t> parse_xmltv_time(std::string_view text) noexcept;
+
+// Range of times, in seconds since the Unix epoch, of the programmes to
+// keep in the new EPG
+struct TimeWindow {
+  std::int64_t begin{std::numeric_limits<std::int64_t>::min()};
+  std::int64_t end{std::numeric_limits<std::int64_t>::max()};
+
+  // A programme is in the window if any part of it is in the window
+  bool overlaps(std::int64_t start, std::int64_t stop) const noexcept {
+    return stop >= begin && start < end;
+  }
+};
+
+}  // namespace pefti
@@ -4,18 +4,30 @@
 #include <cppcoro/sync_wait.hpp>
 #include <cppcoro/task.hpp>
 #include <cppcoro/when_all.hpp>
+#include <cstdint>
 #include <cxxopts.hpp>
+#include <deque>
+#include <gsl/gsl>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "buffers.h"
 #include "config.h"
 #include "epg.h"
+#include "epg_index.h"
 #include "filter.h"
+#include "http_client.h"
+#include "http_server.h"
 #include "iptv_channel.h"
 #include "loader.h"
 #include "mapper.h"
+#include "output_file.h"
+#include "parser.h"
 #include "playlist.h"
+#include "playlist_snapshot.h"
+#include "stats.h"
+#include "trace.h"
 #include "transformer.h"
 
 // For each input playlist, there is a pipeline of coroutines consisting of
@@ -46,46 +58,139 @@ Application::Application(std::string&& config_filename)
 }
 
 // Filters EPGs and creates a new EPG which will only contain data for channels
-// that are in the new playlist. Output is one new EPG file.
+// that are in the new playlist. Output is one new EPG file. The EPGs are
+// indexed while the playlists are still being processed, only the output
+// has to wait for the channels of the new playlist.
 [[nodiscard]] cppcoro::task<> Application::process_epgs(
-    cppcoro::static_thread_pool& tp) {
+    cppcoro::static_thread_pool& tp, IptvChannelsEvent& have_iptv_channels) {
   co_await tp.schedule();
   const auto& epg_urls = config_.get_epgs_urls();
-  auto epgs = load_epgs(epg_urls);
-  co_await have_iptv_channels_;
-  filter_.filter(std::move(epgs), config_.get_new_epg_filename());
+  std::vector<std::string> downloaded_epgs;
+  std::vector<std::string_view> epgs;
+  {
+    const Stats::Timer timer(Stats::Stage::kEpgLoad);
+    const Trace::Span span(Trace::Stage::kEpgLoad, 0);
+    if (http_client_) {
+      for (const auto& url : epg_urls)
+        epgs.push_back(http_client_->get_body(url));
+    } else {
+      downloaded_epgs = load_epgs(epg_urls);
+      epgs.assign(downloaded_epgs.begin(), downloaded_epgs.end());
+    }
+    Stats::add_items(Stats::Stage::kEpgLoad, epgs.size());
+    for (auto epg : epgs) Stats::add_bytes(Stats::Stage::kEpgLoad, epg.size());
+  }
+  const auto time_window = config_.get_epg_time_window();
+  const bool use_scanner =
+      config_.get_epg_parser() == ConfigType::EpgParser::kScanner;
+  const bool is_parallel = config_.is_epg_parallel_parse_enabled();
+  std::vector<std::string> index_filenames;
+  for (const auto& url : epg_urls) {
+    index_filenames.push_back(
+        get_epg_index_filename(config_.get_snapshot_directory(), url));
+  }
+  std::vector<EpgIndex> epg_indexes(epgs.size());
+  std::vector<cppcoro::task<>> tasks;
+  for (size_t i{0}; i < epgs.size(); ++i) {
+    tasks.push_back(index_epg(tp, epgs[i], static_cast<std::uint32_t>(i),
+                              time_window, use_scanner, is_parallel,
+                              index_filenames[i], epg_indexes[i]));
+  }
+  co_await cppcoro::when_all(std::move(tasks));
+  co_await have_iptv_channels.event;
+  if (have_iptv_channels.has_failed) co_return;
+  const Stats::Timer timer(Stats::Stage::kEpgOutput);
+  const Trace::Span span(Trace::Stage::kEpgOutput, 0);
+  co_await filter_.filter(tp, epg_indexes, config_.get_new_epg_filename(),
+                          http_server_);
 }
 
 // Fiters and transforms IPTV playlists and creates a new playlist according
 // to the user configuration. Output is one new playlist file.
 [[nodiscard]] cppcoro::task<> Application::process_playlists(
-    cppcoro::static_thread_pool& tp) {
+    cppcoro::static_thread_pool& tp, IptvChannelsEvent& have_iptv_channels) {
   co_await tp.schedule();
+  // The EPGs wait for the channels, so they are released if processing the
+  // playlists fails too. The error is reported by process().
+  bool are_channels_complete{false};
+  auto release_epgs = gsl::finally([&]() {
+    if (are_channels_complete) return;
+    have_iptv_channels.has_failed = true;
+    have_iptv_channels.event.set();
+  });
   const auto& playlist_urls = config_.get_playlists_urls();
   std::vector<PlaylistLoaderParserBuffer> lp_buffers(playlist_urls.size());
   std::vector<PlaylistParserFilterBuffer> pf_buffers(playlist_urls.size());
   std::vector<PlaylistFilterTransformerBuffer> ft_buffers(playlist_urls.size());
+  std::deque<Parser> parsers(playlist_urls.size());
+  std::deque<PlaylistSnapshot> snapshots;
+  for (const auto& url : playlist_urls)
+    snapshots.emplace_back(config_.get_snapshot_directory(), url);
   std::vector<cppcoro::task<>> tasks;
   for (size_t i{0}; i < playlist_urls.size(); ++i) {
+    const auto source_id = static_cast<std::uint32_t>(i);
+    lp_buffers[i].source_id = source_id;
+    pf_buffers[i].source_id = source_id;
+    ft_buffers[i].source_id = source_id;
     tasks.push_back(
-        std::move(loader_.load(tp, lp_buffers[i], playlist_urls[i])));
-    tasks.push_back(std::move(parser_.parse(tp, lp_buffers[i], pf_buffers[i])));
+        std::move(loader_.load(tp, lp_buffers[i], snapshots[i])));
+    tasks.push_back(std::move(
+        parsers[i].parse(tp, lp_buffers[i], pf_buffers[i], snapshots[i])));
     tasks.push_back(
         std::move(filter_.filter(tp, pf_buffers[i], ft_buffers[i])));
     tasks.push_back(std::move(transformer_.transform(tp, ft_buffers[i])));
   }
   co_await cppcoro::when_all(std::move(tasks));
-  channels_mapper_.populate_maps();
-  have_iptv_channels_.set();
-  transformer_.transform();
-  store_playlist(config_.get_new_playlist_filename(), playlist_, config_,
+  {
+    const Stats::Timer timer(Stats::Stage::kPopulateMaps);
+    const Trace::Span span(Trace::Stage::kPopulateMaps, 0);
+    channels_mapper_.populate_maps();
+  }
+  playlist_.freeze_tvg_ids();
+  are_channels_complete = true;
+  have_iptv_channels.event.set();
+  {
+    const Stats::Timer timer(Stats::Stage::kTransform);
+    const Trace::Span span(Trace::Stage::kTransform, 0);
+    co_await transformer_.transform(tp);
+  }
+  const Stats::Timer timer(Stats::Stage::kStorePlaylist);
+  const Trace::Span span(Trace::Stage::kStorePlaylist, 0);
+  Stats::add_items(Stats::Stage::kStorePlaylist, playlist_.size());
+  OutputFile new_playlist{config_.get_new_playlist_filename(), http_server_};
+  store_playlist(new_playlist.get_stream(), playlist_, config_,
                  channels_mapper_);
+  co_await new_playlist.close(tp);
+}
+
+// The playlists and the EPGs are processed concurrently
+[[nodiscard]] cppcoro::task<> Application::process(
+    cppcoro::static_thread_pool& tp) {
+  IptvChannelsEvent have_iptv_channels;
+  co_await cppcoro::when_all(process_playlists(tp, have_iptv_channels),
+                             process_epgs(tp, have_iptv_channels));
+}
+
+std::vector<std::string> Application::get_urls() {
+  auto urls = config_.get_playlists_urls();
+  const auto& epg_urls = config_.get_epgs_urls();
+  urls.insert(urls.end(), epg_urls.begin(), epg_urls.end());
+  return urls;
 }
 
 void Application::run() {
   cppcoro::static_thread_pool thread_pool;
-  cppcoro::sync_wait(cppcoro::when_all(process_playlists(thread_pool),
-                                       process_epgs(thread_pool)));
+  cppcoro::sync_wait(process(thread_pool));
+}
+
+// The channels of the previous run are removed, the compiled configuration
+// and the channel name to template memo table are kept.
+void Application::refresh(cppcoro::static_thread_pool& tp,
+                          const HttpClient& http_client) {
+  http_client_ = &http_client;
+  loader_.set_http_client(http_client);
+  playlist_.clear();
+  cppcoro::sync_wait(process(tp));
 }
 
 }  // namespace pefti
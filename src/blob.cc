@@ -0,0 +1,130 @@
+#include "blob.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "hash.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+static constexpr std::size_t kAlignment = 8;
+
+static std::size_t padding(std::size_t size) {
+  return (kAlignment - size % kAlignment) % kAlignment;
+}
+
+//
+// BlobWriter
+//
+
+void BlobWriter::pad() { data_.append(padding(data_.size()), '\0'); }
+
+std::uint32_t BlobWriter::add_string(std::string_view string) {
+  auto [iter, is_new] = string_ids_.try_emplace(
+      std::string{string}, static_cast<std::uint32_t>(strings_.size()));
+  if (is_new) strings_.push_back(iter->first);
+  return iter->second;
+}
+
+// The string table is the number of strings, the offset of each string
+// and the end offset of the last string, then the characters.
+std::string BlobWriter::finish(std::string_view magic, std::uint32_t version,
+                               std::uint64_t key) const {
+  std::string strings;
+  const auto num_strings = static_cast<std::uint64_t>(strings_.size());
+  strings.append(reinterpret_cast<const char*>(&num_strings),
+                 sizeof(num_strings));
+  std::uint64_t offset{0};
+  for (std::size_t i{0}; i <= strings_.size(); ++i) {
+    strings.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    if (i < strings_.size()) offset += strings_[i].size();
+  }
+  for (const auto& string : strings_) strings.append(string);
+  strings.append(padding(strings.size()), '\0');
+  BlobHeader header{};
+  std::memcpy(header.magic, magic.data(),
+              std::min(magic.size(), sizeof(header.magic)));
+  header.version = version;
+  header.key = key;
+  header.strings_size = strings.size();
+  header.data_size = data_.size();
+  Hasher hasher;
+  hasher.update(strings);
+  hasher.update(data_);
+  header.checksum = hasher.digest();
+  std::string blob;
+  blob.reserve(sizeof(header) + strings.size() + data_.size());
+  blob.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  blob.append(strings);
+  blob.append(data_);
+  return blob;
+}
+
+//
+// BlobReader
+//
+
+BlobReader::BlobReader(std::string_view blob, std::string_view magic,
+                       std::uint32_t version, std::uint64_t key) {
+  BlobHeader header;
+  if (blob.size() < sizeof(header))
+    throw std::runtime_error("Cached data is truncated"s);
+  std::memcpy(&header, blob.data(), sizeof(header));
+  char expected_magic[sizeof(header.magic)]{};
+  std::memcpy(expected_magic, magic.data(),
+              std::min(magic.size(), sizeof(expected_magic)));
+  if (std::memcmp(header.magic, expected_magic, sizeof(header.magic)) != 0)
+    throw std::runtime_error("Cached data has the wrong type"s);
+  if (header.version != version)
+    throw std::runtime_error("Cached data has the wrong version"s);
+  if (header.key != key) throw std::runtime_error("Cached data is stale"s);
+  blob.remove_prefix(sizeof(header));
+  if (header.strings_size > blob.size() ||
+      header.data_size != blob.size() - header.strings_size)
+    throw std::runtime_error("Cached data is truncated"s);
+  if (hash_bytes(blob) != header.checksum)
+    throw std::runtime_error("Cached data is corrupt"s);
+  //
+  // Read the string table
+  data_ = blob.substr(0, header.strings_size);
+  const auto num_strings = read<std::uint64_t>();
+  if (num_strings >= data_.size() / sizeof(std::uint64_t))
+    throw std::runtime_error("Invalid string table in cached data"s);
+  std::vector<std::uint64_t> offsets(num_strings + 1);
+  for (auto& offset : offsets) offset = read<std::uint64_t>();
+  const auto characters = data_;
+  strings_.reserve(num_strings);
+  for (std::uint64_t i{0}; i < num_strings; ++i) {
+    if (offsets[i] > offsets[i + 1] || offsets[i + 1] > characters.size())
+      throw std::runtime_error("Invalid string table in cached data"s);
+    strings_.push_back(
+        characters.substr(offsets[i], offsets[i + 1] - offsets[i]));
+  }
+  data_ = blob.substr(header.strings_size);
+  offset_ = 0;
+}
+
+const char* BlobReader::consume(std::size_t size) {
+  if (size > data_.size())
+    throw std::runtime_error("Unexpected end of cached data"s);
+  const char* begin = data_.data();
+  data_.remove_prefix(size);
+  offset_ += size;
+  return begin;
+}
+
+void BlobReader::skip_padding() { consume(padding(offset_)); }
+
+std::string_view BlobReader::get_string(std::uint32_t id) const {
+  if (id >= strings_.size())
+    throw std::runtime_error("Invalid string in cached data"s);
+  return strings_[id];
+}
+
+}  // namespace pefti
@@ -1,18 +1,76 @@
 #include "config.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <vector>
 
+#include "blob.h"
+#include "file.h"
+#include "hash.h"
+#include "normalizer.h"
+#include "version.h"
+#include "xmltv_time.h"
+
 using namespace std::literals;
 
 namespace pefti {
 
+static constexpr auto kCompiledConfigSuffix = ".cache"sv;
+static constexpr auto kCompiledConfigMagic = "PEFTICFG"sv;
+static constexpr auto kSnapshotDirectorySuffix = ".snapshots"sv;
+
+// The last byte is the revision of the blob layout. The cache is also
+// invalidated by a new pefti version, because the compiled form of the
+// configuration may change between versions.
+static constexpr std::uint32_t kCompiledConfigVersion =
+    (kVersionMajor << 24) | (kVersionMinor << 16) | (kVersionPatch << 8) | 6;
+
 template class Config<TomlConfigReader>;
 
+// The compiled configuration is cached in a file next to the configuration
+// file. The cache is keyed by the hash of the configuration file, so any
+// edit to the configuration file causes it to be rebuilt.
 template <typename ConfigReader>
 Config<ConfigReader>::Config(std::string& config_filename)
-    : ConfigReader(config_filename) {
+    : ConfigReader(config_filename),
+      compiled_config_filename_(config_filename +
+                                std::string{kCompiledConfigSuffix}),
+      snapshot_directory_(config_filename +
+                          std::string{kSnapshotDirectorySuffix}) {
+  const auto source_hash = hash_bytes(ConfigReader::get_source());
+  if (!load_compiled_config(source_hash)) {
+    read_config();
+    normalize_names();
+    template_matcher_ = TemplateMatcher(config_.channels_templates);
+    store_compiled_config(source_hash);
+  }
+  merge_tag_patches();
+  if (config_.duplicates_location == "inline")
+    duplicates_location_ = DuplicatesLocation::kInline;
+  else if (config_.duplicates_location == "append")
+    duplicates_location_ = DuplicatesLocation::kAppend;
+  else {
+    duplicates_location_ = DuplicatesLocation::kNone;
+    config_.num_duplicates = 0;
+  }
+  if (config_.epg_output_mode == "verbatim")
+    epg_output_mode_ = EpgOutputMode::kVerbatim;
+  else
+    epg_output_mode_ = EpgOutputMode::kRebuild;
+  if (config_.epg_parser == "scanner")
+    epg_parser_ = EpgParser::kScanner;
+  else
+    epg_parser_ = EpgParser::kLibxml2;
+}
+
+template <typename ConfigReader>
+void Config<ConfigReader>::read_config() {
   ConfigReader::check_required_element("resources");
   ConfigReader::check_required_element("resources.playlists");
   ConfigReader::check_required_element("resources.new_playlist");
@@ -21,6 +79,14 @@ Config<ConfigReader>::Config(std::string& config_filename)
                          config_.new_playlist_filename);
   ConfigReader::get_data("resources.epgs", config_.epgs_urls);
   ConfigReader::get_data("resources.new_epg", config_.new_epg_filename);
+  ConfigReader::get_data("epg.output", config_.epg_output_mode);
+  ConfigReader::get_data("epg.past_hours", config_.epg_past_hours);
+  ConfigReader::get_data("epg.future_hours", config_.epg_future_hours);
+  ConfigReader::get_data("epg.reference_time", config_.epg_reference_time);
+  ConfigReader::get_data("epg.merge", config_.epg_merge);
+  ConfigReader::get_data("epg.merge_memory_mb", config_.epg_merge_memory_mb);
+  ConfigReader::get_data("epg.parser", config_.epg_parser);
+  ConfigReader::get_data("epg.parallel_parse", config_.epg_parallel_parse);
   ConfigReader::get_data("groups.allow", config_.allowed_groups);
   ConfigReader::get_data("groups.block", config_.blocked_groups);
   ConfigReader::get_data("urls.block", config_.blocked_urls);
@@ -33,22 +99,183 @@ Config<ConfigReader>::Config(std::string& config_filename)
   ConfigReader::get_data("channels.tags_block", config_.blocked_tags);
   ConfigReader::get_data("channels.block", config_.blocked_channels);
   ConfigReader::get_data("channels.allow", config_.channels_templates);
-  if (config_.duplicates_location == "inline")
-    duplicates_location_ = DuplicatesLocation::kInline;
-  else if (config_.duplicates_location == "append")
-    duplicates_location_ = DuplicatesLocation::kAppend;
-  else {
-    duplicates_location_ = DuplicatesLocation::kNone;
-    config_.num_duplicates = 0;
+}
+
+// Returns false if there is no valid compiled configuration for this
+// version of the configuration file.
+template <typename ConfigReader>
+bool Config<ConfigReader>::load_compiled_config(std::uint64_t source_hash) {
+  std::error_code error;
+  if (!std::filesystem::exists(compiled_config_filename_, error)) return false;
+  try {
+    MappedFile file(compiled_config_filename_);
+    BlobReader reader(file.get_data(), kCompiledConfigMagic,
+                      kCompiledConfigVersion, source_hash);
+    reader.read_strings(config_.playlists_urls);
+    config_.new_playlist_filename = reader.read_string();
+    reader.read_strings(config_.epgs_urls);
+    config_.new_epg_filename = reader.read_string();
+    config_.epg_output_mode = reader.read_string();
+    config_.epg_past_hours = reader.read<int>();
+    config_.epg_future_hours = reader.read<int>();
+    config_.epg_reference_time = reader.read_string();
+    config_.epg_merge = reader.read<bool>();
+    config_.epg_merge_memory_mb = reader.read<int>();
+    config_.epg_parser = reader.read_string();
+    config_.epg_parallel_parse = reader.read<bool>();
+    reader.read_strings(config_.blocked_groups);
+    reader.read_strings(config_.allowed_groups);
+    reader.read_strings(config_.blocked_urls);
+    config_.copy_group_title = reader.read<bool>();
+    config_.num_duplicates = reader.read<int>();
+    config_.duplicates_location = reader.read_string();
+    reader.read_strings(config_.sort_qualities);
+    reader.read_strings(config_.blocked_tags);
+    reader.read_strings(config_.blocked_channels);
+    const auto num_templates = reader.read<std::uint64_t>();
+    config_.channels_templates.resize(num_templates);
+    for (auto& ct : config_.channels_templates) {
+      reader.read_strings(ct.include);
+      reader.read_strings(ct.exclude);
+      ct.new_name = reader.read_string();
+      const auto num_tags = reader.read<std::uint64_t>();
+      for (std::uint64_t i{0}; i < num_tags; ++i) {
+        std::string key{reader.read_string()};
+        ct.tags.emplace_back(std::move(key), reader.read_string());
+      }
+    }
+    template_matcher_.load(reader);
+    if (!reader.is_at_end())
+      throw std::runtime_error("Unexpected data in compiled config"s);
+  } catch (const std::exception&) {
+    config_ = PeftiConfig{};
+    template_matcher_ = TemplateMatcher{};
+    return false;
+  }
+  return true;
+}
+
+// The cache is an optimisation, failing to write it is not an error
+template <typename ConfigReader>
+void Config<ConfigReader>::store_compiled_config(std::uint64_t source_hash) {
+  BlobWriter writer;
+  writer.write_strings(config_.playlists_urls);
+  writer.write_string(config_.new_playlist_filename);
+  writer.write_strings(config_.epgs_urls);
+  writer.write_string(config_.new_epg_filename);
+  writer.write_string(config_.epg_output_mode);
+  writer.write(config_.epg_past_hours);
+  writer.write(config_.epg_future_hours);
+  writer.write_string(config_.epg_reference_time);
+  writer.write(config_.epg_merge);
+  writer.write(config_.epg_merge_memory_mb);
+  writer.write_string(config_.epg_parser);
+  writer.write(config_.epg_parallel_parse);
+  writer.write_strings(config_.blocked_groups);
+  writer.write_strings(config_.allowed_groups);
+  writer.write_strings(config_.blocked_urls);
+  writer.write(config_.copy_group_title);
+  writer.write(config_.num_duplicates);
+  writer.write_string(config_.duplicates_location);
+  writer.write_strings(config_.sort_qualities);
+  writer.write_strings(config_.blocked_tags);
+  writer.write_strings(config_.blocked_channels);
+  writer.write(static_cast<std::uint64_t>(config_.channels_templates.size()));
+  for (const auto& ct : config_.channels_templates) {
+    writer.write_strings(ct.include);
+    writer.write_strings(ct.exclude);
+    writer.write_string(ct.new_name);
+    writer.write(static_cast<std::uint64_t>(ct.tags.size()));
+    for (const auto& [key, value] : ct.tags) {
+      writer.write_string(key);
+      writer.write_string(value);
+    }
+  }
+  template_matcher_.save(writer);
+  try {
+    write_file_atomically(
+        compiled_config_filename_,
+        writer.finish(kCompiledConfigMagic, kCompiledConfigVersion,
+                      source_hash));
+  } catch (const std::exception&) {
+  }
+}
+
+// Each template's tag changes are merged once here, so the Transformer sets
+// the tags of a channel with a single patch. If enabled in the configuration,
+// templates without a group-title tag use the group-title of the previous
+// template in the channel templates list.
+template <typename ConfigReader>
+void Config<ConfigReader>::merge_tag_patches() {
+  const auto is_blocked_tag = [this](std::string_view tag) {
+    return std::ranges::find(config_.blocked_tags, tag) !=
+           config_.blocked_tags.end();
+  };
+  tag_patches_.clear();
+  tag_patches_.reserve(config_.channels_templates.size());
+  std::string previous_group_title;
+  for (const auto& ct : config_.channels_templates) {
+    auto& patch = tag_patches_.emplace_back();
+    auto group_title = previous_group_title;
+    for (const auto& tag : ct.tags) {
+      if (tag.first == IptvChannel::kTagGroupTitle) group_title = tag.second;
+      if (!is_blocked_tag(tag.first)) patch.push_back(tag);
+    }
+    if (config_.copy_group_title) {
+      // The copied group-title is set even if the tag is blocked
+      auto iter = std::ranges::find(patch, IptvChannel::kTagGroupTitle,
+                                    &IptvChannel::Tag::first);
+      if (iter != patch.end())
+        iter->second = group_title;
+      else
+        patch.emplace_back(IptvChannel::kTagGroupTitle, group_title);
+    }
+    previous_group_title = std::move(group_title);
   }
 }
 
+// Text strings that are compared with channel names are normalized once
+// here, channel names are normalized when they are parsed.
+template <typename ConfigReader>
+void Config<ConfigReader>::normalize_names() {
+  std::unordered_set<std::string> blocked_channels;
+  for (const auto& name : config_.blocked_channels)
+    blocked_channels.insert(normalize_name(name));
+  config_.blocked_channels = std::move(blocked_channels);
+  for (auto& quality : config_.sort_qualities)
+    quality = normalize_name(quality);
+}
+
 template <typename ConfigReader>
 const Config<ConfigReader>::DuplicatesLocation&
 Config<ConfigReader>::get_duplicates_location() noexcept {
   return duplicates_location_;
 }
 
+// A negative number of hours means that the window is not limited in that
+// direction
+template <typename ConfigReader>
+TimeWindow Config<ConfigReader>::get_epg_time_window() {
+  TimeWindow window;
+  if (config_.epg_past_hours < 0 && config_.epg_future_hours < 0)
+    return window;
+  std::int64_t reference_time =
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  if (!config_.epg_reference_time.empty()) {
+    const auto time = parse_xmltv_time(config_.epg_reference_time);
+    if (!time)
+      throw std::runtime_error("Invalid date in [epg].reference_time"s);
+    reference_time = *time;
+  }
+  if (config_.epg_past_hours >= 0)
+    window.begin = reference_time - std::int64_t{config_.epg_past_hours} * 3600;
+  if (config_.epg_future_hours >= 0)
+    window.end = reference_time + std::int64_t{config_.epg_future_hours} * 3600;
+  return window;
+}
+
 template <typename ConfigReader>
 const std::vector<std::string>& Config<ConfigReader>::get_epgs_urls() noexcept {
   return config_.epgs_urls;
@@ -74,17 +301,26 @@ const std::string& Config<ConfigReader>::get_new_playlist_filename() noexcept {
   return config_.new_playlist_filename;
 }
 
+template <typename ConfigReader>
+int Config<ConfigReader>::get_quality_rank(std::string_view channel_name) {
+  int rank{0};
+  for (const auto& quality : config_.sort_qualities) {
+    if (channel_name.find(quality) != std::string::npos) break;
+    ++rank;
+  }
+  return rank;
+}
+
 template <typename ConfigReader>
 bool Config<ConfigReader>::is_allowed_group(std::string_view group_name) {
   return config_.allowed_groups.contains(std::string{group_name});
 }
 
 template <typename ConfigReader>
-bool Config<ConfigReader>::is_blocked_channel(
-    std::string_view original_channel_name) {
+bool Config<ConfigReader>::is_blocked_channel(std::string_view channel_name) {
   bool is_blocked_channel{false};
   for (auto& substring : config_.blocked_channels) {
-    if (original_channel_name.find(substring) != std::string::npos) {
+    if (channel_name.find(substring) != std::string::npos) {
       is_blocked_channel = true;
       break;
     }
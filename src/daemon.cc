@@ -0,0 +1,67 @@
+#include "daemon.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "application.h"
+#include "file.h"
+#include "hash.h"
+#include "http_server.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+static volatile std::sig_atomic_t is_stop_requested{0};
+
+static void handle_signal(int) { is_stop_requested = 1; }
+
+Daemon::Daemon(std::string config_filename, std::chrono::seconds interval,
+               const std::string& listen_address, std::uint16_t port)
+    : config_filename_(std::move(config_filename)), interval_(interval) {
+  if (port != 0)
+    http_server_ = std::make_unique<HttpServer>(listen_address, port);
+}
+
+void Daemon::run() {
+  std::signal(SIGINT, handle_signal);
+  std::signal(SIGTERM, handle_signal);
+  while (!is_stop_requested) {
+    try {
+      refresh();
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+    }
+    // Sleeps in steps so that a signal is handled promptly
+    for (auto remaining = interval_; remaining > 0s && !is_stop_requested;
+         remaining -= 1s)
+      std::this_thread::sleep_for(1s);
+  }
+}
+
+void Daemon::refresh() {
+  const auto config_hash =
+      hash_bytes(MappedFile{config_filename_}.get_data());
+  bool is_changed{false};
+  if (!application_ || config_hash != config_hash_) {
+    application_.reset();
+    application_ = std::make_unique<Application>(std::string{config_filename_});
+    if (http_server_) application_->set_http_server(*http_server_);
+    config_hash_ = config_hash;
+    is_changed = true;
+  }
+  if (http_client_.fetch(application_->get_urls())) is_changed = true;
+  if (!is_changed && are_outputs_current_) return;
+  are_outputs_current_ = false;
+  application_->refresh(thread_pool_, http_client_);
+  are_outputs_current_ = true;
+}
+
+}  // namespace pefti
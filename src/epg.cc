@@ -1,12 +1,118 @@
 #include "epg.h"
 
+#include <algorithm>
+#include <cppcoro/static_thread_pool.hpp>
+#include <cppcoro/task.hpp>
+#include <cppcoro/when_all.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "epg_index.h"
+#include "hash.h"
 #include "resource.h"
+#include "stats.h"
+#include "trace.h"
+#include "xmltv_time.h"
+
+using namespace std::literals;
 
 namespace pefti {
 
+// Smallest chunk of an EPG that is worth indexing on its own thread
+static constexpr std::size_t kMinChunkSize{16 * 1024 * 1024};
+
+static cppcoro::task<> build_index(cppcoro::static_thread_pool& tp,
+                                   std::string_view epg,
+                                   std::uint32_t source_id,
+                                   const TimeWindow& time_window,
+                                   bool use_scanner, bool is_parallel,
+                                   EpgIndex& epg_index) {
+  if (is_parallel) {
+    const auto num_chunks =
+        std::min<std::size_t>(tp.thread_count(), epg.size() / kMinChunkSize);
+    std::vector<std::string_view> chunks;
+    {
+      const Trace::ThreadSpan span("split"sv, source_id);
+      chunks = EpgIndex::split(epg, num_chunks);
+    }
+    if (!chunks.empty()) {
+      const auto header_size = std::size_t(chunks.front().data() - epg.data());
+      std::vector<EpgIndex> chunk_indexes(chunks.size());
+      std::vector<char> has_failed(chunks.size(), false);
+      auto index_chunk = [&](std::size_t i) -> cppcoro::task<> {
+        co_await tp.schedule();
+        try {
+          const Trace::ThreadSpan span("index chunk"sv, source_id);
+          chunk_indexes[i].build_chunk(epg, header_size, chunks[i],
+                                       time_window, use_scanner);
+        } catch (const std::exception&) {
+          has_failed[i] = true;
+        }
+      };
+      std::vector<cppcoro::task<>> tasks;
+      for (std::size_t i{0}; i < chunks.size(); ++i)
+        tasks.push_back(index_chunk(i));
+      co_await cppcoro::when_all(std::move(tasks));
+      if (std::ranges::find(has_failed, true) == has_failed.end()) {
+        const Trace::ThreadSpan span("join"sv, source_id);
+        epg_index.join(epg, chunk_indexes);
+        co_return;
+      }
+    }
+  }
+  // A chunk that fails to parse is indexed again as part of the whole
+  // document, so a malformed EPG is reported the same way in both modes
+  const Trace::ThreadSpan span("build"sv, source_id);
+  epg_index.build(epg, time_window, use_scanner);
+}
+
+static constexpr auto kIndexSuffix = ".epgindex"sv;
+
+std::string get_epg_index_filename(const std::string& directory,
+                                   std::string_view url) {
+  return directory + "/"s + to_hex(hash_bytes(url)) +
+         std::string{kIndexSuffix};
+}
+
+// The saved index is built without a time window, so it can be used
+// whatever the current window is
+cppcoro::task<> index_epg(cppcoro::static_thread_pool& tp,
+                          std::string_view epg, std::uint32_t source_id,
+                          const TimeWindow& time_window, bool use_scanner,
+                          bool is_parallel, const std::string& index_filename,
+                          EpgIndex& epg_index) {
+  co_await tp.schedule();
+  const Stats::Timer timer(Stats::Stage::kEpgIndex);
+  const Trace::Span span(Trace::Stage::kEpgIndex, source_id);
+  if (index_filename.empty()) {
+    co_await build_index(tp, epg, source_id, time_window, use_scanner,
+                         is_parallel, epg_index);
+  } else {
+    const auto epg_hash = hash_bytes(epg);
+    bool is_loaded;
+    {
+      const Trace::ThreadSpan load_span("load index"sv, source_id);
+      is_loaded = epg_index.load(index_filename, epg, epg_hash);
+    }
+    if (!is_loaded) {
+      co_await build_index(tp, epg, source_id, TimeWindow{}, use_scanner,
+                           is_parallel, epg_index);
+      const Trace::ThreadSpan save_span("save index"sv, source_id);
+      epg_index.save(index_filename, epg_hash);
+    }
+    const Trace::ThreadSpan window_span("apply time window"sv, source_id);
+    epg_index.apply_time_window(time_window);
+  }
+  Stats::add_bytes(Stats::Stage::kEpgIndex, epg.size());
+  Stats::add_items(
+      Stats::Stage::kEpgIndex,
+      epg_index.get_channels().size() + epg_index.get_programmes().size());
+}
+
 std::vector<std::string> load_epgs(const std::vector<std::string>& urls) {
   return load_resources(urls);
 }
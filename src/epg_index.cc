@@ -0,0 +1,501 @@
+#include "epg_index.h"
+
+#include <iconv.h>
+#include <libxml/parser.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <gsl/gsl>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "blob.h"
+#include "file.h"
+#include "sax_fsm.h"
+#include "version.h"
+#include "xmltv_scanner.h"
+#include "xmltv_time.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+// The document is passed to the parser in chunks of this size
+static constexpr std::size_t kParseChunkSize{4 * 1024 * 1024};
+
+static constexpr auto kUtf8Bom = "\xEF\xBB\xBF"sv;
+
+static constexpr auto kIndexMagic = "PEFTIEPG"sv;
+
+// The last byte is the revision of the blob layout
+static constexpr std::uint32_t kIndexVersion =
+    (kVersionMajor << 24) | (kVersionMinor << 16) | (kVersionPatch << 8) | 1;
+
+// Attributes of <programme>
+static constexpr auto kStart = "start"sv;
+static constexpr auto kStop = "stop"sv;
+
+static bool equals_ignoring_case(std::string_view lhs, std::string_view rhs) {
+  return std::ranges::equal(lhs, rhs, [](char l, char r) {
+    return std::tolower(static_cast<unsigned char>(l)) ==
+           std::tolower(static_cast<unsigned char>(r));
+  });
+}
+
+// Returns the length of the byte order mark and XML declaration at the
+// start of the document, or 0 if there are none
+static std::size_t get_declaration_size(std::string_view epg) {
+  std::size_t begin{0};
+  if (epg.starts_with(kUtf8Bom)) begin = kUtf8Bom.size();
+  if (epg.substr(begin).starts_with("<?xml"sv)) {
+    const auto end = epg.find("?>"sv, begin);
+    if (end != std::string_view::npos) return end + 2;
+  }
+  return begin;
+}
+
+// Returns the encoding that the document needs to be converted from, or an
+// empty string if it is already UTF-8
+static std::string get_source_encoding(std::string_view epg) {
+  if (epg.starts_with("\xFE\xFF"sv) || epg.starts_with("\xFF\xFE"sv))
+    return "UTF-16"s;
+  const auto declaration = epg.substr(0, get_declaration_size(epg));
+  auto pos = declaration.find("encoding"sv);
+  if (pos == std::string_view::npos) return {};
+  pos = declaration.find_first_of("\"'"sv, pos);
+  if (pos == std::string_view::npos) return {};
+  const auto end = declaration.find(declaration[pos], pos + 1);
+  if (end == std::string_view::npos) return {};
+  const auto encoding = declaration.substr(pos + 1, end - pos - 1);
+  if (equals_ignoring_case(encoding, "UTF-8"sv) ||
+      equals_ignoring_case(encoding, "US-ASCII"sv) ||
+      equals_ignoring_case(encoding, "ASCII"sv))
+    return {};
+  return std::string{encoding};
+}
+
+static std::string convert_to_utf8(std::string_view epg,
+                                   const std::string& encoding) {
+  iconv_t converter = iconv_open("UTF-8", encoding.c_str());
+  if (converter == reinterpret_cast<iconv_t>(-1))
+    throw std::runtime_error("Unsupported EPG encoding: "s + encoding);
+  auto close_converter =
+      gsl::finally([converter]() { iconv_close(converter); });
+  std::string output(epg.size() + epg.size() / 2 + 16, '\0');
+  char* input = const_cast<char*>(epg.data());
+  std::size_t input_left = epg.size();
+  std::size_t output_size{0};
+  while (input_left > 0) {
+    char* output_begin = output.data() + output_size;
+    std::size_t output_left = output.size() - output_size;
+    const auto result =
+        iconv(converter, &input, &input_left, &output_begin, &output_left);
+    output_size = output.size() - output_left;
+    if (result == static_cast<std::size_t>(-1)) {
+      if (errno != E2BIG)
+        throw std::runtime_error("Invalid "s + encoding + " text in EPG"s);
+      output.resize(output.size() * 2);
+    }
+  }
+  output.resize(output_size);
+  return output;
+}
+
+void EpgIndex::build(std::string_view epg, const TimeWindow& time_window,
+                     bool use_scanner) {
+  time_window_ = time_window;
+  const auto encoding = get_source_encoding(epg);
+  if (encoding.empty()) {
+    source_ = epg;
+    if (use_scanner) {
+      if (scan()) return;
+      clear();
+    }
+  } else {
+    converted_source_ = convert_to_utf8(epg, encoding);
+    source_ = converted_source_;
+  }
+  parse(!encoding.empty());
+}
+
+// Each chunk ends at the first channel or programme start tag after its
+// share of the content, the last one at the end tag of the root element
+std::vector<std::string_view> EpgIndex::split(std::string_view epg,
+                                              std::size_t num_chunks) {
+  if (num_chunks < 2 || !get_source_encoding(epg).empty()) return {};
+  // Finds the start tag of the root element. If this finds "<tv" in a
+  // comment then building the chunks fails.
+  auto root = epg.find("<tv"sv, get_declaration_size(epg));
+  while (root != std::string_view::npos && root + 3 < epg.size() &&
+         !std::isspace(static_cast<unsigned char>(epg[root + 3])) &&
+         epg[root + 3] != '>')
+    root = epg.find("<tv"sv, root + 3);
+  if (root == std::string_view::npos) return {};
+  const auto begin = epg.find('>', root);
+  const auto end = epg.rfind("</tv"sv);
+  if (begin == std::string_view::npos || end == std::string_view::npos ||
+      end <= begin)
+    return {};
+  // Returns the offset of the first start tag of a channel or programme at
+  // or after `offset`, or `end`
+  auto find_boundary = [epg, end](std::size_t offset) {
+    while (true) {
+      offset = epg.find('<', offset);
+      if (offset == std::string_view::npos || offset >= end) return end;
+      for (auto name : {"<programme"sv, "<channel"sv}) {
+        if (epg.substr(offset).starts_with(name) &&
+            offset + name.size() < end) {
+          const auto c = epg[offset + name.size()];
+          if (std::isspace(static_cast<unsigned char>(c)) || c == '>' ||
+              c == '/')
+            return offset;
+        }
+      }
+      ++offset;
+    }
+  };
+  std::vector<std::string_view> chunks;
+  const auto content_size = end - (begin + 1);
+  auto chunk_begin = begin + 1;
+  for (std::size_t i{1}; i <= num_chunks && chunk_begin < end; ++i) {
+    const auto target = begin + 1 + content_size * i / num_chunks;
+    const auto chunk_end =
+        (i == num_chunks) ? end
+                          : find_boundary(std::max(chunk_begin + 1, target));
+    chunks.push_back(epg.substr(chunk_begin, chunk_end - chunk_begin));
+    chunk_begin = chunk_end;
+  }
+  if (chunks.size() < 2) return {};
+  return chunks;
+}
+
+void EpgIndex::build_chunk(std::string_view epg, std::size_t header_size,
+                           std::string_view chunk,
+                           const TimeWindow& time_window, bool use_scanner) {
+  time_window_ = time_window;
+  converted_source_.reserve(header_size + chunk.size() + 5);
+  converted_source_ = epg.substr(0, header_size);
+  converted_source_ += chunk;
+  converted_source_ += "</tv>"sv;
+  source_ = converted_source_;
+  if (!use_scanner || !scan()) {
+    clear();
+    parse(false);
+  }
+  // Offsets in the chunk document become offsets in `epg`
+  const auto shift = std::uint64_t(chunk.data() - epg.data()) - header_size;
+  for (auto& element : channels_) element.offset += shift;
+  for (auto& element : programmes_) element.offset += shift;
+  prolog_ = epg.substr(prolog_.data() - source_.data(), prolog_.size());
+  source_ = epg;
+  converted_source_ = std::string{};
+}
+
+void EpgIndex::join(std::string_view epg,
+                    std::span<const EpgIndex> chunk_indexes) {
+  source_ = epg;
+  prolog_ = chunk_indexes.front().prolog_;
+  std::vector<ChannelId> channel_ids;
+  for (const auto& chunk_index : chunk_indexes) {
+    // Channel IDs are numbered in order of first appearance in each chunk,
+    // so adding them in order of chunks keeps the numbering of build()
+    channel_ids.clear();
+    for (const auto& channel_id : chunk_index.channel_ids_)
+      channel_ids.push_back(add_channel_id(channel_id));
+    auto append = [&channel_ids](std::span<const Element> elements,
+                                 std::vector<Element>& destination) {
+      for (auto element : elements) {
+        element.channel_id = channel_ids[element.channel_id];
+        destination.push_back(element);
+      }
+    };
+    append(chunk_index.channels_, channels_);
+    append(chunk_index.programmes_, programmes_);
+  }
+}
+
+bool EpgIndex::load(const std::string& filename, std::string_view epg,
+                    std::uint64_t epg_hash) {
+  std::error_code error;
+  if (!std::filesystem::exists(filename, error)) return false;
+  clear();
+  try {
+    const MappedFile file(filename);
+    BlobReader reader(file.get_data(), kIndexMagic, kIndexVersion, epg_hash);
+    reader.read_strings(channel_ids_);
+    const auto prolog_offset = reader.read<std::uint64_t>();
+    const auto prolog_size = reader.read<std::uint64_t>();
+    reader.read_array(channels_);
+    reader.read_array(programmes_);
+    if (!reader.is_at_end())
+      throw std::runtime_error("Unexpected data in EPG index"s);
+    auto is_valid = [&](const Element& element) {
+      return element.offset <= epg.size() &&
+             element.size <= epg.size() - element.offset &&
+             element.channel_id < channel_ids_.size();
+    };
+    if (prolog_offset > epg.size() ||
+        prolog_size > epg.size() - prolog_offset ||
+        !std::ranges::all_of(channels_, is_valid) ||
+        !std::ranges::all_of(programmes_, is_valid))
+      throw std::runtime_error("Invalid element in EPG index"s);
+    for (ChannelId id{0}; id < channel_ids_.size(); ++id)
+      channel_id_lookup_.emplace(channel_ids_[id], id);
+    source_ = epg;
+    prolog_ = epg.substr(prolog_offset, prolog_size);
+    return true;
+  } catch (const std::exception&) {
+    clear();
+    return false;
+  }
+}
+
+// Offsets are relative to the EPG, which is not part of the blob
+void EpgIndex::save(const std::string& filename,
+                    std::uint64_t epg_hash) const {
+  if (!converted_source_.empty()) return;
+  try {
+    BlobWriter writer;
+    writer.write_strings(channel_ids_);
+    writer.write(static_cast<std::uint64_t>(
+        prolog_.empty() ? 0 : prolog_.data() - source_.data()));
+    writer.write(static_cast<std::uint64_t>(prolog_.size()));
+    writer.write_array<Element>(channels_);
+    writer.write_array<Element>(programmes_);
+    std::filesystem::create_directories(
+        std::filesystem::path{filename}.parent_path());
+    write_file_atomically(filename,
+                          writer.finish(kIndexMagic, kIndexVersion, epg_hash));
+  } catch (const std::exception&) {
+  }
+}
+
+// Channel IDs that only the removed programmes referred to are removed too,
+// and the others are numbered again in order of first appearance in the
+// document, as build() numbers them
+void EpgIndex::apply_time_window(const TimeWindow& time_window) {
+  time_window_ = time_window;
+  const auto num_removed =
+      std::erase_if(programmes_, [this](const Element& element) {
+        return !is_in_time_window(element.start, element.stop);
+      });
+  if (num_removed == 0) return;
+  const auto old_channel_ids = std::move(channel_ids_);
+  std::vector<ChannelId> new_ids(old_channel_ids.size());
+  std::vector<char> is_numbered(old_channel_ids.size(), false);
+  channel_ids_.clear();
+  channel_id_lookup_.clear();
+  auto renumber = [&](Element& element) {
+    const auto id = element.channel_id;
+    if (!is_numbered[id]) {
+      new_ids[id] = add_channel_id(old_channel_ids[id]);
+      is_numbered[id] = true;
+    }
+    element.channel_id = new_ids[id];
+  };
+  std::size_t c{0};
+  std::size_t p{0};
+  while (c < channels_.size() || p < programmes_.size()) {
+    if (p == programmes_.size() ||
+        (c < channels_.size() &&
+         channels_[c].offset < programmes_[p].offset))
+      renumber(channels_[c++]);
+    else
+      renumber(programmes_[p++]);
+  }
+}
+
+// Most elements refer to a channel ID that has already been added, so the
+// ID is only copied into a string when it is new
+EpgIndex::ChannelId EpgIndex::add_channel_id(std::string_view channel_id) {
+  const auto iter = channel_id_lookup_.find(channel_id);
+  if (iter != channel_id_lookup_.end()) return iter->second;
+  const auto id = static_cast<ChannelId>(channel_ids_.size());
+  channel_id_lookup_.emplace(channel_id, id);
+  channel_ids_.emplace_back(channel_id);
+  return id;
+}
+
+void EpgIndex::clear() {
+  prolog_ = {};
+  channel_ids_.clear();
+  channel_id_lookup_.clear();
+  channels_.clear();
+  programmes_.clear();
+}
+
+// Programmes with dates that cannot be parsed are kept. A programme without
+// a stop date is treated as ending when it starts.
+bool EpgIndex::is_in_time_window(std::int64_t start, std::int64_t stop) const {
+  if (start == kNoTime) return true;
+  return time_window_.overlaps(start, (stop != kNoTime) ? stop : start);
+}
+
+void EpgIndex::parse_programme_times(int num_attributes,
+                                     const xmlChar** attributes) {
+  element_start_ = kNoTime;
+  element_stop_ = kNoTime;
+  for (int i = 0; i < num_attributes; ++i) {
+    const auto attribute = attributes + i * 5;
+    const std::string_view name{reinterpret_cast<const char*>(attribute[0])};
+    const std::string_view value{reinterpret_cast<const char*>(attribute[3]),
+                                 reinterpret_cast<const char*>(attribute[4])};
+    if (name == kStart)
+      element_start_ = parse_xmltv_time(value).value_or(kNoTime);
+    else if (name == kStop)
+      element_stop_ = parse_xmltv_time(value).value_or(kNoTime);
+  }
+}
+
+// Returns the offset in source_ of the parser's current position
+std::uint64_t EpgIndex::get_parser_offset() const {
+  const auto input = parser_context_->input;
+  return input->consumed + (input->cur - input->base);
+}
+
+// The document is fed to a push parser so that libxml2 only buffers one
+// chunk at a time. Converted documents are UTF-8 whatever their XML
+// declaration says, so the declared encoding is ignored.
+void EpgIndex::parse(bool ignore_declared_encoding) {
+  xmlSAXHandler sax_handler;
+  memset(&sax_handler, 0, sizeof(sax_handler));
+  sax_handler.initialized = XML_SAX2_MAGIC;
+  sax_handler.startElementNs = &EpgIndex::handler_start_element;
+  sax_handler.endElementNs = &EpgIndex::handler_end_element;
+  // libxml2 only looks up the entities of the internal subset when the
+  // user data is the parser context, so the index is its private data
+  parser_context_ =
+      xmlCreatePushParserCtxt(&sax_handler, nullptr, nullptr, 0, nullptr);
+  if (!parser_context_)
+    throw std::runtime_error("xmlCreatePushParserCtxt() returned NULL");
+  parser_context_->_private = this;
+  auto free_parser_context = gsl::finally([this]() {
+    // libxml2 creates a document for the DTD of an internal subset
+    if (parser_context_->myDoc) xmlFreeDoc(parser_context_->myDoc);
+    xmlFreeParserCtxt(parser_context_);
+    parser_context_ = nullptr;
+  });
+  if (ignore_declared_encoding)
+    xmlCtxtUseOptions(parser_context_, XML_PARSE_IGNORE_ENC);
+  std::size_t offset{0};
+  do {
+    const auto size = std::min(kParseChunkSize, source_.size() - offset);
+    const bool is_last_chunk = (offset + size == source_.size());
+    if (xmlParseChunk(parser_context_, source_.data() + offset,
+                      static_cast<int>(size), is_last_chunk) != 0)
+      throw std::runtime_error("Failed to parse XML document");
+    offset += size;
+  } while (offset < source_.size());
+  if (!parser_context_->wellFormed)
+    throw std::runtime_error("Failed to parse XML document");
+}
+
+// Indexes the document with XmltvScanner, returns false if the scanner
+// does not support the document
+bool EpgIndex::scan() {
+  XmltvScanner scanner(source_, get_declaration_size(source_));
+  XmltvScanner::Element element;
+  while (true) {
+    switch (scanner.next(element)) {
+      case XmltvScanner::Result::kEnd:
+        prolog_ = scanner.get_prolog();
+        return true;
+      case XmltvScanner::Result::kUnsupported:
+        return false;
+      case XmltvScanner::Result::kElement:
+        break;
+    }
+    auto start = kNoTime;
+    auto stop = kNoTime;
+    if (element.is_programme) {
+      start = parse_xmltv_time(element.start).value_or(kNoTime);
+      stop = parse_xmltv_time(element.stop).value_or(kNoTime);
+      if (!is_in_time_window(start, stop)) continue;
+    }
+    auto& elements = element.is_programme ? programmes_ : channels_;
+    elements.push_back({element.offset,
+                        static_cast<std::uint32_t>(element.size),
+                        add_channel_id(element.channel_id), start, stop});
+  }
+}
+
+// The index of a parser context, see EpgIndex::parse()
+static EpgIndex& get_index(void* context) noexcept {
+  const auto parser_context = static_cast<xmlParserCtxtPtr>(context);
+  return *static_cast<EpgIndex*>(parser_context->_private);
+}
+
+// SAX2 handler for the start of an element. The parser has just read the
+// attributes, so the element starts at the last '<' before the parser's
+// position, attribute values cannot contain '<'.
+void EpgIndex::handler_start_element(void* context, const xmlChar* local_name,
+                                     const xmlChar*, const xmlChar*, int,
+                                     const xmlChar**, int num_attributes, int,
+                                     const xmlChar** attributes) {
+  auto& index = get_index(context);
+  ++index.depth_;
+  if (index.depth_ > 2) return;
+  const auto offset = index.source_.rfind('<', index.get_parser_offset());
+  if (index.depth_ == 1) {
+    const auto prolog_begin = get_declaration_size(index.source_);
+    if (prolog_begin <= offset)
+      index.prolog_ = index.source_.substr(prolog_begin, offset - prolog_begin);
+    return;
+  }
+  const std::string_view element_name{
+      reinterpret_cast<const char*>(local_name)};
+  std::string_view attribute_name;
+  if (element_name == SaxFsm::KChannel) {
+    attribute_name = SaxFsm::kId;
+    index.element_list_ = &index.channels_;
+    index.element_start_ = kNoTime;
+    index.element_stop_ = kNoTime;
+  } else if (element_name == SaxFsm::kProgramme) {
+    index.parse_programme_times(num_attributes, attributes);
+    if (!index.is_in_time_window(index.element_start_, index.element_stop_))
+      return;
+    attribute_name = SaxFsm::KChannel;
+    index.element_list_ = &index.programmes_;
+  } else {
+    return;
+  }
+  std::string channel_id;
+  for (int i = 0; i < num_attributes; ++i) {
+    const auto attribute = attributes + i * 5;
+    if (attribute_name == reinterpret_cast<const char*>(attribute[0])) {
+      channel_id = unescape_attribute_value(
+          {reinterpret_cast<const char*>(attribute[3]),
+           reinterpret_cast<const char*>(attribute[4])});
+      break;
+    }
+  }
+  index.element_offset_ = offset;
+  index.element_channel_id_ = index.add_channel_id(channel_id);
+}
+
+// SAX2 handler for the end of an element. The parser is after the '>' of
+// the end tag, or at the "/>" of an empty element.
+void EpgIndex::handler_end_element(void* context, const xmlChar*,
+                                   const xmlChar*, const xmlChar*) {
+  auto& index = get_index(context);
+  if (index.depth_ == 2 && index.element_list_) {
+    auto end = index.get_parser_offset();
+    if (end == 0 || index.source_[end - 1] != '>') end += 2;
+    index.element_list_->push_back(
+        {index.element_offset_,
+         static_cast<std::uint32_t>(end - index.element_offset_),
+         index.element_channel_id_, index.element_start_,
+         index.element_stop_});
+    index.element_list_ = nullptr;
+  }
+  --index.depth_;
+}
+
+}  // namespace pefti
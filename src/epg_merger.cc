@@ -0,0 +1,258 @@
+#include "epg_merger.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "epg_index.h"
+#include "playlist.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+EpgMerger::EpgMerger(const std::vector<EpgIndex>& epg_indexes,
+                     const Playlist& playlist, std::size_t memory_budget,
+                     std::string spill_filename)
+    : epg_indexes_(epg_indexes),
+      playlist_(playlist),
+      max_records_in_memory_(
+          std::max<std::size_t>(memory_budget / sizeof(Record), 1)),
+      spill_filename_(std::move(spill_filename)) {}
+
+EpgMerger::~EpgMerger() {
+  if (spill_stream_.is_open()) {
+    spill_stream_.close();
+    std::error_code error;
+    std::filesystem::remove(spill_filename_, error);
+  }
+}
+
+void EpgMerger::merge(const WriteElement& write_channel,
+                      const WriteElement& write_programme) {
+  assign_channel_keys();
+  write_channels(write_channel);
+  for (std::uint32_t source{0}; source < epg_indexes_.size(); ++source) {
+    const auto programmes = epg_indexes_[source].get_programmes();
+    const auto& keys = channel_keys_[source];
+    for (std::uint32_t i{0}; i < programmes.size(); ++i) {
+      const auto& programme = programmes[i];
+      const auto channel_key = keys[programme.channel_id];
+      if (channel_key == kNotKept) continue;
+      add_record({channel_key, source, i, programme.start, programme.stop});
+    }
+  }
+  if (runs_.empty()) {
+    // Everything fits in memory
+    std::ranges::sort(records_, {}, &Record::get_sort_key);
+    auto begin = records_.begin();
+    while (begin != records_.end()) {
+      const auto end = std::find_if(begin, records_.end(), [&](auto& record) {
+        return record.channel_key != begin->channel_key;
+      });
+      std::vector<Record> channel_records(begin, end);
+      resolve_channel(channel_records, write_programme);
+      begin = end;
+    }
+  } else {
+    spill_run();
+    merge_runs(write_programme);
+  }
+}
+
+void EpgMerger::add_record(const Record& record) {
+  if (records_.size() == max_records_in_memory_) spill_run();
+  records_.push_back(record);
+}
+
+// The channel IDs of the EPGs are mapped to one set of keys, so that
+// records of the same channel from different EPGs sort together
+void EpgMerger::assign_channel_keys() {
+  std::unordered_map<std::string_view, std::uint32_t> keys;
+  channel_keys_.resize(epg_indexes_.size());
+  for (std::size_t source{0}; source < epg_indexes_.size(); ++source) {
+    const auto& channel_ids = epg_indexes_[source].get_channel_ids();
+    auto& source_keys = channel_keys_[source];
+    source_keys.resize(channel_ids.size());
+    for (std::size_t i{0}; i < channel_ids.size(); ++i) {
+      if (!playlist_.is_tvg_id_in_playlist(channel_ids[i])) {
+        source_keys[i] = kNotKept;
+        continue;
+      }
+      auto [iter, is_new] = keys.try_emplace(channel_ids[i], num_channel_keys_);
+      if (is_new) ++num_channel_keys_;
+      source_keys[i] = iter->second;
+    }
+  }
+}
+
+// K-way merge of the sorted runs. Each run is read through its own buffer,
+// the buffers share the memory budget.
+void EpgMerger::merge_runs(const WriteElement& write_programme) {
+  struct RunReader {
+    Run run;
+    std::vector<Record> buffer;
+    std::size_t next{0};
+  };
+  const auto buffer_size =
+      std::max<std::size_t>(max_records_in_memory_ / runs_.size(), 1);
+  std::vector<RunReader> readers;
+  readers.reserve(runs_.size());
+  for (const auto& run : runs_) readers.push_back({run, {}, 0});
+  records_.clear();
+  records_.shrink_to_fit();
+  //
+  // Returns false when the run is exhausted
+  auto fill_buffer = [this, buffer_size](RunReader& reader) {
+    const auto count = std::min<std::uint64_t>(buffer_size,
+                                               reader.run.num_records);
+    if (count == 0) return false;
+    reader.buffer.resize(count);
+    spill_stream_.seekg(reader.run.offset);
+    spill_stream_.read(reinterpret_cast<char*>(reader.buffer.data()),
+                       count * sizeof(Record));
+    if (!spill_stream_)
+      throw std::runtime_error("Failed to read EPG merge spill file"s);
+    reader.run.offset += count * sizeof(Record);
+    reader.run.num_records -= count;
+    reader.next = 0;
+    return true;
+  };
+  auto is_after = [&readers](std::size_t lhs, std::size_t rhs) {
+    return readers[lhs].buffer[readers[lhs].next].get_sort_key() >
+           readers[rhs].buffer[readers[rhs].next].get_sort_key();
+  };
+  std::priority_queue<std::size_t, std::vector<std::size_t>,
+                      decltype(is_after)>
+      queue(is_after);
+  for (std::size_t i{0}; i < readers.size(); ++i)
+    if (fill_buffer(readers[i])) queue.push(i);
+  std::vector<Record> channel_records;
+  while (!queue.empty()) {
+    const auto i = queue.top();
+    queue.pop();
+    auto& reader = readers[i];
+    const auto& record = reader.buffer[reader.next];
+    if (!channel_records.empty() &&
+        channel_records.front().channel_key != record.channel_key) {
+      resolve_channel(channel_records, write_programme);
+      channel_records.clear();
+    }
+    channel_records.push_back(record);
+    if (++reader.next < reader.buffer.size() || fill_buffer(reader))
+      queue.push(i);
+  }
+  if (!channel_records.empty())
+    resolve_channel(channel_records, write_programme);
+}
+
+// Decides which programmes of one channel are written. `records` are in
+// order of start time. The EPGs are visited in order of priority and the
+// programmes that are kept block overlapping programmes of later EPGs.
+void EpgMerger::resolve_channel(std::vector<Record>& records,
+                                const WriteElement& write_programme) {
+  // Programmes of EPGs with a higher priority, sorted by start time, with
+  // the latest stop time of each prefix so that an overlap can be found
+  // with a binary search
+  std::vector<std::pair<std::int64_t, std::int64_t>> blocking;
+  std::vector<std::int64_t> max_stop;
+  std::vector<std::pair<std::int64_t, std::int64_t>> accepted;
+  auto add_accepted_to_blocking = [&]() {
+    blocking.insert(blocking.end(), accepted.begin(), accepted.end());
+    std::ranges::sort(blocking);
+    max_stop.resize(blocking.size());
+    std::int64_t stop{EpgIndex::kNoTime};
+    for (std::size_t i{0}; i < blocking.size(); ++i)
+      max_stop[i] = stop = std::max(stop, blocking[i].second);
+    accepted.clear();
+  };
+  auto is_blocked = [&](std::int64_t start, std::int64_t stop) {
+    const auto end = std::ranges::lower_bound(
+        blocking, std::pair{stop, EpgIndex::kNoTime});
+    const auto count = end - blocking.begin();
+    return count > 0 && max_stop[count - 1] > start;
+  };
+  std::vector<std::size_t> order(records.size());
+  for (std::size_t i{0}; i < order.size(); ++i) order[i] = i;
+  std::ranges::stable_sort(order, {}, [&records](std::size_t i) {
+    return records[i].source;
+  });
+  std::vector<bool> is_kept(records.size());
+  std::uint32_t source{0};
+  std::int64_t previous_start{EpgIndex::kNoTime};
+  for (auto i : order) {
+    const auto& record = records[i];
+    if (record.source != source) {
+      add_accepted_to_blocking();
+      source = record.source;
+      previous_start = EpgIndex::kNoTime;
+    }
+    if (record.start == EpgIndex::kNoTime) {
+      is_kept[i] = true;
+      continue;
+    }
+    if (record.start == previous_start) continue;
+    // Programmes without a stop time, or with no duration, still occupy
+    // their start time
+    const auto stop = std::max(record.stop, record.start + 1);
+    if (is_blocked(record.start, stop)) continue;
+    is_kept[i] = true;
+    previous_start = record.start;
+    accepted.emplace_back(record.start, stop);
+  }
+  for (std::size_t i{0}; i < records.size(); ++i) {
+    if (!is_kept[i]) continue;
+    const auto& index = epg_indexes_[records[i].source];
+    write_programme(records[i].source,
+                    index.get_text(index.get_programmes()[records[i].element]));
+  }
+}
+
+// Sorts the records in memory and appends them to the spill file as a run
+void EpgMerger::spill_run() {
+  if (records_.empty()) return;
+  if (!spill_stream_.is_open()) {
+    spill_stream_.open(spill_filename_, std::ios::in | std::ios::out |
+                                            std::ios::trunc |
+                                            std::ios::binary);
+    if (!spill_stream_)
+      throw std::runtime_error("Failed to create EPG merge spill file"s);
+  }
+  std::ranges::sort(records_, {}, &Record::get_sort_key);
+  spill_stream_.seekp(0, std::ios::end);
+  const std::uint64_t offset = spill_stream_.tellp();
+  spill_stream_.write(reinterpret_cast<const char*>(records_.data()),
+                      records_.size() * sizeof(Record));
+  if (!spill_stream_)
+    throw std::runtime_error("Failed to write EPG merge spill file"s);
+  runs_.push_back({offset, records_.size()});
+  records_.clear();
+}
+
+// Channels are written in order of EPG priority, then document order
+void EpgMerger::write_channels(const WriteElement& write_channel) {
+  std::vector<bool> is_written(num_channel_keys_);
+  for (std::size_t source{0}; source < epg_indexes_.size(); ++source) {
+    const auto& index = epg_indexes_[source];
+    const auto& keys = channel_keys_[source];
+    for (const auto& channel : index.get_channels()) {
+      const auto channel_key = keys[channel.channel_id];
+      if (channel_key == kNotKept || is_written[channel_key]) continue;
+      is_written[channel_key] = true;
+      write_channel(static_cast<std::uint32_t>(source),
+                    index.get_text(channel));
+    }
+  }
+}
+
+}  // namespace pefti
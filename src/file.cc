@@ -0,0 +1,82 @@
+#include "file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+using namespace std::literals;
+
+namespace pefti {
+
+MappedFile::MappedFile(const std::string& filename) {
+  const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) throw std::runtime_error(filename + ": failed to open"s);
+  struct stat status;
+  if (::fstat(fd, &status) != 0) {
+    ::close(fd);
+    throw std::runtime_error(filename + ": failed to get file size"s);
+  }
+  size_ = static_cast<std::size_t>(status.st_size);
+  if (size_ > 0) {
+    void* address = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error(filename + ": failed to map file"s);
+    }
+    data_ = static_cast<const char*>(address);
+  }
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() { unmap(); }
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    unmap();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+void MappedFile::unmap() noexcept {
+  if (data_ != nullptr) ::munmap(const_cast<char*>(data_), size_);
+  data_ = nullptr;
+  size_ = 0;
+}
+
+void write_file_atomically(const std::string& filename,
+                           std::string_view data) {
+  const auto temp_filename =
+      filename + ".tmp."s + std::to_string(::getpid());
+  {
+    std::ofstream file(temp_filename, std::ios::binary | std::ios::trunc);
+    if (!file) throw std::runtime_error(temp_filename + ": failed to create"s);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    file.close();
+    if (!file) {
+      std::filesystem::remove(temp_filename);
+      throw std::runtime_error(temp_filename + ": failed to write"s);
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temp_filename, filename, error);
+  if (error) {
+    std::filesystem::remove(temp_filename, error);
+    throw std::runtime_error(filename + ": failed to rename"s);
+  }
+}
+
+}  // namespace pefti
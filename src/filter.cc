@@ -3,59 +3,258 @@
 #include <libxml/parser.h>
 #include <libxml/xmlmemory.h>
 
+#include <algorithm>
 #include <cppcoro/static_thread_pool.hpp>
 #include <cppcoro/task.hpp>
+#include <cppcoro/when_all.hpp>
+#include <cstddef>
+#include <filesystem>
 #include <fstream>
 #include <gsl/gsl>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <system_error>
 #include <vector>
 
 #include "buffers.h"
 #include "config.h"
+#include "epg_index.h"
+#include "epg_merger.h"
+#include "http_server.h"
 #include "iptv_channel.h"
 #include "mapper.h"
+#include "output_file.h"
 #include "playlist.h"
 #include "sax_fsm.h"
+#include "stats.h"
+#include "trace.h"
 
 using namespace std::literals;
 
 namespace pefti {
 
-// Copies XML nodes from source to destination if the channel in the source
-// matches a channel in the playlist
+// Suffix of the temporary files that hold the programmes of the new EPG
+static constexpr auto kSpillSuffix = ".programmes.tmp"sv;
+
+// Smallest number of elements of an EPG that is worth filtering on its own
+// thread
+static constexpr std::size_t kMinElementsPerPart{100'000};
+
+// Suffix of the temporary file that holds the sorted runs when merging EPGs
+static constexpr auto kMergeSpillSuffix = ".merge.tmp"sv;
+
+// Copies the <channel> and <programme> nodes from source to the channel and
+// programme destinations if the channel in the source matches a channel in
+// the playlist. Each parse has its own parser context, so EPGs can be
+// parsed concurrently.
 void Filter::copy_xml_nodes(const std::string& source,
-                            std::string_view node_name,
-                            std::ofstream& destination) {
-  xmlSAXHandler sax_handler;
-  memset(&sax_handler, 0, sizeof(sax_handler));
-  sax_handler.initialized = XML_SAX2_MAGIC;
-  sax_handler.startElementNs = &SaxFsm::handler_start_element;
-  sax_handler.endElementNs = &SaxFsm::handler_end_element;
-  sax_handler.characters = &SaxFsm::handler_characters;
-  SaxFsm fsm(std::string{node_name}, destination, playlist_);
-  int result = xmlSAXUserParseMemory(&sax_handler, &fsm, source.c_str(),
-                                     int(source.size()));
-  if (result != 0) throw std::runtime_error("Failed to parse XML document");
-  xmlCleanupParser();
+                            std::ostream& channel_destination,
+                            std::ostream& programme_destination) {
+  SaxFsm fsm(channel_destination, programme_destination, playlist_);
+  fsm.parse(source);
+}
+
+// Copies the given elements of the index that belong to the channels in the
+// playlist. In verbatim mode the source bytes of the elements are copied as
+// they are. Otherwise a document is built from the elements and its nodes
+// are copied with copy_xml_nodes(), so only the kept elements are parsed a
+// second time. The new EPG does not have the DOCTYPE declaration of the
+// source, so the elements of an EPG with an internal subset are rebuilt
+// even in verbatim mode: they could use the entities that it declares.
+void Filter::copy_indexed_nodes(const EpgIndex& index,
+                                std::span<const EpgIndex::Element> channels,
+                                std::span<const EpgIndex::Element> programmes,
+                                std::ostream& channel_destination,
+                                std::ostream& programme_destination) {
+  const auto& channel_ids = index.get_channel_ids();
+  std::vector<bool> is_kept(channel_ids.size());
+  for (std::size_t i{0}; i < channel_ids.size(); ++i)
+    is_kept[i] = playlist_.is_tvg_id_in_playlist(channel_ids[i]);
+  if (config_.get_epg_output_mode() == ConfigType::EpgOutputMode::kVerbatim &&
+      !index.has_internal_subset()) {
+    auto copy_elements = [&index, &is_kept](auto elements,
+                                            std::ostream& destination) {
+      for (const auto& element : elements) {
+        if (!is_kept[element.channel_id]) continue;
+        destination << '\n';
+        const auto text = index.get_text(element);
+        destination.write(text.data(), std::ssize(text));
+      }
+    };
+    copy_elements(channels, channel_destination);
+    copy_elements(programmes, programme_destination);
+    return;
+  }
+  std::string document{index.get_prolog()};
+  document += "<tv>";
+  for (const auto& element : channels)
+    if (is_kept[element.channel_id]) document += index.get_text(element);
+  for (const auto& element : programmes)
+    if (is_kept[element.channel_id]) document += index.get_text(element);
+  document += "</tv>";
+  copy_xml_nodes(document, channel_destination, programme_destination);
 }
 
 // Filters EPGs and creates a new EPG file.
 // Copies <channel> and <programme> nodes from all input EPGs to the new EPG.
-void Filter::filter(std::vector<std::string>&& epgs,
-                    std::string_view new_epg_filename) {
-  if (epgs.empty()) return;
+// Each EPG is filtered by its own task into its own segment: the channels
+// are kept in memory and the programmes are spilled to a temporary file next
+// to the new EPG. XMLTV requires all of the channels to come before the
+// programmes, so the channel segments are written first, followed by the
+// programme segments, both in the configured order of the EPGs. With
+// [epg].parallel_parse a large EPG is split into parts, in document order,
+// that are filtered by their own tasks into their own segments. When the
+// EPGs are merged there is a single segment, written by the merge task.
+cppcoro::task<> Filter::filter(cppcoro::static_thread_pool& tp,
+                               const std::vector<EpgIndex>& epg_indexes,
+                               std::string_view new_epg_filename,
+                               HttpServer* http_server) {
+  if (epg_indexes.empty()) co_return;
   Expects(!new_epg_filename.empty());
   LIBXML_TEST_VERSION;  // Check for library ABI mismatch
-  std::ofstream new_epg_stream{std::string{new_epg_filename}};
+  xmlInitParser();      // Must be called before parsing on several threads
+  OutputFile new_epg{new_epg_filename, http_server};
+  struct EpgSegment {
+    std::ostringstream channels;
+    std::string programmes_filename;
+    std::fstream programmes;
+  };
+  // Elements of an EPG that are filtered by one task
+  struct EpgPart {
+    const EpgIndex* index;
+    std::span<const EpgIndex::Element> channels;
+    std::span<const EpgIndex::Element> programmes;
+  };
+  const bool is_merge_enabled = config_.is_epg_merge_enabled();
+  std::vector<EpgPart> parts;
+  if (!is_merge_enabled) {
+    for (const auto& index : epg_indexes) {
+      const auto channels = index.get_channels();
+      const auto programmes = index.get_programmes();
+      std::size_t num_parts{1};
+      if (config_.is_epg_parallel_parse_enabled()) {
+        num_parts = std::clamp<std::size_t>(
+            (channels.size() + programmes.size()) / kMinElementsPerPart, 1,
+            tp.thread_count());
+      }
+      for (std::size_t p{0}; p < num_parts; ++p) {
+        auto get_part = [p, num_parts](auto elements) {
+          const auto begin = elements.size() * p / num_parts;
+          const auto end = elements.size() * (p + 1) / num_parts;
+          return elements.subspan(begin, end - begin);
+        };
+        parts.push_back({&index, get_part(channels), get_part(programmes)});
+      }
+    }
+  }
+  std::vector<EpgSegment> segments(is_merge_enabled ? 1 : parts.size());
+  auto remove_spill_files = gsl::finally([&segments]() {
+    for (auto& segment : segments) {
+      segment.programmes.close();
+      std::error_code error;
+      std::filesystem::remove(segment.programmes_filename, error);
+    }
+  });
+  std::vector<cppcoro::task<>> tasks;
+  for (std::size_t i{0}; i < segments.size(); ++i) {
+    auto& segment = segments[i];
+    segment.programmes_filename = std::string{new_epg_filename} + '.' +
+                                  std::to_string(i) + std::string{kSpillSuffix};
+    segment.programmes.open(segment.programmes_filename,
+                            std::ios::in | std::ios::out | std::ios::trunc |
+                                std::ios::binary);
+    if (!segment.programmes)
+      throw std::runtime_error("Failed to create EPG spill file"s);
+    if (is_merge_enabled) {
+      auto spill_filename =
+          std::string{new_epg_filename} + std::string{kMergeSpillSuffix};
+      tasks.push_back(merge_epgs(tp, epg_indexes, std::move(spill_filename),
+                                 segment.channels, segment.programmes));
+    } else {
+      tasks.push_back(filter_epg(tp, *parts[i].index, parts[i].channels,
+                                 parts[i].programmes, segment.channels,
+                                 segment.programmes));
+    }
+  }
+  co_await cppcoro::when_all(std::move(tasks));
+  auto& new_epg_stream = new_epg.get_stream();
   new_epg_stream << R"(<?xml version="1.0" encoding="utf-8"?>)" << '\n';
   new_epg_stream << R"(<!DOCTYPE tv SYSTEM "xmltv.dtd">)" << '\n';
   new_epg_stream << R"(<tv generator-info-name="pefti">)";
-  for (const auto& epg : epgs) {
-    copy_xml_nodes(epg, SaxFsm::KChannel, new_epg_stream);
-    copy_xml_nodes(epg, SaxFsm::kProgramme, new_epg_stream);
+  for (auto& segment : segments) {
+    new_epg_stream << segment.channels.view();
+    co_await new_epg.flush(tp);
+  }
+  for (auto& segment : segments) {
+    segment.programmes.flush();
+    segment.programmes.seekg(0);
+    co_await new_epg.copy(tp, segment.programmes);
   }
   new_epg_stream << "\n</tv>" << '\n';
-  new_epg_stream.close();
+  co_await new_epg.close(tp);
+}
+
+// Filters elements of one EPG on a thread of the pool
+cppcoro::task<> Filter::filter_epg(
+    cppcoro::static_thread_pool& tp, const EpgIndex& epg_index,
+    std::span<const EpgIndex::Element> channels,
+    std::span<const EpgIndex::Element> programmes,
+    std::ostream& channel_destination, std::ostream& programme_destination) {
+  co_await tp.schedule();
+  copy_indexed_nodes(epg_index, channels, programmes, channel_destination,
+                     programme_destination);
+}
+
+// Merges the EPGs on a thread of the pool, see EpgMerger. The merged
+// elements are written the same way as by copy_indexed_nodes(). Each
+// element is rebuilt in a document with the prolog of its own EPG, so that
+// the entities declared in the DTD of any of the EPGs resolve. Consecutive
+// elements of EPGs with the same prolog are rebuilt from one document. In
+// verbatim mode only the elements of EPGs with an internal subset are
+// rebuilt, the pending document is copied before each verbatim element to
+// keep the merged order.
+cppcoro::task<> Filter::merge_epgs(cppcoro::static_thread_pool& tp,
+                                   const std::vector<EpgIndex>& epg_indexes,
+                                   std::string spill_filename,
+                                   std::ostream& channel_destination,
+                                   std::ostream& programme_destination) {
+  co_await tp.schedule();
+  EpgMerger merger(epg_indexes, playlist_,
+                   config_.get_epg_merge_memory_budget(),
+                   std::move(spill_filename));
+  const bool is_verbatim = config_.get_epg_output_mode() ==
+                           ConfigType::EpgOutputMode::kVerbatim;
+  std::string_view prolog;
+  std::string document;
+  auto copy_document = [&] {
+    if (document.empty()) return;
+    document += "</tv>";
+    copy_xml_nodes(document, channel_destination, programme_destination);
+    document.clear();
+  };
+  auto write_to = [&](std::ostream& destination) {
+    return [&](std::uint32_t source, std::string_view text) {
+      const auto& index = epg_indexes[source];
+      if (is_verbatim && !index.has_internal_subset()) {
+        copy_document();
+        destination << '\n';
+        destination.write(text.data(), std::ssize(text));
+        return;
+      }
+      if (document.empty() || index.get_prolog() != prolog) {
+        copy_document();
+        prolog = index.get_prolog();
+        document = prolog;
+        document += "<tv>";
+      }
+      document += text;
+    };
+  };
+  merger.merge(write_to(channel_destination), write_to(programme_destination));
+  copy_document();
 }
 
 // Filters IPTV channels.
@@ -72,7 +271,7 @@ cppcoro::task<> Filter::filter(cppcoro::static_thread_pool& tp,
   };
   //
   const auto is_blocked_channel = [this](auto&& channel) {
-    return config_.is_blocked_channel(channel.get_original_name());
+    return config_.is_blocked_channel(channel.get_normalized_name());
   };
   //
   const auto is_blocked_url = [this](auto&& channel) {
@@ -92,29 +291,49 @@ cppcoro::task<> Filter::filter(cppcoro::static_thread_pool& tp,
             (config_.is_allowed_group(*group_title)));
   };
   //
-  const auto is_allowed_channel = [this](auto&& channel) {
-    return channels_mapper_.is_allowed_channel(channel);
+  // Stamps the channel with the reason it is allowed, returns false if it is
+  // not allowed. A channel that matches a template is handled as a template
+  // channel even if its group is also allowed.
+  const auto stamp_allow_reason = [&, this](auto&& channel) {
+    if (config_.get_num_channels_templates() > 0) {
+      const auto template_id =
+          channels_mapper_.map_channel_to_template(channel);
+      if (template_id) {
+        channel.set_allowed(IptvChannel::AllowReason::kTemplate, *template_id);
+        return true;
+      }
+    }
+    if (are_all_channels_allowed()) {
+      channel.set_allowed(IptvChannel::AllowReason::kAll);
+    } else if (is_allowed_group(channel)) {
+      channel.set_allowed(IptvChannel::AllowReason::kGroup);
+    } else {
+      return false;
+    }
+    return true;
   };
   //
   // End of lambdas
   //
   co_await tp.schedule();
+  const Stats::Timer timer(Stats::Stage::kFilter);
+  const Trace::Span span(Trace::Stage::kFilter, pf_buffer.source_id);
   const auto kPfIndexMask = pf_buffer.get_index_mask();
   const auto kFtIndexMask = ft_buffer.get_index_mask();
   size_t pf_read_index{0};
   bool received_sentinel{false};
   while (!received_sentinel) {
     const size_t pf_write_index =
-        co_await pf_buffer.sequencer.wait_until_published(pf_read_index, tp);
+        co_await pf_buffer.wait_until_published(pf_read_index, tp);
+    const Trace::Span batch_span(Trace::Stage::kFilter, pf_buffer.source_id,
+                                 "batch"sv);
     do {
       auto& channel = pf_buffer.data[pf_read_index & kPfIndexMask];
       const bool is_sentinel = channel.get_original_name() == kSentinel;
       if (!is_sentinel) {
         if (!is_blocked_group(channel) && !is_blocked_channel(channel) &&
-            !is_blocked_url(channel) &&
-            (are_all_channels_allowed() || is_allowed_group(channel) ||
-             is_allowed_channel(channel))) {
-          size_t ft_write_index = co_await ft_buffer.sequencer.claim_one(tp);
+            !is_blocked_url(channel) && stamp_allow_reason(channel)) {
+          size_t ft_write_index = co_await ft_buffer.claim_one(tp);
           ft_buffer.data[ft_write_index & kFtIndexMask] = std::move(channel);
           ft_buffer.sequencer.publish(ft_write_index);
         }
@@ -125,6 +344,7 @@ cppcoro::task<> Filter::filter(cppcoro::static_thread_pool& tp,
     } while (pf_read_index++ != pf_write_index);
     pf_buffer.barrier.publish(pf_read_index);
   }
+  Stats::add_items(Stats::Stage::kFilter, pf_read_index);
   co_await publish_sentinel(tp, ft_buffer);
 }
 
@@ -134,7 +354,7 @@ cppcoro::task<> Filter::publish_sentinel(
     PlaylistFilterTransformerBuffer& ft_buffer) {
   co_await tp.schedule();
   const auto kIndexMask = ft_buffer.get_index_mask();
-  size_t write_index = co_await ft_buffer.sequencer.claim_one(tp);
+  size_t write_index = co_await ft_buffer.claim_one(tp);
   IptvChannel sentinel;
   sentinel.set_original_name(kSentinel);
   ft_buffer.data[write_index & kIndexMask] = std::move(sentinel);
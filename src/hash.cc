@@ -0,0 +1,122 @@
+#include "hash.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace pefti {
+
+static constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+static constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr std::uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+static constexpr std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr std::uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+static std::uint64_t read64(const char* data) {
+  std::uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  if constexpr (std::endian::native == std::endian::big)
+    value = __builtin_bswap64(value);
+  return value;
+}
+
+static std::uint32_t read32(const char* data) {
+  std::uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  if constexpr (std::endian::native == std::endian::big)
+    value = __builtin_bswap32(value);
+  return value;
+}
+
+static std::uint64_t round(std::uint64_t accumulator, std::uint64_t input) {
+  accumulator += input * kPrime2;
+  accumulator = std::rotl(accumulator, 31);
+  return accumulator * kPrime1;
+}
+
+static std::uint64_t merge_round(std::uint64_t hash,
+                                 std::uint64_t accumulator) {
+  hash ^= round(0, accumulator);
+  return hash * kPrime1 + kPrime4;
+}
+
+Hasher::Hasher(std::uint64_t seed)
+    : accumulators_{seed + kPrime1 + kPrime2, seed + kPrime2, seed,
+                    seed - kPrime1},
+      seed_(seed) {}
+
+void Hasher::update(std::string_view data) {
+  total_size_ += data.size();
+  auto process_stripe = [this](const char* stripe) {
+    for (std::size_t i{0}; i < accumulators_.size(); ++i)
+      accumulators_[i] = round(accumulators_[i], read64(stripe + i * 8));
+  };
+  if (stripe_size_ > 0) {
+    const auto num_to_copy = std::min(kStripeSize - stripe_size_, data.size());
+    std::memcpy(stripe_.data() + stripe_size_, data.data(), num_to_copy);
+    stripe_size_ += num_to_copy;
+    data.remove_prefix(num_to_copy);
+    if (stripe_size_ < kStripeSize) return;
+    process_stripe(stripe_.data());
+    stripe_size_ = 0;
+  }
+  while (data.size() >= kStripeSize) {
+    process_stripe(data.data());
+    data.remove_prefix(kStripeSize);
+  }
+  std::memcpy(stripe_.data(), data.data(), data.size());
+  stripe_size_ = data.size();
+}
+
+std::uint64_t Hasher::digest() const {
+  std::uint64_t hash;
+  if (total_size_ >= kStripeSize) {
+    hash = std::rotl(accumulators_[0], 1) + std::rotl(accumulators_[1], 7) +
+           std::rotl(accumulators_[2], 12) + std::rotl(accumulators_[3], 18);
+    for (auto accumulator : accumulators_)
+      hash = merge_round(hash, accumulator);
+  } else {
+    hash = seed_ + kPrime5;
+  }
+  hash += total_size_;
+  const char* data = stripe_.data();
+  std::size_t size = stripe_size_;
+  for (; size >= 8; data += 8, size -= 8) {
+    hash ^= round(0, read64(data));
+    hash = std::rotl(hash, 27) * kPrime1 + kPrime4;
+  }
+  if (size >= 4) {
+    hash ^= static_cast<std::uint64_t>(read32(data)) * kPrime1;
+    hash = std::rotl(hash, 23) * kPrime2 + kPrime3;
+    data += 4;
+    size -= 4;
+  }
+  for (; size > 0; ++data, --size) {
+    hash ^= static_cast<unsigned char>(*data) * kPrime5;
+    hash = std::rotl(hash, 11) * kPrime1;
+  }
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+std::uint64_t hash_bytes(std::string_view data, std::uint64_t seed) {
+  Hasher hasher(seed);
+  hasher.update(data);
+  return hasher.digest();
+}
+
+std::string to_hex(std::uint64_t hash) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string hex(16, '0');
+  for (int i{15}; i >= 0; --i, hash >>= 4) hex[i] = kDigits[hash & 0xF];
+  return hex;
+}
+
+}  // namespace pefti
@@ -0,0 +1,219 @@
+#include "http_client.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.h"
+#include "resource.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+using EasyHandle = std::unique_ptr<CURL, std::function<void(CURL*)>>;
+using HeaderList =
+    std::unique_ptr<curl_slist, std::function<void(curl_slist*)>>;
+
+namespace {
+
+// State of one transfer of HttpClient::fetch()
+struct Transfer {
+  const std::string* url;
+  EasyHandle handle;
+  HeaderList request_headers;
+  std::string body;
+  std::string etag;
+  std::string last_modified;
+  CURLcode result{CURLE_OK};
+};
+
+}  // namespace
+
+static void check(CURLcode code) {
+  if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
+}
+
+static void check(CURLMcode code) {
+  if (code != CURLM_OK) throw std::runtime_error(curl_multi_strerror(code));
+}
+
+static size_t write_callback(char* data, size_t, size_t size,
+                             void* context) {
+  static_cast<Transfer*>(context)->body.append(data, size);
+  return size;
+}
+
+// Stores the validators of the response
+static size_t header_callback(char* data, size_t, size_t size,
+                              void* context) {
+  auto& transfer = *static_cast<Transfer*>(context);
+  read_validator({data, size}, transfer.etag, transfer.last_modified);
+  return size;
+}
+
+void read_validator(std::string_view header, std::string& etag,
+                    std::string& last_modified) {
+  const auto colon = header.find(':');
+  if (colon == std::string_view::npos) return;
+  std::string name{header.substr(0, colon)};
+  std::ranges::transform(name, name.begin(), [](unsigned char c) {
+    return static_cast<char>(std::tolower(c));
+  });
+  auto value = header.substr(colon + 1);
+  while (!value.empty() && std::isspace(static_cast<unsigned char>(value[0])))
+    value.remove_prefix(1);
+  while (!value.empty() &&
+         std::isspace(static_cast<unsigned char>(value.back())))
+    value.remove_suffix(1);
+  if (name == "etag"sv)
+    etag = value;
+  else if (name == "last-modified"sv)
+    last_modified = value;
+}
+
+HttpClient::HttpClient() {
+  multi_handle_ = curl_multi_init();
+  if (!multi_handle_)
+    throw std::runtime_error("curl_multi_init() returned NULL");
+  share_handle_ = curl_share_init();
+  if (!share_handle_) {
+    curl_multi_cleanup(multi_handle_);
+    throw std::runtime_error("curl_share_init() returned NULL");
+  }
+  // The handles are only used by the thread that calls fetch(), so the
+  // share handle does not need locking
+  curl_share_setopt(share_handle_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_handle_, CURLSHOPT_SHARE,
+                    CURL_LOCK_DATA_SSL_SESSION);
+}
+
+HttpClient::~HttpClient() {
+  curl_multi_cleanup(multi_handle_);
+  curl_share_cleanup(share_handle_);
+}
+
+// The connection cache belongs to the multi handle, which is kept between
+// calls, so connections to the same hosts are reused.
+bool HttpClient::fetch(const std::vector<std::string>& urls) {
+  std::vector<Transfer> transfers(urls.size());
+  check(curl_multi_setopt(multi_handle_, CURLMOPT_MAXCONNECTS,
+                          static_cast<long>(urls.size())));
+  for (std::size_t i{0}; i < urls.size(); ++i) {
+    auto& transfer = transfers[i];
+    transfer.url = &urls[i];
+    transfer.handle = EasyHandle(curl_easy_init(), curl_easy_cleanup);
+    if (!transfer.handle)
+      throw std::runtime_error("curl_easy_init() returned NULL");
+    auto handle = transfer.handle.get();
+    check(curl_easy_setopt(handle, CURLOPT_URL, urls[i].c_str()));
+    check(curl_easy_setopt(handle, CURLOPT_PRIVATE, &transfer));
+    check(curl_easy_setopt(handle, CURLOPT_SHARE, share_handle_));
+    check(curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback));
+    check(curl_easy_setopt(handle, CURLOPT_WRITEDATA, &transfer));
+    check(curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, header_callback));
+    check(curl_easy_setopt(handle, CURLOPT_HEADERDATA, &transfer));
+    check(curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0L));
+    check(curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 0L));
+    // Accepts every encoding that libcurl can decode
+    check(curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, ""));
+    const auto iter = resources_.find(urls[i]);
+    if (iter != resources_.end()) {
+      curl_slist* headers{nullptr};
+      if (!iter->second.etag.empty())
+        headers = curl_slist_append(
+            headers, ("If-None-Match: "s + iter->second.etag).c_str());
+      if (!iter->second.last_modified.empty())
+        headers = curl_slist_append(
+            headers,
+            ("If-Modified-Since: "s + iter->second.last_modified).c_str());
+      transfer.request_headers = HeaderList(headers, curl_slist_free_all);
+      check(curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers));
+    }
+    check(curl_multi_add_handle(multi_handle_, handle));
+  }
+  int num_transfers_running{static_cast<int>(transfers.size())};
+  while (num_transfers_running > 0) {
+    check(curl_multi_perform(multi_handle_, &num_transfers_running));
+    CURLMsg* msg;
+    int num_msgs_in_queue;
+    while ((msg = curl_multi_info_read(multi_handle_, &num_msgs_in_queue))) {
+      if (msg->msg != CURLMSG_DONE) continue;
+      Transfer* transfer;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &transfer);
+      transfer->result = msg->data.result;
+      add_download_stats(msg->easy_handle, *transfer->url);
+      curl_multi_remove_handle(multi_handle_, msg->easy_handle);
+    }
+    if (num_transfers_running > 0)
+      check(curl_multi_wait(multi_handle_, nullptr, 0, 1000, nullptr));
+  }
+  //
+  // Resources that are no longer in the configuration are forgotten
+  std::unordered_map<std::string, Resource> resources;
+  bool is_changed{false};
+  for (auto& transfer : transfers) {
+    const auto& url = *transfer.url;
+    auto previous = resources_.find(url);
+    long status{0};
+    curl_easy_getinfo(transfer.handle.get(), CURLINFO_RESPONSE_CODE, &status);
+    if (transfer.result != CURLE_OK || status >= 400) {
+      const auto error = (transfer.result != CURLE_OK)
+                             ? std::string{curl_easy_strerror(transfer.result)}
+                             : "HTTP status "s + std::to_string(status);
+      std::cerr << "Failed to download " << url << ": " << error;
+      if (previous == resources_.end()) {
+        std::cerr << '\n';
+        continue;
+      }
+      std::cerr << ", using the previous download\n";
+      resources.insert(resources_.extract(previous));
+      continue;
+    }
+    if (status == 304 && previous != resources_.end()) {
+      resources.insert(resources_.extract(previous));
+      continue;
+    }
+    Resource resource;
+    resource.hash = hash_bytes(transfer.body);
+    resource.body = std::move(transfer.body);
+    resource.etag = std::move(transfer.etag);
+    resource.last_modified = std::move(transfer.last_modified);
+    if (previous == resources_.end() || previous->second.hash != resource.hash)
+      is_changed = true;
+    resources.insert_or_assign(url, std::move(resource));
+  }
+  resources_ = std::move(resources);
+  return is_changed;
+}
+
+const std::string* HttpClient::find_body(const std::string& url) const {
+  const auto iter = resources_.find(url);
+  return (iter == resources_.end()) ? nullptr : &iter->second.body;
+}
+
+const std::string& HttpClient::get_body(const std::string& url) const {
+  const auto body = find_body(url);
+  if (!body) throw std::runtime_error("Failed to download "s + url);
+  return *body;
+}
+
+std::uint64_t HttpClient::get_hash(const std::string& url) const {
+  const auto iter = resources_.find(url);
+  if (iter == resources_.end())
+    throw std::runtime_error("Failed to download "s + url);
+  return iter->second.hash;
+}
+
+}  // namespace pefti
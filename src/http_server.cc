@@ -0,0 +1,564 @@
+#include "http_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "hash.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+// Largest request line and headers that are accepted
+static constexpr std::size_t kMaxRequestSize{16 * 1024};
+static constexpr int kMaxEvents{64};
+
+// The fields of a request that are used, as views of the connection input
+struct HttpServer::Request {
+  bool is_valid{false};
+  bool is_keep_alive{true};
+  bool has_body{false};
+  std::string_view method;
+  std::string_view target;
+  std::string_view accept_encoding;
+  std::string_view if_none_match;
+  std::string_view range;
+};
+
+// Requests are handled one at a time. A response is a head followed by a
+// view of a document, which is kept alive until the response is sent.
+struct HttpServer::Connection {
+  int fd;
+  std::uint32_t events{EPOLLIN};
+  std::string input;
+  std::string head;
+  std::size_t head_sent{0};
+  std::shared_ptr<const Document> document;
+  std::string_view body;
+  bool is_closing{false};
+  bool is_response_pending() const {
+    return head_sent < head.size() || !body.empty();
+  }
+};
+
+static void check(int result, std::string_view what) {
+  if (result < 0)
+    throw std::runtime_error(std::string{what} + ": "s +
+                             std::strerror(errno));
+}
+
+static bool is_equal_ignoring_case(std::string_view lhs,
+                                   std::string_view rhs) {
+  if (lhs.size() != rhs.size()) return false;
+  for (std::size_t i{0}; i < lhs.size(); ++i) {
+    if (std::tolower(static_cast<unsigned char>(lhs[i])) !=
+        std::tolower(static_cast<unsigned char>(rhs[i])))
+      return false;
+  }
+  return true;
+}
+
+static std::string_view trim(std::string_view text) {
+  while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+    text.remove_prefix(1);
+  while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+    text.remove_suffix(1);
+  return text;
+}
+
+// Calls `f` with each trimmed item of a comma-separated header value
+template <typename F>
+static void for_each_item(std::string_view list, F f) {
+  while (!list.empty()) {
+    const auto comma = list.find(',');
+    f(trim(list.substr(0, comma)));
+    if (comma == std::string_view::npos) break;
+    list.remove_prefix(comma + 1);
+  }
+}
+
+// Returns the q-value of the parameters of an Accept-Encoding item in
+// thousandths, 1000 if there is none and 0 if it is not valid
+static int get_quality(std::string_view parameters) {
+  while (!parameters.empty()) {
+    const auto semicolon = parameters.find(';');
+    auto parameter = trim(parameters.substr(0, semicolon));
+    if (parameter.size() >= 2 && (parameter[0] == 'q' || parameter[0] == 'Q') &&
+        parameter[1] == '=') {
+      parameter.remove_prefix(2);
+      if (parameter.empty() || (parameter[0] != '0' && parameter[0] != '1'))
+        return 0;
+      int quality{(parameter[0] - '0') * 1000};
+      if (parameter.size() == 1) return quality;
+      if (parameter[1] != '.' || parameter.size() > 5) return 0;
+      int scale{100};
+      for (const auto c : parameter.substr(2)) {
+        if (c < '0' || c > '9') return 0;
+        quality += (c - '0') * scale;
+        scale /= 10;
+      }
+      return (quality > 1000) ? 0 : quality;
+    }
+    if (semicolon == std::string_view::npos) break;
+    parameters.remove_prefix(semicolon + 1);
+  }
+  return 1000;
+}
+
+// An explicit gzip item takes precedence over "*", whatever their order
+static bool accepts_gzip(std::string_view accept_encoding) {
+  int gzip_quality{-1};
+  int any_quality{-1};
+  for_each_item(accept_encoding, [&](std::string_view item) {
+    const auto semicolon = item.find(';');
+    const auto coding = trim(item.substr(0, semicolon));
+    const auto parameters =
+        (semicolon == std::string_view::npos) ? ""sv
+                                              : item.substr(semicolon + 1);
+    if (is_equal_ignoring_case(coding, "gzip"sv))
+      gzip_quality = std::max(gzip_quality, get_quality(parameters));
+    else if (coding == "*"sv)
+      any_quality = std::max(any_quality, get_quality(parameters));
+  });
+  return (gzip_quality >= 0) ? gzip_quality > 0 : any_quality > 0;
+}
+
+static bool matches_etag(std::string_view if_none_match,
+                         std::string_view etag) {
+  bool is_match{false};
+  for_each_item(if_none_match, [&is_match, etag](std::string_view item) {
+    if (item.starts_with("W/"sv)) item.remove_prefix(2);
+    if (item == "*"sv || item == etag) is_match = true;
+  });
+  return is_match;
+}
+
+enum class RangeType { kNone, kSatisfiable, kUnsatisfiable };
+
+// Parses a single byte range, other ranges are ignored and the whole
+// document is sent. `last` is inclusive.
+static RangeType parse_range(std::string_view range, std::size_t size,
+                             std::size_t& first, std::size_t& last) {
+  if (!range.starts_with("bytes="sv)) return RangeType::kNone;
+  range = trim(range.substr(6));
+  const auto dash = range.find('-');
+  if (dash == std::string_view::npos ||
+      range.find(',') != std::string_view::npos)
+    return RangeType::kNone;
+  auto to_number = [](std::string_view text, std::size_t& number) {
+    const auto [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), number);
+    return error == std::errc{} && end == text.data() + text.size();
+  };
+  const auto first_text = trim(range.substr(0, dash));
+  const auto last_text = trim(range.substr(dash + 1));
+  if (first_text.empty()) {
+    // Suffix range, the last N bytes
+    std::size_t length;
+    if (!to_number(last_text, length)) return RangeType::kNone;
+    if (length == 0 || size == 0) return RangeType::kUnsatisfiable;
+    first = size - std::min(length, size);
+    last = size - 1;
+    return RangeType::kSatisfiable;
+  }
+  if (!to_number(first_text, first)) return RangeType::kNone;
+  last = size - 1;
+  if (!last_text.empty()) {
+    if (!to_number(last_text, last) || last < first) return RangeType::kNone;
+    last = std::min(last, size - 1);
+  }
+  if (first >= size) return RangeType::kUnsatisfiable;
+  return RangeType::kSatisfiable;
+}
+
+// `head` is the request line and headers, each ending with CRLF
+HttpServer::Request HttpServer::parse_request(std::string_view head) {
+  Request request;
+  auto line_end = head.find("\r\n"sv);
+  const auto request_line = head.substr(0, line_end);
+  head.remove_prefix(line_end + 2);
+  const auto method_end = request_line.find(' ');
+  const auto target_end = request_line.rfind(' ');
+  if (method_end == std::string_view::npos || target_end <= method_end)
+    return request;
+  request.method = request_line.substr(0, method_end);
+  request.target =
+      request_line.substr(method_end + 1, target_end - method_end - 1);
+  const auto version = request_line.substr(target_end + 1);
+  if (version == "HTTP/1.0"sv)
+    request.is_keep_alive = false;
+  else if (version != "HTTP/1.1"sv)
+    return request;
+  while (!head.empty()) {
+    line_end = head.find("\r\n"sv);
+    const auto line = head.substr(0, line_end);
+    head.remove_prefix(line_end + 2);
+    const auto colon = line.find(':');
+    if (colon == std::string_view::npos) return request;
+    const auto name = line.substr(0, colon);
+    const auto value = trim(line.substr(colon + 1));
+    if (is_equal_ignoring_case(name, "Accept-Encoding"sv)) {
+      request.accept_encoding = value;
+    } else if (is_equal_ignoring_case(name, "If-None-Match"sv)) {
+      request.if_none_match = value;
+    } else if (is_equal_ignoring_case(name, "Range"sv)) {
+      request.range = value;
+    } else if (is_equal_ignoring_case(name, "Connection"sv)) {
+      for_each_item(value, [&request](std::string_view item) {
+        if (is_equal_ignoring_case(item, "close"sv))
+          request.is_keep_alive = false;
+        else if (is_equal_ignoring_case(item, "keep-alive"sv))
+          request.is_keep_alive = true;
+      });
+    } else if (is_equal_ignoring_case(name, "Transfer-Encoding"sv) ||
+               (is_equal_ignoring_case(name, "Content-Length"sv) &&
+                value != "0"sv)) {
+      request.has_body = true;
+    }
+  }
+  request.is_valid = true;
+  return request;
+}
+
+// Outputs are served at the name of the file without a compression
+// extension
+static std::string get_path(std::string_view filename) {
+  auto name = std::filesystem::path{filename}.filename().string();
+  for (auto extension : {".gz"sv, ".zst"sv}) {
+    if (name.ends_with(extension)) name.resize(name.size() - extension.size());
+  }
+  return "/"s + name;
+}
+
+static std::string_view get_content_type(std::string_view path) {
+  if (path.ends_with(".m3u"sv) || path.ends_with(".m3u8"sv))
+    return "audio/x-mpegurl"sv;
+  if (path.ends_with(".xml"sv)) return "application/xml"sv;
+  return "application/octet-stream"sv;
+}
+
+// Returns the socket address of a numeric IPv4 or IPv6 address
+static sockaddr_storage get_socket_address(const std::string& address,
+                                           std::uint16_t port,
+                                           socklen_t& size) {
+  sockaddr_storage storage{};
+  auto* ipv4 = reinterpret_cast<sockaddr_in*>(&storage);
+  auto* ipv6 = reinterpret_cast<sockaddr_in6*>(&storage);
+  if (::inet_pton(AF_INET, address.c_str(), &ipv4->sin_addr) == 1) {
+    ipv4->sin_family = AF_INET;
+    ipv4->sin_port = htons(port);
+    size = sizeof(sockaddr_in);
+  } else if (::inet_pton(AF_INET6, address.c_str(), &ipv6->sin6_addr) == 1) {
+    ipv6->sin6_family = AF_INET6;
+    ipv6->sin6_port = htons(port);
+    size = sizeof(sockaddr_in6);
+  } else {
+    throw std::runtime_error("Invalid listen address "s + address);
+  }
+  return storage;
+}
+
+HttpServer::HttpServer(const std::string& address, std::uint16_t port) {
+  try {
+    socklen_t address_size{0};
+    const auto socket_address = get_socket_address(address, port,
+                                                   address_size);
+    listen_fd_ = ::socket(socket_address.ss_family,
+                          SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    check(listen_fd_, "socket()"sv);
+    const int off{0};
+    const int on{1};
+    // The IPv6 wildcard address accepts IPv4 connections too
+    if (socket_address.ss_family == AF_INET6)
+      ::setsockopt(listen_fd_, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    check(::bind(listen_fd_, reinterpret_cast<const sockaddr*>(&socket_address),
+                 address_size),
+          "Failed to bind "s + address + " port "s + std::to_string(port));
+    check(::listen(listen_fd_, SOMAXCONN), "listen()"sv);
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    check(epoll_fd_, "epoll_create1()"sv);
+    event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    check(event_fd_, "eventfd()"sv);
+    for (auto fd : {listen_fd_, event_fd_}) {
+      epoll_event event{};
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      check(::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event), "epoll_ctl()"sv);
+    }
+    thread_ = std::thread(&HttpServer::serve, this);
+  } catch (...) {
+    close_fds();
+    throw;
+  }
+}
+
+HttpServer::~HttpServer() {
+  const std::uint64_t stop{1};
+  [[maybe_unused]] auto result = ::write(event_fd_, &stop, sizeof(stop));
+  thread_.join();
+  close_fds();
+}
+
+void HttpServer::close_fds() noexcept {
+  for (auto fd : {listen_fd_, epoll_fd_, event_fd_}) {
+    if (fd >= 0) ::close(fd);
+  }
+}
+
+// The previous document is released after the lock, it is only freed here
+// if no response is still sending it
+void HttpServer::publish(std::string_view filename, std::string content,
+                         std::string gzip_content, std::uint64_t hash) {
+  auto path = get_path(filename);
+  auto document = std::make_shared<Document>();
+  document->content = std::move(content);
+  document->gzip_content = std::move(gzip_content);
+  document->etag = "\""s + to_hex(hash) + "\""s;
+  document->gzip_etag = "\""s + to_hex(hash) + "-gzip\""s;
+  document->content_type = get_content_type(path);
+  std::shared_ptr<const Document> previous;
+  {
+    std::lock_guard lock(documents_mutex_);
+    previous = std::exchange(documents_[std::move(path)], std::move(document));
+  }
+}
+
+std::shared_ptr<const HttpServer::Document> HttpServer::find_document(
+    std::string_view path) {
+  std::lock_guard lock(documents_mutex_);
+  const auto iter = documents_.find(path);
+  if (iter == documents_.end()) return nullptr;
+  return iter->second;
+}
+
+void HttpServer::serve() {
+  std::unordered_map<int, std::unique_ptr<Connection>> connections;
+  std::array<epoll_event, kMaxEvents> events;
+  for (;;) {
+    const auto num_events =
+        ::epoll_wait(epoll_fd_, events.data(), kMaxEvents, -1);
+    if (num_events < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "HTTP server: epoll_wait(): " << std::strerror(errno)
+                << std::endl;
+      break;
+    }
+    for (int i{0}; i < num_events; ++i) {
+      const auto fd = events[i].data.fd;
+      if (fd == event_fd_) {
+        for (auto& [_, connection] : connections) ::close(connection->fd);
+        return;
+      }
+      if (fd == listen_fd_) {
+        int connection_fd;
+        while ((connection_fd = ::accept4(listen_fd_, nullptr, nullptr,
+                                          SOCK_NONBLOCK | SOCK_CLOEXEC)) >=
+               0) {
+          epoll_event event{};
+          event.events = EPOLLIN;
+          event.data.fd = connection_fd;
+          if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection_fd, &event) <
+              0) {
+            ::close(connection_fd);
+            continue;
+          }
+          auto connection = std::make_unique<Connection>();
+          connection->fd = connection_fd;
+          connections.emplace(connection_fd, std::move(connection));
+        }
+        continue;
+      }
+      const auto iter = connections.find(fd);
+      if (iter == connections.end()) continue;
+      auto& connection = *iter->second;
+      bool is_open{(events[i].events & EPOLLERR) == 0};
+      try {
+        if (is_open && (events[i].events & (EPOLLIN | EPOLLHUP)))
+          is_open = receive(connection);
+        if (is_open) is_open = process(connection);
+      } catch (const std::exception& e) {
+        std::cerr << "HTTP server: " << e.what() << std::endl;
+        is_open = false;
+      }
+      if (!is_open) {
+        close_connection(connection);
+        connections.erase(iter);
+      }
+    }
+  }
+}
+
+void HttpServer::close_connection(Connection& connection) {
+  ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection.fd, nullptr);
+  ::close(connection.fd);
+}
+
+// Reads the data that has been received. Returns false if the connection
+// was closed by the client.
+bool HttpServer::receive(Connection& connection) {
+  std::array<char, 16 * 1024> data;
+  for (;;) {
+    const auto size = ::recv(connection.fd, data.data(), data.size(), 0);
+    if (size > 0) {
+      connection.input.append(data.data(), static_cast<std::size_t>(size));
+      if (connection.input.size() > kMaxRequestSize) return true;
+      continue;
+    }
+    if (size == 0) return false;
+    if (errno == EINTR) continue;
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+}
+
+// Sends the pending response then handles the requests that have been
+// received. Returns false if the connection is to be closed.
+bool HttpServer::process(Connection& connection) {
+  for (;;) {
+    if (connection.is_response_pending()) {
+      if (!send_response(connection)) return false;
+      if (connection.is_response_pending())
+        return set_events(connection, EPOLLOUT);
+      connection.document.reset();
+      if (connection.is_closing) return false;
+    }
+    const auto head_end = connection.input.find("\r\n\r\n"sv);
+    if (head_end == std::string::npos) {
+      if (connection.input.size() > kMaxRequestSize) return false;
+      return set_events(connection, EPOLLIN);
+    }
+    const auto request = parse_request(
+        std::string_view{connection.input}.substr(0, head_end + 2));
+    handle_request(connection, request);
+    connection.input.erase(0, head_end + 4);
+  }
+}
+
+bool HttpServer::set_events(Connection& connection, std::uint32_t events) {
+  if (connection.events == events) return true;
+  epoll_event event{};
+  event.events = events;
+  event.data.fd = connection.fd;
+  if (::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event) < 0)
+    return false;
+  connection.events = events;
+  return true;
+}
+
+// Sends as much of the response as the socket accepts. The body is sent
+// from the document without copying it. Returns false on error.
+bool HttpServer::send_response(Connection& connection) {
+  while (connection.is_response_pending()) {
+    std::array<iovec, 2> parts{};
+    const auto head_size = connection.head.size() - connection.head_sent;
+    parts[0].iov_base = connection.head.data() + connection.head_sent;
+    parts[0].iov_len = head_size;
+    parts[1].iov_base = const_cast<char*>(connection.body.data());
+    parts[1].iov_len = connection.body.size();
+    msghdr message{};
+    message.msg_iov = (head_size > 0) ? &parts[0] : &parts[1];
+    message.msg_iovlen = (head_size > 0) ? 2 : 1;
+    const auto size = ::sendmsg(connection.fd, &message, MSG_NOSIGNAL);
+    if (size < 0) {
+      if (errno == EINTR) continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    auto sent = static_cast<std::size_t>(size);
+    const auto head_sent = std::min(sent, head_size);
+    connection.head_sent += head_sent;
+    connection.body.remove_prefix(sent - head_sent);
+  }
+  return true;
+}
+
+void HttpServer::handle_request(Connection& connection,
+                                const Request& request) {
+  connection.head.clear();
+  connection.head_sent = 0;
+  connection.body = {};
+  connection.is_closing = !request.is_keep_alive;
+  std::string headers;
+  std::string_view status;
+  std::shared_ptr<const Document> document;
+  std::string_view body;
+  if (!request.is_valid || request.has_body) {
+    status = "400 Bad Request"sv;
+    connection.is_closing = true;
+  } else if (request.method != "GET"sv && request.method != "HEAD"sv) {
+    status = "405 Method Not Allowed"sv;
+    headers = "Allow: GET, HEAD\r\n"s;
+  } else {
+    const auto path = request.target.substr(0, request.target.find('?'));
+    document = find_document(path);
+    if (!document) status = "404 Not Found"sv;
+  }
+  if (document) {
+    // Ranges are of the uncompressed document
+    const bool is_gzip{request.range.empty() &&
+                       !document->gzip_content.empty() &&
+                       accepts_gzip(request.accept_encoding)};
+    const auto& content = is_gzip ? document->gzip_content : document->content;
+    const auto& etag = is_gzip ? document->gzip_etag : document->etag;
+    headers = "Content-Type: "s + std::string{document->content_type} +
+              "\r\nETag: "s + etag +
+              "\r\nVary: Accept-Encoding\r\nAccept-Ranges: bytes\r\n"s;
+    if (is_gzip) headers += "Content-Encoding: gzip\r\n"s;
+    std::size_t first;
+    std::size_t last;
+    const auto range_type =
+        parse_range(request.range, content.size(), first, last);
+    if (!request.if_none_match.empty() &&
+        matches_etag(request.if_none_match, etag)) {
+      status = "304 Not Modified"sv;
+    } else if (range_type == RangeType::kUnsatisfiable) {
+      status = "416 Range Not Satisfiable"sv;
+      headers += "Content-Range: bytes */"s + std::to_string(content.size()) +
+                 "\r\n"s;
+    } else if (range_type == RangeType::kSatisfiable) {
+      status = "206 Partial Content"sv;
+      headers += "Content-Range: bytes "s + std::to_string(first) + "-"s +
+                 std::to_string(last) + "/"s +
+                 std::to_string(content.size()) + "\r\n"s;
+      body = std::string_view{content}.substr(first, last - first + 1);
+    } else {
+      status = "200 OK"sv;
+      body = content;
+    }
+  }
+  auto& head = connection.head;
+  head = "HTTP/1.1 "s + std::string{status} + "\r\n"s + headers;
+  if (status != "304 Not Modified"sv)
+    head += "Content-Length: "s + std::to_string(body.size()) + "\r\n"s;
+  if (connection.is_closing) head += "Connection: close\r\n"s;
+  head += "\r\n"s;
+  if (request.method == "HEAD"sv || body.empty()) return;
+  connection.document = std::move(document);
+  connection.body = body;
+}
+
+}  // namespace pefti
@@ -6,6 +6,8 @@
 #include <regex>
 #include <string>
 
+#include "normalizer.h"
+
 using namespace std::literals;
 
 namespace pefti {
@@ -43,8 +45,11 @@ std::ostream& operator<<(std::ostream& stream, IptvChannel& channel) {
   return stream;
 }
 
+// The normalized name is computed here, once per channel, so that all of
+// the name matching can use it.
 void IptvChannel::set_original_name(std::string_view new_name) {
   original_name_ = new_name;
+  normalize_name(original_name_, normalized_name_);
 }
 
 void IptvChannel::set_tag(std::string_view tag, std::string_view new_value) {
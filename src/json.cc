@@ -0,0 +1,26 @@
+#include "json.h"
+
+#include <array>
+#include <cstdio>
+#include <ostream>
+#include <string_view>
+
+namespace pefti {
+
+void write_json_string(std::ostream& stream, std::string_view text) {
+  stream << '"';
+  for (const char c : text) {
+    if (c == '"' || c == '\\') {
+      stream << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      std::array<char, 8> escape;
+      std::snprintf(escape.data(), escape.size(), "\\u%04x", c);
+      stream << escape.data();
+    } else {
+      stream << c;
+    }
+  }
+  stream << '"';
+}
+
+}  // namespace pefti
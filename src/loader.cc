@@ -7,25 +7,73 @@
 #include <cppcoro/task.hpp>
 #include <cstring>
 #include <functional>
+#include <iostream>
 #include <memory>
 #include <stdexcept>
 #include <string>
 
 #include "buffers.h"
+#include "http_client.h"
+#include "playlist_snapshot.h"
+#include "resource.h"
+#include "stats.h"
+#include "trace.h"
+
+using namespace std::literals;
 
 namespace pefti {
 
 using EasyHandle = std::unique_ptr<CURL, std::function<void(CURL*)>>;
 
-static size_t write_callback(void* new_data, size_t, size_t data_size,
+static size_t write_callback(void* new_data, size_t, size_t num_chars,
                              void* context);
 cppcoro::task<size_t> write_to_buffer(void* new_data, size_t num_chars,
                                       void* context);
 
-static void load_resource(const std::string& url,
-                          PlaylistLoaderParserBuffer& buffer) {
+// State of the download of a playlist
+struct Download {
+  CURL* handle;
+  PlaylistLoaderParserBuffer* buffer;
+  PlaylistSnapshot* snapshot;
+  std::string etag;
+  std::string last_modified;
+  bool has_content{false};
+  bool is_error_status{false};
+};
+
+static size_t header_callback(char* data, size_t, size_t size,
+                              void* context) {
+  auto& download = *static_cast<Download*>(context);
+  read_validator({data, size}, download.etag, download.last_modified);
+  return size;
+}
+
+// Requests the playlist conditionally if there is a snapshot. The body of an
+// error response is discarded, the snapshot is used instead if there is
+// one. Throws std::runtime_error if the playlist cannot be downloaded and
+// there is no snapshot.
+static void load_resource(PlaylistLoaderParserBuffer& buffer,
+                          PlaylistSnapshot& snapshot) {
+  const auto& url = snapshot.get_url();
   auto handle = EasyHandle(curl_easy_init(), curl_easy_cleanup);
   if (!handle) throw std::runtime_error("curl_easy_init() returned NULL");
+  Download download;
+  download.handle = handle.get();
+  download.buffer = &buffer;
+  download.snapshot = &snapshot;
+  std::unique_ptr<curl_slist, std::function<void(curl_slist*)>> headers(
+      nullptr, curl_slist_free_all);
+  if (snapshot.is_loaded()) {
+    const std::string etag{snapshot.get_etag()};
+    const std::string last_modified{snapshot.get_last_modified()};
+    curl_slist* list{nullptr};
+    if (!etag.empty())
+      list = curl_slist_append(list, ("If-None-Match: "s + etag).c_str());
+    if (!last_modified.empty())
+      list = curl_slist_append(
+          list, ("If-Modified-Since: "s + last_modified).c_str());
+    headers.reset(list);
+  }
   CURLcode code;
   code = curl_easy_setopt(handle.get(), CURLOPT_URL, url.c_str());
   if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
@@ -33,29 +81,112 @@ static void load_resource(const std::string& url,
   if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
   code = curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYHOST, 0L);
   if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
+  // Accepts every encoding that libcurl can decode
+  code = curl_easy_setopt(handle.get(), CURLOPT_ACCEPT_ENCODING, "");
+  if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
   code = curl_easy_setopt(handle.get(), CURLOPT_WRITEFUNCTION, write_callback);
   if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
-  code = curl_easy_setopt(handle.get(), CURLOPT_WRITEDATA, &buffer);
+  code = curl_easy_setopt(handle.get(), CURLOPT_WRITEDATA, &download);
+  if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
+  code =
+      curl_easy_setopt(handle.get(), CURLOPT_HEADERFUNCTION, header_callback);
+  if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
+  code = curl_easy_setopt(handle.get(), CURLOPT_HEADERDATA, &download);
+  if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
+  code = curl_easy_setopt(handle.get(), CURLOPT_HTTPHEADER, headers.get());
   if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
   code = curl_easy_perform(handle.get());
+  add_download_stats(handle.get(), url);
+  long status{0};
+  curl_easy_getinfo(handle.get(), CURLINFO_RESPONSE_CODE, &status);
+  if (code == CURLE_OK && status == 304 && snapshot.is_loaded()) {
+    snapshot.set_replayed();
+    return;
+  }
+  const bool has_failed{code != CURLE_OK || status >= 400};
+  if (has_failed && snapshot.is_loaded() && !download.has_content) {
+    std::cerr << "Failed to download " << url
+              << ", using the channels of the previous download\n";
+    snapshot.set_replayed();
+    return;
+  }
   if (code != CURLE_OK) throw std::runtime_error(curl_easy_strerror(code));
+  if (status >= 400) {
+    throw std::runtime_error("Failed to download "s + url + ": HTTP status "s +
+                             std::to_string(status));
+  }
+  if (status < 300) {
+    snapshot.set_validators(std::move(download.etag),
+                            std::move(download.last_modified));
+    snapshot.set_complete();
+  }
+}
+
+// Uses the snapshot if the playlist has not changed since the snapshot was
+// saved, or if it could not be downloaded
+void Loader::load_from_http_client(PlaylistLoaderParserBuffer& buffer,
+                                   PlaylistSnapshot& snapshot) {
+  const auto& url = snapshot.get_url();
+  const auto body = http_client_->find_body(url);
+  if (!body && snapshot.is_loaded()) {
+    std::cerr << "Using the channels of the previous download of " << url
+              << '\n';
+    snapshot.set_replayed();
+    return;
+  }
+  if (!body) throw std::runtime_error("Failed to download "s + url);
+  const auto hash = http_client_->get_hash(url);
+  if (snapshot.is_loaded() && snapshot.get_content_hash() == hash) {
+    snapshot.set_replayed();
+    return;
+  }
+  snapshot.set_content_hash(hash);
+  snapshot.set_complete();
+  Stats::add_bytes(Stats::Stage::kLoader, body->size());
+  cppcoro::sync_wait(write_to_buffer(const_cast<char*>(body->data()),
+                                     body->size(), &buffer));
 }
 
+// The sentinel is written even if loading fails, so that the later stages
+// of the pipeline finish
 cppcoro::task<> Loader::load(cppcoro::static_thread_pool& tp,
                              PlaylistLoaderParserBuffer& buffer,
-                             const std::string& url) {
+                             PlaylistSnapshot& snapshot) {
   co_await tp.schedule();
+  const Stats::Timer timer(Stats::Stage::kLoader);
+  const Trace::Span span(Trace::Stage::kLoader, buffer.source_id);
+  Stats::add_items(Stats::Stage::kLoader, 1);
   buffer.thread_pool = &tp;
-  load_resource(url, buffer);
+  try {
+    if (http_client_)
+      load_from_http_client(buffer, snapshot);
+    else
+      load_resource(buffer, snapshot);
+  } catch (...) {
+    write_playlist_sentinel(buffer);
+    throw;
+  }
   write_playlist_sentinel(buffer);
 }
 
 // Callback used by libcurl when data has been received.
-// Writes the new data to the ring buffer.
+// Writes the new data to the ring buffer. The body of an error response is
+// dropped.
 static size_t write_callback(void* new_data, size_t, size_t num_chars,
                              void* context) {
-  auto num_chars_written =
-      cppcoro::sync_wait(write_to_buffer(new_data, num_chars, context));
+  auto& download = *static_cast<Download*>(context);
+  if (!download.has_content) {
+    long status{0};
+    curl_easy_getinfo(download.handle, CURLINFO_RESPONSE_CODE, &status);
+    download.is_error_status = (status >= 400);
+  }
+  if (download.is_error_status) return num_chars;
+  download.has_content = true;
+  Stats::add_bytes(Stats::Stage::kLoader, num_chars);
+  download.snapshot->add_content(
+      {static_cast<const char*>(new_data), num_chars});
+  auto num_chars_written = cppcoro::sync_wait(
+      write_to_buffer(new_data, num_chars, download.buffer));
   return num_chars_written;
 }
 
@@ -70,7 +201,7 @@ cppcoro::task<size_t> write_to_buffer(void* new_data, size_t num_chars,
   size_t num_chars_remaining{num_chars};
   while (num_chars_remaining > 0) {
     auto num_slots_claimed = (std::min(num_chars_remaining, kBufferSize >> 1));
-    auto write_range = co_await buffer.sequencer.claim_up_to(
+    auto write_range = co_await buffer.claim_up_to(
         num_slots_claimed, *(buffer.thread_pool));
     const auto num_slots_available = *write_range.end() - *write_range.begin();
     const auto start_block = *write_range.begin() / kBufferSize;
@@ -1,11 +1,18 @@
+#include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <cxxopts.hpp>
 #include <exception>
 #include <filesystem>
 #include <iostream>
 #include <sstream>
+#include <string>
 
 #include "application.h"
+#include "daemon.h"
+#include "file.h"
+#include "stats.h"
+#include "trace.h"
 #include "version.h"
 
 using namespace std::literals;
@@ -14,11 +21,17 @@ namespace fs = std::filesystem;
 enum class AppStatus { kOk, kError, kFinished };
 
 static constexpr auto kNumExpectedArgs{2};
+// The HTTP server is only reachable from this host unless --bind is given
+static constexpr auto kDefaultListenAddress{"127.0.0.1"};
 
 static void print_usage();
 static void print_version();
 static AppStatus process_arguments(int argc, char* argv[],
-                                   std::string& filename);
+                                   std::string& filename, bool& is_daemon,
+                                   std::chrono::seconds& interval,
+                                   std::string& listen_address,
+                                   std::uint16_t& port,
+                                   std::string& trace_filename);
 void verify_file(std::string& config_filename);
 
 // Processes command-line arguments then creates and runs the application.
@@ -28,13 +41,31 @@ void verify_file(std::string& config_filename);
 int main(int argc, char* argv[]) {
   try {
     std::string config_filename;
-    AppStatus status = process_arguments(argc, argv, config_filename);
-    if (status == AppStatus::kOk) {
+    bool is_daemon{false};
+    std::chrono::seconds interval;
+    std::string listen_address;
+    std::uint16_t port{0};
+    std::string trace_filename;
+    AppStatus status = process_arguments(argc, argv, config_filename,
+                                         is_daemon, interval, listen_address,
+                                         port, trace_filename);
+    if (status == AppStatus::kOk && is_daemon) {
+      pefti::Daemon daemon(std::move(config_filename), interval,
+                           listen_address, port);
+      daemon.run();
+    } else if (status == AppStatus::kOk) {
       pefti::Application app(std::move(config_filename));
       app.run();
     } else if (status == AppStatus::kError) {
       return EXIT_FAILURE;
     }
+    if (status == AppStatus::kOk && pefti::Stats::is_enabled())
+      pefti::Stats::write_json(std::cout);
+    if (status == AppStatus::kOk && pefti::Trace::is_enabled()) {
+      std::ostringstream stream;
+      pefti::Trace::write_json(stream);
+      pefti::write_file_atomically(trace_filename, stream.str());
+    }
   } catch (const std::exception& e) {
     std::cerr << e.what() << std::endl;
       return EXIT_FAILURE;
@@ -44,7 +75,18 @@ int main(int argc, char* argv[]) {
 
 static void print_usage() {
   std::cout << "Usage: pefti [OPTION]... [--] config-file\n";
+  std::cout << "  -b, --bind=ADDRESS      address that the HTTP server "
+               "listens on (default 127.0.0.1)\n";
+  std::cout << "  -d, --daemon            refresh the outputs periodically\n";
   std::cout << "  -h, --help              display this help text and exit\n";
+  std::cout << "  -i, --interval=SECONDS  time between refreshes in daemon "
+               "mode (default 600)\n";
+  std::cout << "  -p, --port=PORT         serve the new playlist and EPG over "
+               "HTTP in daemon mode\n";
+  std::cout << "  -s, --stats=FORMAT      write metrics of the run at exit, "
+               "FORMAT is json\n";
+  std::cout << "  -t, --trace=FILE        write a trace of the run to FILE in "
+               "Chrome Trace Event format\n";
   std::cout
       << "  -v, --version           display version information and exit\n";
   std::cout << "Full documentation <https://github.com/junglerock99/pefti>\n";
@@ -56,7 +98,12 @@ static void print_version() {
 }
 
 static AppStatus process_arguments(int argc, char* argv[],
-                                   std::string& config_filename) {
+                                   std::string& config_filename,
+                                   bool& is_daemon,
+                                   std::chrono::seconds& interval,
+                                   std::string& listen_address,
+                                   std::uint16_t& port,
+                                   std::string& trace_filename) {
   if (argc < kNumExpectedArgs) {
     print_usage();
     return AppStatus::kError;
@@ -64,6 +111,15 @@ static AppStatus process_arguments(int argc, char* argv[],
   cxxopts::Options options("pefti",
                            "Playlist and EPG Filter/Transformer for IPTV");
   options.add_options()("h,help", "Print usage")("v,version", "Print version")(
+      "b,bind", "Address of the HTTP server",
+      cxxopts::value<std::string>()->default_value(kDefaultListenAddress))(
+      "d,daemon", "Run as a daemon")(
+      "i,interval", "Seconds between refreshes",
+      cxxopts::value<int>()->default_value("600"))(
+      "p,port", "Port of the HTTP server", cxxopts::value<int>())(
+      "s,stats", "Format of the metrics", cxxopts::value<std::string>())(
+      "t,trace", "File that the trace is written to",
+      cxxopts::value<std::string>())(
       "config", "Configuration file", cxxopts::value<std::string>());
   options.parse_positional({"config"});
   auto result = options.parse(argc, argv);
@@ -75,6 +131,32 @@ static AppStatus process_arguments(int argc, char* argv[],
     print_version();
     return AppStatus::kFinished;
   }
+  is_daemon = result.count("daemon") > 0;
+  interval = std::chrono::seconds{result["interval"].as<int>()};
+  if (interval <= std::chrono::seconds{0})
+    throw std::runtime_error("Interval must be a positive number of seconds");
+  if (result.count("port")) {
+    const auto value = result["port"].as<int>();
+    if (value < 1 || value > 65535)
+      throw std::runtime_error("Port must be between 1 and 65535");
+    if (!is_daemon) throw std::runtime_error("--port requires --daemon");
+    port = static_cast<std::uint16_t>(value);
+  }
+  if (result.count("bind") && !result.count("port"))
+    throw std::runtime_error("--bind requires --port");
+  listen_address = result["bind"].as<std::string>();
+  if (result.count("stats")) {
+    if (result["stats"].as<std::string>() != "json")
+      throw std::runtime_error("Unsupported stats format");
+    pefti::Stats::enable();
+  }
+  // The events of a daemon would be held in memory until it exits
+  if (result.count("trace")) {
+    if (is_daemon)
+      throw std::runtime_error("--trace cannot be used with --daemon");
+    trace_filename = result["trace"].as<std::string>();
+    pefti::Trace::enable();
+  }
   config_filename = result["config"].as<std::string>();
   verify_file(config_filename);
   return AppStatus::kOk;
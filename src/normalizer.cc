@@ -0,0 +1,242 @@
+#include "normalizer.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace pefti {
+
+// Base letters for U+00C0 to U+00FF. '_' marks characters that fold to
+// two letters, '.' marks characters that are kept unchanged.
+static constexpr std::string_view kLatin1Bases{
+    "aaaaaa_ceeeeiiiidnooooo.ouuuuy__"
+    "aaaaaa_ceeeeiiiidnooooo.ouuuuy_y"};
+
+// Base letters for U+0100 to U+017F (Latin Extended-A)
+static constexpr std::string_view kLatinExtendedABases{
+    "aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiii__jjkkkllllllllll"
+    "nnnnnnnnnoooooo__rrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs"};
+
+static void append_utf8(char32_t cp, std::string& output) {
+  if (cp < 0x80) {
+    output.push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    output.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    output.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    output.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    output.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    output.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else {
+    output.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+    output.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+    output.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    output.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+static void append_space(std::string& output) {
+  if (!output.empty() && output.back() != ' ') output.push_back(' ');
+}
+
+static bool is_ascii_space(unsigned char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static void append_ascii(unsigned char c, std::string& output) {
+  if (is_ascii_space(c)) {
+    append_space(output);
+  } else {
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    output.push_back(static_cast<char>(c));
+  }
+}
+
+// Decodes one UTF-8 sequence. Returns the length of the sequence, or 0 if
+// it is not valid UTF-8.
+static std::size_t decode_utf8(const unsigned char* data, std::size_t size,
+                               char32_t& cp) {
+  const unsigned char lead = data[0];
+  std::size_t length;
+  char32_t min;
+  if ((lead & 0xE0) == 0xC0) {
+    length = 2;
+    min = 0x80;
+    cp = lead & 0x1F;
+  } else if ((lead & 0xF0) == 0xE0) {
+    length = 3;
+    min = 0x800;
+    cp = lead & 0x0F;
+  } else if ((lead & 0xF8) == 0xF0) {
+    length = 4;
+    min = 0x10000;
+    cp = lead & 0x07;
+  } else {
+    return 0;
+  }
+  if (length > size) return 0;
+  for (std::size_t i{1}; i < length; ++i) {
+    if ((data[i] & 0xC0) != 0x80) return 0;
+    cp = (cp << 6) | (data[i] & 0x3F);
+  }
+  if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+  return length;
+}
+
+// Returns the accent-free lowercase form of a Greek letter
+static char32_t fold_greek(char32_t cp) {
+  switch (cp) {
+    case 0x0386: case 0x03AC: return 0x03B1;
+    case 0x0388: case 0x03AD: return 0x03B5;
+    case 0x0389: case 0x03AE: return 0x03B7;
+    case 0x038A: case 0x0390: case 0x03AA: case 0x03AF: case 0x03CA:
+      return 0x03B9;
+    case 0x038C: case 0x03CC: return 0x03BF;
+    case 0x038E: case 0x03AB: case 0x03B0: case 0x03CB: case 0x03CD:
+      return 0x03C5;
+    case 0x038F: case 0x03CE: return 0x03C9;
+    case 0x03C2: return 0x03C3;  // Final sigma
+    default: break;
+  }
+  if (cp >= 0x0391 && cp <= 0x03A9) return cp + 0x20;
+  return cp;
+}
+
+// Returns the accent-free lowercase form of a Cyrillic letter
+static char32_t fold_cyrillic(char32_t cp) {
+  if (cp >= 0x0400 && cp <= 0x040F) cp += 0x50;
+  else if (cp >= 0x0410 && cp <= 0x042F) cp += 0x20;
+  switch (cp) {
+    case 0x0439: return 0x0438;                // й
+    case 0x0450: case 0x0451: return 0x0435;  // ѐ ё
+    case 0x0453: return 0x0433;                // ѓ
+    case 0x0457: return 0x0456;                // ї
+    case 0x045C: return 0x043A;                // ќ
+    case 0x045D: return 0x0438;                // ѝ
+    case 0x045E: return 0x0443;                // ў
+    default: return cp;
+  }
+}
+
+static bool is_unicode_space(char32_t cp) {
+  return cp == 0x0085 || cp == 0x00A0 || cp == 0x1680 ||
+         (cp >= 0x2000 && cp <= 0x200A) || cp == 0x2028 || cp == 0x2029 ||
+         cp == 0x202F || cp == 0x205F || cp == 0x3000;
+}
+
+static void append_folded(char32_t cp, std::string& output) {
+  if (is_unicode_space(cp)) {
+    append_space(output);
+  } else if ((cp >= 0x0300 && cp <= 0x036F) ||
+             (cp >= 0x200B && cp <= 0x200D) || cp == 0xFEFF) {
+    // Combining accents and zero-width characters are dropped
+  } else if (cp >= 0xFF01 && cp <= 0xFF5E) {
+    append_ascii(static_cast<unsigned char>(cp - 0xFEE0), output);
+  } else if (cp >= 0x00C0 && cp <= 0x00FF) {
+    const char base = kLatin1Bases[cp - 0x00C0];
+    if (base == '.') {
+      append_utf8(cp, output);
+    } else if (base == '_') {
+      if (cp == 0x00C6 || cp == 0x00E6) output += "ae";
+      else if (cp == 0x00DE || cp == 0x00FE) output += "th";
+      else output += "ss";
+    } else {
+      output.push_back(base);
+    }
+  } else if (cp >= 0x0100 && cp <= 0x017F) {
+    const char base = kLatinExtendedABases[cp - 0x0100];
+    if (base == '_') output += (cp < 0x0150) ? "ij" : "oe";
+    else output.push_back(base);
+  } else if (cp >= 0x0218 && cp <= 0x021B) {
+    output.push_back(cp < 0x021A ? 's' : 't');  // Ș ș Ț ț
+  } else if (cp == 0x1E9E) {
+    output += "ss";
+  } else if (cp >= 0x0386 && cp <= 0x03CE) {
+    append_utf8(fold_greek(cp), output);
+  } else if (cp >= 0x0400 && cp <= 0x045F) {
+    append_utf8(fold_cyrillic(cp), output);
+  } else {
+    append_utf8(cp, output);
+  }
+}
+
+#if defined(__SSE2__)
+// Fast path for 16 bytes of printable ASCII. Returns false, without writing
+// any output, if the block needs the scalar path: control characters,
+// non-ASCII bytes, or spaces that have to be collapsed.
+static bool append_ascii_block(const unsigned char* data,
+                               std::string& output) {
+  const __m128i block =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+  // Signed comparison, so bytes >= 0x80 are also less than 0x20
+  const __m128i is_special = _mm_cmplt_epi8(block, _mm_set1_epi8(0x20));
+  if (_mm_movemask_epi8(is_special) != 0) return false;
+  const int spaces =
+      _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')));
+  if ((spaces & (spaces >> 1)) != 0) return false;
+  if ((spaces & 1) != 0 && (output.empty() || output.back() == ' '))
+    return false;
+  const __m128i is_upper =
+      _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)),
+                    _mm_cmplt_epi8(block, _mm_set1_epi8('Z' + 1)));
+  const __m128i lower = _mm_add_epi8(
+      block, _mm_and_si128(is_upper, _mm_set1_epi8('a' - 'A')));
+  const auto offset = output.size();
+  output.resize(offset + 16);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&output[offset]), lower);
+  return true;
+}
+#endif
+
+// Processes the character at `index`, returns the index of the next one
+static std::size_t normalize_character(const unsigned char* data,
+                                       std::size_t size, std::size_t index,
+                                       std::string& output) {
+  const unsigned char c = data[index];
+  if (c < 0x80) {
+    append_ascii(c, output);
+    return index + 1;
+  }
+  char32_t cp;
+  const auto length = decode_utf8(data + index, size - index, cp);
+  if (length == 0) {
+    output.push_back(static_cast<char>(c));
+    return index + 1;
+  }
+  append_folded(cp, output);
+  return index + length;
+}
+
+void normalize_name(std::string_view name, std::string& normalized) {
+  normalized.clear();
+  normalized.reserve(name.size());
+  const auto data = reinterpret_cast<const unsigned char*>(name.data());
+  const auto size = name.size();
+  std::size_t index{0};
+#if defined(__SSE2__)
+  while (size - index >= 16) {
+    if (append_ascii_block(data + index, normalized)) {
+      index += 16;
+    } else {
+      const auto block_end = index + 16;
+      while (index < block_end)
+        index = normalize_character(data, size, index, normalized);
+    }
+  }
+#endif
+  while (index < size)
+    index = normalize_character(data, size, index, normalized);
+  if (!normalized.empty() && normalized.back() == ' ') normalized.pop_back();
+}
+
+std::string normalize_name(std::string_view name) {
+  std::string normalized;
+  normalize_name(name, normalized);
+  return normalized;
+}
+
+}  // namespace pefti
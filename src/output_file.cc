@@ -0,0 +1,223 @@
+#include "output_file.h"
+
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cppcoro/static_thread_pool.hpp>
+#include <cppcoro/task.hpp>
+#include <cppcoro/when_all.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <gsl/gsl>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "file.h"
+#include "hash.h"
+#include "http_server.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+// Size of the uncompressed data in a block. Each block is compressed on its
+// own, so smaller blocks compress less well.
+static constexpr std::size_t kBlockSize{1024 * 1024};
+
+static constexpr int kZstdLevel{3};
+
+// Header of a gzip member without a file name or time stamp, from Unix
+static constexpr std::string_view kGzipHeader{
+    "\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\x03", 10};
+
+static OutputFile::Compression get_compression(std::string_view filename) {
+  if (filename.ends_with(".gz"sv)) return OutputFile::Compression::kGzip;
+  if (filename.ends_with(".zst"sv)) return OutputFile::Compression::kZstd;
+  return OutputFile::Compression::kNone;
+}
+
+// The temporary file is in the same directory so that it can be renamed
+OutputFile::OutputFile(std::string_view filename, HttpServer* http_server)
+    : filename_(filename),
+      temp_filename_(filename_ + ".tmp."s + std::to_string(::getpid())),
+      compression_(get_compression(filename)),
+      file_(temp_filename_, std::ios::binary | std::ios::trunc),
+      http_server_(http_server) {
+  Expects(!filename_.empty());
+  if (!file_)
+    throw std::runtime_error("Failed to create/open "s + temp_filename_);
+  if (compression_ == Compression::kGzip) file_ << kGzipHeader;
+  if (http_server_) gzip_content_ = kGzipHeader;
+}
+
+OutputFile::~OutputFile() {
+  if (is_closed_) return;
+  file_.close();
+  std::error_code error;
+  std::filesystem::remove(temp_filename_, error);
+}
+
+std::ostream& OutputFile::get_stream() noexcept { return buffer_; }
+
+cppcoro::task<bool> OutputFile::close(cppcoro::static_thread_pool& tp) {
+  co_await write_blocks(tp, true);
+  if (compression_ == Compression::kGzip) file_ << get_gzip_trailer();
+  if (http_server_) gzip_content_ += get_gzip_trailer();
+  file_.close();
+  if (!file_) throw std::runtime_error("Failed to write "s + temp_filename_);
+  is_closed_ = true;
+  if (http_server_) {
+    http_server_->publish(filename_, std::move(content_),
+                          std::move(gzip_content_), hasher_.digest());
+  }
+  co_return publish();
+}
+
+cppcoro::task<> OutputFile::copy(cppcoro::static_thread_pool& tp,
+                                 std::istream& source) {
+  // Enough blocks are buffered for every thread to compress one
+  const auto flush_size = kBlockSize * tp.thread_count();
+  std::string data(kBlockSize, '\0');
+  while (source.read(data.data(), std::ssize(data)) || source.gcount() > 0) {
+    buffer_.write(data.data(), source.gcount());
+    if (buffer_.view().size() >= flush_size) co_await write_blocks(tp, false);
+  }
+}
+
+cppcoro::task<> OutputFile::flush(cppcoro::static_thread_pool& tp) {
+  co_await write_blocks(tp, false);
+}
+
+std::string OutputFile::compress_block(std::string_view block,
+                                       Compression compression) const {
+  std::string output;
+  if (compression == Compression::kGzip) {
+    z_stream stream{};
+    // Negative window bits for raw deflate, the gzip header and trailer are
+    // written once for the whole file
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+      throw std::runtime_error("deflateInit2() failed"s);
+    auto end_stream = gsl::finally([&stream]() { deflateEnd(&stream); });
+    // The sync flush adds an empty stored block of at most 10 bytes
+    output.resize(deflateBound(&stream, block.size()) + 16);
+    stream.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(block.data()));
+    stream.avail_in = static_cast<uInt>(block.size());
+    stream.next_out = reinterpret_cast<Bytef*>(output.data());
+    stream.avail_out = static_cast<uInt>(output.size());
+    if (deflate(&stream, Z_SYNC_FLUSH) != Z_OK || stream.avail_in != 0 ||
+        stream.avail_out == 0)
+      throw std::runtime_error("Failed to compress "s + filename_);
+    output.resize(stream.total_out);
+  } else {
+    output.resize(ZSTD_compressBound(block.size()));
+    const auto size = ZSTD_compress(output.data(), output.size(), block.data(),
+                                    block.size(), kZstdLevel);
+    if (ZSTD_isError(size))
+      throw std::runtime_error("Failed to compress "s + filename_);
+    output.resize(size);
+  }
+  return output;
+}
+
+// An empty final deflate block then the CRC-32 and size modulo 2^32, both
+// little-endian
+std::string OutputFile::get_gzip_trailer() const {
+  std::string trailer{"\x03\x00"sv};
+  for (auto value : {crc_, static_cast<std::uint32_t>(size_)}) {
+    for (int i{0}; i < 4; ++i)
+      trailer += static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+  return trailer;
+}
+
+// The temporary file replaces the output file unless the sidecar file has
+// the same hash and the output file still exists. The sidecar is written
+// after the rename, so if it is lost the next output is published anyway.
+bool OutputFile::publish() {
+  const auto hash = to_hex(hasher_.digest());
+  const auto hash_filename = filename_ + ".hash"s;
+  std::string previous_hash;
+  std::ifstream hash_file(hash_filename);
+  if (hash_file) std::getline(hash_file, previous_hash);
+  std::error_code error;
+  if (previous_hash == hash && std::filesystem::exists(filename_, error)) {
+    std::filesystem::remove(temp_filename_, error);
+    return false;
+  }
+  std::filesystem::rename(temp_filename_, filename_, error);
+  if (error) {
+    std::filesystem::remove(temp_filename_, error);
+    throw std::runtime_error("Failed to rename "s + temp_filename_);
+  }
+  write_file_atomically(hash_filename, hash + '\n');
+  return true;
+}
+
+// Compresses the complete blocks in the buffer, or all of the buffer if
+// `is_last` is set, concurrently then writes them in order. The rest of the
+// buffer is kept for the next call.
+cppcoro::task<> OutputFile::write_blocks(cppcoro::static_thread_pool& tp,
+                                         bool is_last) {
+  const auto data = buffer_.view();
+  const auto num_blocks = is_last ? (data.size() + kBlockSize - 1) / kBlockSize
+                                  : data.size() / kBlockSize;
+  if (num_blocks == 0) co_return;
+  const auto written = std::min(num_blocks * kBlockSize, data.size());
+  hasher_.update(data.substr(0, written));
+  size_ += written;
+  if (compression_ == Compression::kGzip || http_server_) {
+    crc_ = static_cast<std::uint32_t>(crc32_z(
+        crc_, reinterpret_cast<const Bytef*>(data.data()), written));
+  }
+  if (http_server_) content_ += data.substr(0, written);
+  //
+  // The gzip variant for the HTTP server is compressed with the file's
+  // blocks, or is the file's blocks if the file is gzip
+  const bool needs_gzip_variant{http_server_ &&
+                                compression_ != Compression::kGzip};
+  if (compression_ == Compression::kNone && !needs_gzip_variant) {
+    file_.write(data.data(), static_cast<std::streamsize>(written));
+    if (!file_) throw std::runtime_error("Failed to write "s + temp_filename_);
+    buffer_.str(std::string{data.substr(written)});
+    co_return;
+  }
+  std::vector<std::string> compressed_blocks(num_blocks);
+  std::vector<std::string> gzip_blocks(needs_gzip_variant ? num_blocks : 0);
+  auto compress = [&](std::size_t i) -> cppcoro::task<> {
+    co_await tp.schedule();
+    const auto block = data.substr(i * kBlockSize, kBlockSize);
+    if (compression_ != Compression::kNone)
+      compressed_blocks[i] = compress_block(block, compression_);
+    if (needs_gzip_variant)
+      gzip_blocks[i] = compress_block(block, Compression::kGzip);
+  };
+  std::vector<cppcoro::task<>> tasks;
+  for (std::size_t i{0}; i < num_blocks; ++i) tasks.push_back(compress(i));
+  co_await cppcoro::when_all(std::move(tasks));
+  if (compression_ == Compression::kNone) {
+    file_.write(data.data(), static_cast<std::streamsize>(written));
+  } else {
+    for (const auto& block : compressed_blocks)
+      file_.write(block.data(), std::ssize(block));
+  }
+  if (!file_) throw std::runtime_error("Failed to write "s + temp_filename_);
+  if (http_server_) {
+    for (const auto& block : needs_gzip_variant ? gzip_blocks
+                                                : compressed_blocks)
+      gzip_content_ += block;
+  }
+  buffer_.str(std::string{data.substr(written)});
+}
+
+}  // namespace pefti
@@ -13,12 +13,14 @@
 
 #include "buffers.h"
 #include "iptv_channel.h"
+#include "playlist_snapshot.h"
+#include "stats.h"
+#include "trace.h"
 
 using namespace std::literals;
 
 namespace pefti {
 
-std::array<char8_t, 64 * 1024> line_buffer;
 const char8_t LF = '\n';
 
 Parser::Parser() {
@@ -50,14 +52,14 @@ std::string_view Parser::get_line() {
   } else {
     const auto size_part_1 = kBufferSize - (start_index_ & kIndexMask);
     const auto size_part_2 = read_index_ - start_index_ - size_part_1 + 1;
-    std::strncpy(reinterpret_cast<char*>(&line_buffer[0]),
+    std::strncpy(reinterpret_cast<char*>(&line_buffer_[0]),
                  reinterpret_cast<const char*>(
                      &lp_buffer_->data[start_index_ & kIndexMask]),
                  size_part_1);
-    std::strncpy(reinterpret_cast<char*>(&line_buffer[size_part_1]),
+    std::strncpy(reinterpret_cast<char*>(&line_buffer_[size_part_1]),
                  reinterpret_cast<const char*>(lp_buffer_->data.data()),
                  size_part_2);
-    line = std::string_view{reinterpret_cast<const char*>(&line_buffer[0]),
+    line = std::string_view{reinterpret_cast<const char*>(&line_buffer_[0]),
                             line_length - 1};
   }
   return line;
@@ -85,15 +87,21 @@ inline bool Parser::have_received_sentinel() {
 // objects and writes them to `pf_buffer`.
 cppcoro::task<> Parser::parse(cppcoro::static_thread_pool& tp,
                               PlaylistLoaderParserBuffer& lp_buffer,
-                              PlaylistParserFilterBuffer& pf_buffer) {
+                              PlaylistParserFilterBuffer& pf_buffer,
+                              PlaylistSnapshot& snapshot) {
   co_await tp.schedule();
+  const Stats::Timer timer(Stats::Stage::kParser);
+  const Trace::Span span(Trace::Stage::kParser, lp_buffer.source_id);
   lp_buffer_ = &lp_buffer;
   pf_buffer_ = &pf_buffer;
+  snapshot_ = &snapshot;
   bool received_sentinel{false};
   IptvChannel iptv_channel;
   while (!received_sentinel) {
     const size_t write_index =
-        co_await lp_buffer_->sequencer.wait_until_published(read_index_, tp);
+        co_await lp_buffer_->wait_until_published(read_index_, tp);
+    const Trace::Span batch_span(Trace::Stage::kParser, lp_buffer.source_id,
+                                 "batch"sv);
     do {
       if (have_received_line_feed()) {
         auto line = get_line();
@@ -107,6 +115,12 @@ cppcoro::task<> Parser::parse(cppcoro::static_thread_pool& tp,
 
     } while (read_index_++ != write_index);
   }
+  Stats::add_bytes(Stats::Stage::kParser, read_index_);
+  // The Loader writes nothing but the sentinel when the snapshot is replayed
+  if (snapshot.is_replayed())
+    co_await snapshot.replay(tp, pf_buffer);
+  else
+    snapshot.save();
   co_await publish_sentinel(tp);
 }
 
@@ -114,7 +128,7 @@ cppcoro::task<> Parser::parse(cppcoro::static_thread_pool& tp,
 cppcoro::task<> Parser::publish_sentinel(cppcoro::static_thread_pool& tp) {
   co_await tp.schedule();
   const size_t kIndexMask = pf_buffer_->get_index_mask();
-  size_t write_index = co_await pf_buffer_->sequencer.claim_one(tp);
+  size_t write_index = co_await pf_buffer_->claim_one(tp);
   IptvChannel sentinel;
   sentinel.set_original_name(kSentinel);
   pf_buffer_->data[write_index & kIndexMask] = std::move(sentinel);
@@ -153,6 +167,7 @@ void Parser::WaitingForExtinfState::get_key_value_pairs(
             kv_pair[pos + 1] == '"' ? pos + 2 : pos + 1,
             kv_pair[length - 1] == '"' ? length - pos - 3 : length - pos - 2);
       }
+      parser_->snapshot_->add_tag(key, value);
       channel.set_tag(key, value);
     }
     ++kv_iterator;
@@ -202,10 +217,12 @@ cppcoro::task<> Parser::WaitingForUrlState::process_line(
   const auto& p{parser_};
   if (line.starts_with(kHttp)) {
     iptv_channel.set_url(line);
+    p->snapshot_->add_channel(iptv_channel.get_original_name(), line);
     const size_t kIndexMask = p->pf_buffer_->get_index_mask();
-    size_t write_index = co_await p->pf_buffer_->sequencer.claim_one(tp);
+    size_t write_index = co_await p->pf_buffer_->claim_one(tp);
     p->pf_buffer_->data[write_index & kIndexMask] = std::move(iptv_channel);
     p->pf_buffer_->sequencer.publish(write_index);
+    Stats::add_items(Stats::Stage::kParser, 1);
     p->active_state_ =
         p->states_[static_cast<size_t>(State::kWaitingForExtinf)];
   }
@@ -5,16 +5,21 @@
 
 #include <cppcoro/async_mutex.hpp>
 #include <cppcoro/task.hpp>
+#include <cstdint>
 #include <exception>
-#include <fstream>
 #include <gsl/gsl>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <unordered_set>
 #include <vector>
 
 #include "resource.h"
+#include "trace.h"
 
 using namespace std::string_view_literals;
 
@@ -22,79 +27,137 @@ namespace pefti {
 
 cppcoro::async_mutex mutex;
 
-// Creates the lookup table on first invocation
-bool Playlist::is_tvg_id_in_playlist(std::string_view tvg_id) {
-  if (tvg_id == ""sv) return false;
-  if (!tvg_id_lookup_) {
-    tvg_id_lookup_ = std::make_optional<std::unordered_set<std::string>>();
-    for (auto& channel : playlist_) {
-      const auto value = channel.get_tag_value(IptvChannel::kTagTvgId);
-      if (value && (*value != "")) tvg_id_lookup_->insert(*value);
-    }
+Playlist::TextRange Playlist::append_text(std::string_view text) {
+  if (text_.size() + text.size() >= UINT32_MAX)
+    throw std::runtime_error("New playlist is too large"s);
+  TextRange range{static_cast<std::uint32_t>(text_.size()),
+                  static_cast<std::uint32_t>(text.size())};
+  text_ += text;
+  return range;
+}
+
+std::optional<Playlist::GroupId> Playlist::find_group(
+    std::string_view group_title) const {
+  auto iter = group_title_ids_.find(std::string{group_title});
+  if (iter == group_title_ids_.end()) return std::nullopt;
+  return iter->second;
+}
+
+void Playlist::clear() {
+  new_names_.clear();
+  urls_.clear();
+  group_ids_.clear();
+  tvg_ids_.clear();
+  template_ids_.clear();
+  quality_ranks_.clear();
+  tags_.clear();
+  text_.clear();
+  tvg_id_lookup_.reset();
+}
+
+void Playlist::freeze_tvg_ids() {
+  tvg_id_lookup_ = std::make_optional<std::unordered_set<std::string_view>>();
+  tvg_id_lookup_->reserve(tvg_ids_.size());
+  for (auto range : tvg_ids_) {
+    if (range.offset != kNoText.offset && range.size != 0)
+      tvg_id_lookup_->insert(get_text(range));
   }
-  Ensures(tvg_id_lookup_.has_value());
-  Ensures(!tvg_id_lookup_->empty());
-  return tvg_id_lookup_->contains(std::string{tvg_id});
+}
+
+bool Playlist::is_tvg_id_in_playlist(std::string_view tvg_id) const {
+  Expects(tvg_id_lookup_.has_value());
+  if (tvg_id == ""sv) return false;
+  return tvg_id_lookup_->contains(tvg_id);
 }
 
 std::vector<std::string> load_playlists(const std::vector<std::string>& urls) {
   return load_resources(urls);
 }
 
-cppcoro::task<> Playlist::push_back(IptvChannel channel) {
-  cppcoro::async_mutex_lock lock = co_await mutex.scoped_lock_async();
-  playlist_.push_back(channel);
+// The tags are formatted before taking the lock
+cppcoro::task<> Playlist::push_back(IptvChannel channel,
+                                    std::uint32_t source_id) {
+  std::string tags;
+  for (const auto& [name, value] : channel.get_tags()) {
+    if (name == IptvChannel::kTagTvgId) continue;
+    tags += ' ' + name + "=\"" + value + '"';
+  }
+  const auto group_title = channel.get_tag_value(IptvChannel::kTagGroupTitle);
+  const auto tvg_id = channel.get_tag_value(IptvChannel::kTagTvgId);
+  // Only contended acquisitions are traced
+  if (!mutex.try_lock()) {
+    const Trace::Span span(Trace::Stage::kTransformer, source_id,
+                           "wait playlist"sv);
+    co_await mutex.lock_async();
+  }
+  cppcoro::async_mutex_lock lock(mutex, std::adopt_lock);
+  new_names_.push_back(append_text(channel.get_new_name()));
+  urls_.push_back(append_text(channel.get_url()));
+  auto group_id = kNoGroup;
+  if (group_title) {
+    auto [iter, is_new] = group_title_ids_.try_emplace(
+        *group_title, static_cast<GroupId>(group_titles_.size()));
+    if (is_new) group_titles_.push_back(*group_title);
+    group_id = iter->second;
+  }
+  group_ids_.push_back(group_id);
+  tvg_ids_.push_back(tvg_id ? append_text(*tvg_id) : kNoText);
+  template_ids_.push_back(channel.get_template_id());
+  quality_ranks_.push_back(channel.get_quality_rank());
+  tags_.push_back(append_text(tags));
 }
 
-void store_playlist(std::string_view filename, Playlist& playlist,
+void Playlist::write_channel(std::ostream& stream, Index index,
+                             bool with_tvg_id) const {
+  stream << "#EXTINF:-1";
+  const auto tvg_id = tvg_ids_[index];
+  if (with_tvg_id && tvg_id.offset != kNoText.offset)
+    stream << " tvg-id=\"" << get_text(tvg_id) << '"';
+  stream << get_text(tags_[index]) << ',' << get_new_name(index) << '\n'
+         << get_url(index) << '\n';
+}
+
+void store_playlist(std::ostream& file, Playlist& playlist,
                     ConfigType& config, ChannelsMapper& channels_mapper) {
-  Expects(filename != ""sv);
-  std::ofstream file(std::string{filename});
-  if (!file)
-    throw std::runtime_error("Failed to create/open new playlist file"s);
   file << "#EXTM3U\n";
   const auto num_duplicates =
       static_cast<std::size_t>(config.get_num_duplicates());
   const auto duplicates_location = config.get_duplicates_location();
-  auto write_duplicates = [&file, &num_duplicates](auto& channels) {
+  auto write_duplicates = [&file, &num_duplicates,
+                           &playlist](const auto& channels) {
     const auto num_to_write =
         (channels.size() > 0) ? std::min(num_duplicates, channels.size() - 1)
                               : 0;
-    if (num_to_write > 0) {
-      for (std::size_t i{1}; i <= num_to_write; ++i) {
-        (*(channels[i])).delete_tag(IptvChannel::kTagTvgId);
-        file << *(channels[i]);
-      }
-    }
+    for (std::size_t i{1}; i <= num_to_write; ++i)
+      playlist.write_channel(file, channels[i], false);
   };
   //
   // Write highest priority instance of each channel, plus inline duplicates
-  auto channels_templates = config.get_channels_templates();
-  for (auto& ct : channels_templates) {
-    auto& channels = channels_mapper.map_template_to_channel(ct);
-    if (channels.size() > 0) file << *(channels[0]);
+  const IptvChannel::TemplateId num_templates =
+      config.get_num_channels_templates();
+  for (IptvChannel::TemplateId t{0}; t < num_templates; ++t) {
+    auto& channels = channels_mapper.map_template_to_channel(t);
+    if (channels.size() > 0) playlist.write_channel(file, channels[0], true);
     if (duplicates_location == ConfigType::DuplicatesLocation::kInline)
       write_duplicates(channels);
   }
   if (duplicates_location == ConfigType::DuplicatesLocation::kAppend) {
     // Append duplicates
-    for (auto& ct : channels_templates) {
-      auto& channels = channels_mapper.map_template_to_channel(ct);
-      write_duplicates(channels);
-    }
+    for (IptvChannel::TemplateId t{0}; t < num_templates; ++t)
+      write_duplicates(channels_mapper.map_template_to_channel(t));
   }
   //
   // Write allowed groups
   auto allowed_groups = config.get_allowed_groups();
   for (auto& group : allowed_groups) {
-    for (auto& channel : playlist) {
-      auto value = channel.get_tag_value(IptvChannel::kTagGroupTitle);
-      if (value && value == group) {
-        if (!channels_mapper.is_allowed_channel(channel)) file << channel;
-      }
+    const auto group_id = playlist.find_group(group);
+    if (!group_id) continue;
+    for (Playlist::Index i{0}; i < playlist.size(); ++i) {
+      if (playlist.get_group_id(i) == *group_id &&
+          playlist.get_template_id(i) == IptvChannel::kNoTemplate)
+        playlist.write_channel(file, i, true);
     }
   }
-  file.close();
 }
 
 }  // namespace pefti
@@ -0,0 +1,123 @@
+#include "playlist_snapshot.h"
+
+#include <cppcoro/static_thread_pool.hpp>
+#include <cppcoro/task.hpp>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "blob.h"
+#include "buffers.h"
+#include "file.h"
+#include "hash.h"
+#include "iptv_channel.h"
+#include "stats.h"
+#include "version.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+static constexpr auto kSnapshotMagic = "PEFTISNP"sv;
+static constexpr auto kSnapshotSuffix = ".snapshot"sv;
+
+// The last byte is the revision of the blob layout
+static constexpr std::uint32_t kSnapshotVersion =
+    (kVersionMajor << 24) | (kVersionMinor << 16) | (kVersionPatch << 8) | 1;
+
+// The file is named by the hash of the URL, which is also the key of the
+// blob so that a snapshot is never used for another URL
+PlaylistSnapshot::PlaylistSnapshot(const std::string& directory,
+                                   const std::string& url)
+    : filename_(directory + "/"s + to_hex(hash_bytes(url)) +
+                std::string{kSnapshotSuffix}),
+      url_(url) {
+  std::error_code error;
+  if (!std::filesystem::exists(filename_, error)) return;
+  try {
+    file_ = MappedFile(filename_);
+    BlobReader reader(file_.get_data(), kSnapshotMagic, kSnapshotVersion,
+                      hash_bytes(url));
+    content_hash_ = reader.read<std::uint64_t>();
+    etag_ = reader.read_string();
+    last_modified_ = reader.read_string();
+    channels_ = reader.view_array<ChannelRecord>();
+    tags_ = reader.view_array<TagRecord>();
+    if (!reader.is_at_end())
+      throw std::runtime_error("Unexpected data in snapshot"s);
+    for (const auto& channel : channels_) {
+      if (channel.first_tag > tags_.size() ||
+          channel.num_tags > tags_.size() - channel.first_tag)
+        throw std::runtime_error("Invalid channel in snapshot"s);
+    }
+    reader_ = std::move(reader);
+  } catch (const std::exception&) {
+    channels_ = {};
+    tags_ = {};
+    file_ = MappedFile{};
+  }
+}
+
+void PlaylistSnapshot::set_validators(std::string etag,
+                                      std::string last_modified) {
+  new_etag_ = std::move(etag);
+  new_last_modified_ = std::move(last_modified);
+}
+
+void PlaylistSnapshot::add_tag(std::string_view name, std::string_view value) {
+  new_tags_.push_back({writer_.add_string(name), writer_.add_string(value)});
+}
+
+void PlaylistSnapshot::add_channel(std::string_view name,
+                                   std::string_view url) {
+  const auto first_tag =
+      new_channels_.empty()
+          ? 0
+          : new_channels_.back().first_tag + new_channels_.back().num_tags;
+  new_channels_.push_back(
+      {writer_.add_string(name), writer_.add_string(url), first_tag,
+       static_cast<std::uint32_t>(new_tags_.size()) - first_tag});
+}
+
+// The tags are set in the order that the Parser set them, so the channels
+// are the same as the parsed channels, including the order of their tags
+cppcoro::task<> PlaylistSnapshot::replay(
+    cppcoro::static_thread_pool& tp, PlaylistParserFilterBuffer& pf_buffer) {
+  const auto kIndexMask = pf_buffer.get_index_mask();
+  for (const auto& record : channels_) {
+    IptvChannel channel;
+    for (const auto& tag : tags_.subspan(record.first_tag, record.num_tags))
+      channel.set_tag(reader_->get_string(tag.name),
+                      reader_->get_string(tag.value));
+    channel.set_original_name(reader_->get_string(record.name));
+    channel.set_url(reader_->get_string(record.url));
+    const auto write_index = co_await pf_buffer.claim_one(tp);
+    pf_buffer.data[write_index & kIndexMask] = std::move(channel);
+    pf_buffer.sequencer.publish(write_index);
+  }
+  Stats::add_items(Stats::Stage::kParser, channels_.size());
+}
+
+void PlaylistSnapshot::save() {
+  if (!is_complete_ || is_replayed_) return;
+  try {
+    writer_.write(new_content_hash_.value_or(hasher_.digest()));
+    writer_.write_string(new_etag_);
+    writer_.write_string(new_last_modified_);
+    writer_.write_array<ChannelRecord>(new_channels_);
+    writer_.write_array<TagRecord>(new_tags_);
+    std::filesystem::create_directories(
+        std::filesystem::path{filename_}.parent_path());
+    write_file_atomically(
+        filename_,
+        writer_.finish(kSnapshotMagic, kSnapshotVersion, hash_bytes(url_)));
+  } catch (const std::exception&) {
+  }
+}
+
+}  // namespace pefti
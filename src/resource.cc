@@ -2,8 +2,14 @@
 
 #include <curl/curl.h>
 
+#include <chrono>
+#include <cstdint>
 #include <exception>
 #include <gsl/gsl>
+#include <string_view>
+
+#include "stats.h"
+#include "trace.h"
 
 namespace pefti {
 
@@ -34,6 +40,9 @@ void add_transfer(CURLM* multi_handle, const char* url, std::string& output) {
   if (ecode != CURLE_OK) throw std::runtime_error(curl_easy_strerror(ecode));
   ecode = curl_easy_setopt(easy_handle, CURLOPT_SSL_VERIFYHOST, 0L);
   if (ecode != CURLE_OK) throw std::runtime_error(curl_easy_strerror(ecode));
+  // Accepts every encoding that libcurl can decode
+  ecode = curl_easy_setopt(easy_handle, CURLOPT_ACCEPT_ENCODING, "");
+  if (ecode != CURLE_OK) throw std::runtime_error(curl_easy_strerror(ecode));
   CURLMcode mcode = curl_multi_add_handle(multi_handle, easy_handle);
   if (mcode != CURLM_OK) throw std::runtime_error(curl_multi_strerror(mcode));
 }
@@ -60,6 +69,9 @@ std::vector<std::string> load_resources(const std::vector<std::string>& urls) {
     while ((msg = curl_multi_info_read(mhandle, &num_msgs_in_queue))) {
       if (msg->msg == CURLMSG_DONE) {
         CURL* ehandle = msg->easy_handle;
+        const char* url{nullptr};
+        curl_easy_getinfo(ehandle, CURLINFO_PRIVATE, &url);
+        add_download_stats(ehandle, url);
         curl_multi_remove_handle(mhandle, ehandle);
         curl_easy_cleanup(ehandle);
       }
@@ -76,6 +88,25 @@ std::vector<std::string> load_resources(const std::vector<std::string>& urls) {
   return resources;
 }
 
+void add_download_stats(CURL* handle, std::string_view url) {
+  if (!Stats::is_enabled() && !Trace::is_enabled()) return;
+  const auto now = Trace::Clock::now();
+  long status{0};
+  curl_off_t time_to_first_byte{0};
+  curl_off_t total_time{0};
+  curl_off_t num_bytes{0};
+  curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+  curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &time_to_first_byte);
+  curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total_time);
+  curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &num_bytes);
+  if (Stats::is_enabled()) {
+    Stats::add_download(url, status, time_to_first_byte, total_time,
+                        static_cast<std::uint64_t>(num_bytes));
+  }
+  // The transfer finished when curl reported it done, which is now
+  Trace::add_download(url, now - std::chrono::microseconds{total_time}, now);
+}
+
 static size_t write_callback(void* ptr, size_t size, size_t nmemb,
                              void* user_data) {
   std::string& data = *static_cast<std::string*>(user_data);
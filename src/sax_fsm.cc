@@ -1,19 +1,174 @@
 #include "sax_fsm.h"
 
+#include <libxml/entities.h>
 #include <libxml/parser.h>
 #include <libxml/xmlmemory.h>
 
 #include <algorithm>
 #include <cctype>
+#include <cstring>
+#include <gsl/gsl>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 
 #include "playlist.h"
 
 namespace pefti {
 
-SaxFsm::SaxFsm(std::string_view parent_node, std::ofstream& stream,
-               Playlist& playlist)
-    : parent_node_(parent_node), stream_(stream), playlist_(playlist) {}
+// Appends text to output, escaping the characters that are special in XML
+static void append_escaped(std::string_view text, std::string& output) {
+  std::size_t begin{0};
+  while (begin < text.size()) {
+    const auto pos = text.find_first_of("&<>\"'"sv, begin);
+    output.append(text.substr(begin, pos - begin));
+    if (pos == std::string_view::npos) break;
+    switch (text[pos]) {
+      case '&':  output += "&amp;";  break;
+      case '\"': output += "&quot;"; break;
+      case '\'': output += "&apos;"; break;
+      case '<':  output += "&lt;";   break;
+      default:   output += "&gt;";   break;
+    }
+    begin = pos + 1;
+  }
+}
+
+// Returns the length of the entity or character reference at the start of
+// text, or 0 if text does not start with a reference
+static std::size_t get_reference_size(std::string_view text) {
+  const auto end = text.find(';');
+  if (end == std::string_view::npos || end < 2) return 0;
+  auto name = text.substr(1, end - 1);
+  if (name.front() == '#') {
+    name.remove_prefix(1);
+    const bool is_hex = name.starts_with('x');
+    if (is_hex) name.remove_prefix(1);
+    if (name.empty()) return 0;
+    for (unsigned char c : name)
+      if (is_hex ? !std::isxdigit(c) : !std::isdigit(c)) return 0;
+  } else {
+    for (unsigned char c : name) {
+      if (!std::isalnum(c) && c < 0x80 && c != '_' && c != '-' && c != '.' &&
+          c != ':')
+        return 0;
+    }
+  }
+  return end + 1;
+}
+
+// Returns the replacement text of an entity declared in the internal subset
+// of `document`, if it contains no references of its own
+static std::optional<std::string_view> get_entity_text(xmlDocPtr document,
+                                                       std::string_view name) {
+  if (!document || name.starts_with('#')) return std::nullopt;
+  const auto entity = xmlGetDocEntity(
+      document, reinterpret_cast<const xmlChar*>(std::string{name}.c_str()));
+  if (!entity || entity->etype != XML_INTERNAL_GENERAL_ENTITY ||
+      !entity->content)
+    return std::nullopt;
+  const std::string_view text{reinterpret_cast<const char*>(entity->content)};
+  if (text.find('&') != std::string_view::npos) return std::nullopt;
+  return text;
+}
+
+// Appends an attribute value passed by libxml2 to output, to be quoted with
+// quotation marks. The new EPG does not declare the entities of the input
+// EPG, so references to them are replaced by their text. Other references
+// are copied as they are, any other "&" and the characters that cannot
+// appear unescaped in a value are escaped.
+static void append_attribute_value(std::string_view value,
+                                   xmlDocPtr document, std::string& output) {
+  std::size_t begin{0};
+  while (begin < value.size()) {
+    const auto pos = value.find_first_of("&<\""sv, begin);
+    output.append(value.substr(begin, pos - begin));
+    if (pos == std::string_view::npos) break;
+    begin = pos + 1;
+    if (value[pos] == '&') {
+      const auto size = get_reference_size(value.substr(pos));
+      if (size > 0) {
+        const auto text =
+            get_entity_text(document, value.substr(pos + 1, size - 2));
+        if (text)
+          append_attribute_value(*text, nullptr, output);
+        else
+          output.append(value.substr(pos, size));
+        begin = pos + size;
+      } else {
+        output += "&amp;"sv;
+      }
+    } else if (value[pos] == '<') {
+      output += "&lt;"sv;
+    } else {
+      output += "&quot;"sv;
+    }
+  }
+}
+
+// Without entity substitution libxml2 passes "&" in attribute values as a
+// character reference, entities other than the predefined ones as entity
+// references, and all other characters unescaped. "<" is passed as it is.
+std::string unescape_attribute_value(std::string_view value) {
+  std::string unescaped;
+  unescaped.reserve(value.size());
+  std::size_t begin{0};
+  while (begin < value.size()) {
+    const auto pos = value.find("&#"sv, begin);
+    unescaped.append(value.substr(begin, pos - begin));
+    if (pos == std::string_view::npos) break;
+    if (value.substr(pos).starts_with("&#38;"sv)) {
+      unescaped += '&';
+    } else {
+      unescaped += "&#"sv;
+      begin = pos + 2;
+      continue;
+    }
+    begin = pos + 5;
+  }
+  return unescaped;
+}
+
+// The SaxFsm of a parser context, see SaxFsm::parse()
+static SaxFsm& get_fsm(void* context) noexcept {
+  const auto parser_context = static_cast<xmlParserCtxtPtr>(context);
+  return *static_cast<SaxFsm*>(parser_context->_private);
+}
+
+// Returns true for whitespace characters other than space, which are
+// removed from text
+static bool is_removed_whitespace(unsigned char c) {
+  return c != ' ' && std::isspace(c);
+}
+
+SaxFsm::SaxFsm(std::ostream& channel_stream, std::ostream& programme_stream,
+               const Playlist& playlist)
+    : channel_stream_(channel_stream),
+      programme_stream_(programme_stream),
+      playlist_(playlist) {}
+
+void SaxFsm::parse(std::string_view document) {
+  xmlSAXHandler sax_handler;
+  memset(&sax_handler, 0, sizeof(sax_handler));
+  sax_handler.initialized = XML_SAX2_MAGIC;
+  sax_handler.startElementNs = &SaxFsm::handler_start_element;
+  sax_handler.endElementNs = &SaxFsm::handler_end_element;
+  sax_handler.characters = &SaxFsm::handler_characters;
+  auto parser_context =
+      xmlCreatePushParserCtxt(&sax_handler, nullptr, nullptr, 0, nullptr);
+  if (!parser_context)
+    throw std::runtime_error("xmlCreatePushParserCtxt() returned NULL");
+  auto free_parser_context = gsl::finally([parser_context]() {
+    if (parser_context->myDoc) xmlFreeDoc(parser_context->myDoc);
+    xmlFreeParserCtxt(parser_context);
+  });
+  parser_context->_private = this;
+  if (xmlParseChunk(parser_context, document.data(),
+                    static_cast<int>(document.size()), 1) != 0 ||
+      !parser_context->wellFormed)
+    throw std::runtime_error("Failed to parse XML document");
+}
 
 std::string SaxFsm::get_attribute_value(std::string_view attribute_name,
                                         int num_attributes,
@@ -25,23 +180,27 @@ std::string SaxFsm::get_attribute_value(std::string_view attribute_name,
     if (name == attribute_name) {
       const xmlChar* begin = attributes[index + 3];
       const xmlChar* end = attributes[index + 4];
-      value = std::string{reinterpret_cast<const char*>(begin),
-                          reinterpret_cast<const char*>(end)};
+      value = unescape_attribute_value({reinterpret_cast<const char*>(begin),
+                                        reinterpret_cast<const char*>(end)});
       break;
     }
   }
   return value;
 }
 
-// SAX2 handler for characters between start and end elements
+// SAX2 handler for characters between start and end elements. Appends the
+// runs of characters between removed whitespace characters.
 void SaxFsm::handler_characters(void* context, const xmlChar* begin,
                                 int length) {
-  SaxFsm& fsm = *(static_cast<SaxFsm*>(context));
+  SaxFsm& fsm = get_fsm(context);
   if (fsm.state_ == State::kInsideNode) {
-    auto end = begin + length;
-    std::for_each(begin, end, [&fsm](unsigned char c) {
-      if (!std::isspace(c) || c == ' ') fsm.characters_.push_back(c);
-    });
+    const auto end = begin + length;
+    while (begin != end) {
+      const auto run_end = std::find_if(begin, end, is_removed_whitespace);
+      fsm.characters_.append(reinterpret_cast<const char*>(begin),
+                             reinterpret_cast<const char*>(run_end));
+      begin = (run_end == end) ? end : run_end + 1;
+    }
   }
 }
 
@@ -53,7 +212,7 @@ void SaxFsm::handler_characters(void* context, const xmlChar* begin,
 // URI: The element namespace name if available
 void SaxFsm::handler_end_element(void* context, const xmlChar* local_name,
                                  const xmlChar*, const xmlChar*) {
-  SaxFsm& fsm = *(static_cast<SaxFsm*>(context));
+  SaxFsm& fsm = get_fsm(context);
   std::string element_name{reinterpret_cast<const char*>(local_name)};
   switch (fsm.state_) {
     case State::kWaitingForParentNode:
@@ -63,27 +222,19 @@ void SaxFsm::handler_end_element(void* context, const xmlChar* local_name,
         throw std::runtime_error("Invalid XML");
       if (!std::all_of(fsm.characters_.begin(), fsm.characters_.end(),
                        isspace)) {
-        for (const char& c : fsm.characters_) {
-          // Escape special characters
-          switch (c) {
-            case '&':  fsm.stream_ << "&amp;";  break;
-            case '\"': fsm.stream_ << "&quot;"; break;
-            case '\'': fsm.stream_ << "&apos;"; break;
-            case '<':  fsm.stream_ << "&lt;";   break;
-            case '>':  fsm.stream_ << "&gt;";   break;
-            default:   fsm.stream_ << c;        break;
-          }
-        }
+        fsm.escaped_.clear();
+        append_escaped(fsm.characters_, fsm.escaped_);
+        *fsm.stream_ << fsm.escaped_;
       }
     } break;
     case State::kOutsideNode:
-      fsm.stream_ << '\n';
+      *fsm.stream_ << '\n';
       fsm.indentation_--;
-      for (int i{}; i < fsm.indentation_; i++) fsm.stream_ << '\t';
+      for (int i{}; i < fsm.indentation_; i++) *fsm.stream_ << '\t';
       break;
   }
   fsm.characters_.clear();
-  fsm.stream_ << "</" << element_name << '>';
+  *fsm.stream_ << "</" << element_name << '>';
   if (element_name == fsm.parent_node_) {
     fsm.state_ = State::kWaitingForParentNode;
   } else {
@@ -109,34 +260,52 @@ void SaxFsm::handler_start_element(void* context, const xmlChar* local_name,
                                    const xmlChar*, const xmlChar*, int,
                                    const xmlChar**, int num_attributes, int,
                                    const xmlChar** attributes) {
-  SaxFsm& fsm = *(static_cast<SaxFsm*>(context));
+  SaxFsm& fsm = get_fsm(context);
   std::string element_name{reinterpret_cast<const char*>(local_name)};
   if (fsm.state_ == State::kWaitingForParentNode) {
-    if (element_name.compare(fsm.parent_node_) == 0) {
-      auto attribute_name = (fsm.parent_node_ == KChannel) ? kId : KChannel;
-      std::string tvg_id =
-          fsm.get_attribute_value(attribute_name, num_attributes, attributes);
-      if (!fsm.playlist_.is_tvg_id_in_playlist(tvg_id)) return;
-      fsm.indentation_ = 1;
+    if (element_name == KChannel) {
+      fsm.parent_node_ = KChannel;
+      fsm.stream_ = &fsm.channel_stream_;
+    } else if (element_name == kProgramme) {
+      fsm.parent_node_ = kProgramme;
+      fsm.stream_ = &fsm.programme_stream_;
     } else {
       return;
     }
+    auto attribute_name = (fsm.parent_node_ == KChannel) ? kId : KChannel;
+    std::string tvg_id =
+        fsm.get_attribute_value(attribute_name, num_attributes, attributes);
+    if (!fsm.playlist_.is_tvg_id_in_playlist(tvg_id)) return;
+    fsm.indentation_ = 1;
   } else if (fsm.state_ == State::kInsideNode) {
     fsm.indentation_++;
   }
   fsm.characters_.clear();
-  fsm.stream_ << '\n';
-  for (int i{}; i < fsm.indentation_; i++) fsm.stream_ << '\t';
-  fsm.stream_ << '<' << element_name;
+  *fsm.stream_ << '\n';
+  for (int i{}; i < fsm.indentation_; i++) *fsm.stream_ << '\t';
+  // Attribute values are passed with "&" as a reference but with "<" as it
+  // is, see unescape_attribute_value(), and a value that was quoted with
+  // apostrophes can contain quotation marks. libxml2 keeps the declarations
+  // of the internal subset in its document.
+  const auto document = static_cast<xmlParserCtxtPtr>(context)->myDoc;
+  fsm.escaped_.clear();
+  fsm.escaped_ += '<';
+  fsm.escaped_ += element_name;
   unsigned int index = 0;
   for (int i = 0; i < num_attributes; ++i, index += 5) {
     const xmlChar* localname = attributes[index];
     const xmlChar* valueBegin = attributes[index + 3];
     const xmlChar* valueEnd = attributes[index + 4];
-    std::string value((const char*)valueBegin, (const char*)valueEnd);
-    fsm.stream_ << ' ' << localname << R"(=")" << value << '"';
+    fsm.escaped_ += ' ';
+    fsm.escaped_ += reinterpret_cast<const char*>(localname);
+    fsm.escaped_ += R"(=")";
+    append_attribute_value({reinterpret_cast<const char*>(valueBegin),
+                            reinterpret_cast<const char*>(valueEnd)},
+                           document, fsm.escaped_);
+    fsm.escaped_ += '"';
   }
-  fsm.stream_ << '>';
+  fsm.escaped_ += '>';
+  *fsm.stream_ << fsm.escaped_;
   fsm.current_node_name_ = element_name;
   fsm.state_ = State::kInsideNode;
 }
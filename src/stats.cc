@@ -0,0 +1,195 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "json.h"
+#include "version.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+struct StageMetrics {
+  std::atomic<std::uint64_t> items{0};
+  std::atomic<std::uint64_t> bytes{0};
+  std::atomic<std::uint64_t> time_ns{0};
+};
+
+struct RingMetrics {
+  std::atomic<std::uint64_t> claim_waits{0};
+  std::atomic<std::uint64_t> claim_wait_ns{0};
+  std::atomic<std::uint64_t> publish_waits{0};
+  std::atomic<std::uint64_t> publish_wait_ns{0};
+  std::array<std::atomic<std::uint64_t>, Stats::kNumOccupancyBuckets>
+      occupancy{};
+};
+
+struct DownloadMetrics {
+  std::string url;
+  long status;
+  std::int64_t time_to_first_byte;
+  std::int64_t total_time;
+  std::uint64_t num_bytes;
+};
+
+static std::array<StageMetrics,
+                  static_cast<std::size_t>(Stats::Stage::kNumStages)>
+    stages;
+static std::array<RingMetrics,
+                  static_cast<std::size_t>(Stats::Ring::kNumRings)>
+    rings;
+static std::mutex downloads_mutex;
+static std::vector<DownloadMetrics> downloads;
+
+static constexpr std::array kStageNames{
+    "loader"sv,         "parser"sv,         "filter"sv,
+    "transformer"sv,    "populate_maps"sv,  "transform"sv,
+    "store_playlist"sv, "epg_load"sv,       "epg_index"sv,
+    "epg_output"sv};
+
+static constexpr std::array kRingNames{
+    "loader_parser"sv, "parser_filter"sv, "filter_transformer"sv};
+
+static_assert(kStageNames.size() ==
+              static_cast<std::size_t>(Stats::Stage::kNumStages));
+static_assert(kRingNames.size() ==
+              static_cast<std::size_t>(Stats::Ring::kNumRings));
+
+static std::uint64_t load(const std::atomic<std::uint64_t>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+static void add(std::atomic<std::uint64_t>& counter, std::uint64_t count) {
+  counter.fetch_add(count, std::memory_order_relaxed);
+}
+
+static std::uint64_t to_ns(Stats::Clock::duration time) {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+}
+
+static StageMetrics& get(Stats::Stage stage) {
+  return stages[static_cast<std::size_t>(stage)];
+}
+
+static RingMetrics& get(Stats::Ring ring) {
+  return rings[static_cast<std::size_t>(ring)];
+}
+
+void Stats::record_items(Stage stage, std::uint64_t count) noexcept {
+  add(get(stage).items, count);
+}
+
+void Stats::record_bytes(Stage stage, std::uint64_t count) noexcept {
+  add(get(stage).bytes, count);
+}
+
+void Stats::record_time(Stage stage, Clock::duration time) noexcept {
+  add(get(stage).time_ns, to_ns(time));
+}
+
+void Stats::record_claim_wait(Ring ring, Clock::duration time) noexcept {
+  auto& metrics = get(ring);
+  add(metrics.claim_waits, 1);
+  add(metrics.claim_wait_ns, to_ns(time));
+}
+
+void Stats::record_publish_wait(Ring ring, Clock::duration time,
+                                std::size_t num_available,
+                                std::size_t size) noexcept {
+  auto& metrics = get(ring);
+  add(metrics.publish_waits, 1);
+  add(metrics.publish_wait_ns, to_ns(time));
+  const auto bucket =
+      std::min((std::max<std::size_t>(num_available, 1) - 1) *
+                   kNumOccupancyBuckets / size,
+               kNumOccupancyBuckets - 1);
+  add(metrics.occupancy[bucket], 1);
+}
+
+std::string_view Stats::get_name(Stage stage) noexcept {
+  return kStageNames[static_cast<std::size_t>(stage)];
+}
+
+std::string_view Stats::get_name(Ring ring) noexcept {
+  return kRingNames[static_cast<std::size_t>(ring)];
+}
+
+void Stats::add_download(std::string_view url, long status,
+                         std::int64_t time_to_first_byte,
+                         std::int64_t total_time, std::uint64_t num_bytes) {
+  if (!is_enabled_) return;
+  std::lock_guard lock{downloads_mutex};
+  downloads.push_back(
+      {std::string{url}, status, time_to_first_byte, total_time, num_bytes});
+}
+
+// Busy time is the time in a stage less the time that the stage waited for
+// its rings as a producer or a consumer
+void Stats::write_json(std::ostream& stream) {
+  std::array<std::uint64_t, kStageNames.size()> blocked_ns{};
+  for (std::size_t r{0}; r < rings.size(); ++r) {
+    const auto ring = static_cast<Ring>(r);
+    blocked_ns[static_cast<std::size_t>(get_producer(ring))] +=
+        load(rings[r].claim_wait_ns);
+    blocked_ns[static_cast<std::size_t>(get_consumer(ring))] +=
+        load(rings[r].publish_wait_ns);
+  }
+  stream << "{\n  \"version\": \"" << kVersionMajor << '.' << kVersionMinor
+         << '.' << kVersionPatch << "\",\n  \"stages\": {";
+  for (std::size_t s{0}; s < stages.size(); ++s) {
+    const auto& metrics = stages[s];
+    const auto time_ns = load(metrics.time_ns);
+    const auto blocked = std::min(blocked_ns[s], time_ns);
+    stream << (s ? "," : "") << "\n    \"" << kStageNames[s]
+           << "\": {\"items\": " << load(metrics.items)
+           << ", \"bytes\": " << load(metrics.bytes)
+           << ", \"time_ns\": " << time_ns
+           << ", \"busy_ns\": " << time_ns - blocked
+           << ", \"blocked_ns\": " << blocked << '}';
+  }
+  stream << "\n  },\n  \"rings\": {";
+  for (std::size_t r{0}; r < rings.size(); ++r) {
+    const auto& metrics = rings[r];
+    stream << (r ? "," : "") << "\n    \"" << kRingNames[r]
+           << "\": {\"claim_waits\": " << load(metrics.claim_waits)
+           << ", \"claim_wait_ns\": " << load(metrics.claim_wait_ns)
+           << ", \"publish_waits\": " << load(metrics.publish_waits)
+           << ", \"publish_wait_ns\": " << load(metrics.publish_wait_ns)
+           << ", \"occupancy\": [";
+    for (std::size_t b{0}; b < metrics.occupancy.size(); ++b)
+      stream << (b ? ", " : "") << load(metrics.occupancy[b]);
+    stream << "]}";
+  }
+  stream << "\n  },\n  \"downloads\": [";
+  std::lock_guard lock{downloads_mutex};
+  for (std::size_t d{0}; d < downloads.size(); ++d) {
+    const auto& download = downloads[d];
+    const auto transfer_time =
+        download.total_time - download.time_to_first_byte;
+    const auto throughput =
+        (transfer_time > 0) ? download.num_bytes * 1'000'000 /
+                                  static_cast<std::uint64_t>(transfer_time)
+                            : 0;
+    stream << (d ? "," : "") << "\n    {\"url\": ";
+    write_json_string(stream, download.url);
+    stream << ", \"status\": " << download.status
+           << ", \"time_to_first_byte_us\": " << download.time_to_first_byte
+           << ", \"total_time_us\": " << download.total_time
+           << ", \"bytes\": " << download.num_bytes
+           << ", \"bytes_per_second\": " << throughput << '}';
+  }
+  stream << (downloads.empty() ? "]" : "\n  ]") << "\n}\n";
+}
+
+}  // namespace pefti
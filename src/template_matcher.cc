@@ -0,0 +1,272 @@
+#include "template_matcher.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "blob.h"
+#include "config.h"
+#include "normalizer.h"
+
+namespace pefti {
+
+static bool is_alphanumeric(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) != 0;
+}
+
+TemplateMatcher::TemplateMatcher(
+    const std::vector<ChannelTemplate>& templates) {
+  std::unordered_map<std::string, TermId> term_ids;
+  std::vector<std::string> terms;
+  //
+  // Returns the ID of a normalized term, adding the term if it is new
+  auto add_term = [&term_ids, &terms](std::string_view term) {
+    auto normalized_term = normalize_name(term);
+    auto [iter, is_new] = term_ids.try_emplace(
+        normalized_term, static_cast<TermId>(terms.size()));
+    if (is_new) terms.push_back(std::move(normalized_term));
+    return iter->second;
+  };
+  //
+  // Adds the terms of one template, a term that appears more than once
+  // in the same template only needs to be found once
+  auto add_terms = [&add_term](const std::vector<std::string>& ct_terms,
+                               std::vector<TermId>& ids,
+                               std::vector<std::uint32_t>& offsets) {
+    const auto first = ids.size();
+    for (const auto& term : ct_terms) ids.push_back(add_term(term));
+    std::sort(ids.begin() + first, ids.end());
+    ids.erase(std::unique(ids.begin() + first, ids.end()), ids.end());
+    offsets.push_back(static_cast<std::uint32_t>(ids.size()));
+  };
+  include_offsets_.push_back(0);
+  exclude_offsets_.push_back(0);
+  for (TemplateId t{0}; t < templates.size(); ++t) {
+    add_terms(templates[t].include, include_terms_, include_offsets_);
+    add_terms(templates[t].exclude, exclude_terms_, exclude_offsets_);
+    if (include_offsets_[t] == include_offsets_[t + 1])
+      unconditional_templates_.push_back(t);
+  }
+  //
+  // Inverted index from include terms to templates, postings are in
+  // template order
+  posting_offsets_.assign(terms.size() + 1, 0);
+  for (auto term : include_terms_) ++posting_offsets_[term + 1];
+  for (size_t i{1}; i < posting_offsets_.size(); ++i)
+    posting_offsets_[i] += posting_offsets_[i - 1];
+  postings_.resize(include_terms_.size());
+  std::vector<std::uint32_t> next_posting(posting_offsets_.begin(),
+                                          posting_offsets_.end() - 1);
+  for (TemplateId t{0}; t < templates.size(); ++t) {
+    for (auto i = include_offsets_[t]; i < include_offsets_[t + 1]; ++i)
+      postings_[next_posting[include_terms_[i]]++] = t;
+  }
+  build_automaton(terms);
+}
+
+// Builds a trie of the terms, then flattens it into arrays and adds the
+// failure and dictionary links.
+void TemplateMatcher::build_automaton(const std::vector<std::string>& terms) {
+  struct TrieNode {
+    std::map<unsigned char, std::uint32_t> children;
+    TermId term{kNone};
+  };
+  std::vector<TrieNode> trie(1);
+  term_lengths_.resize(terms.size());
+  for (TermId id{0}; id < terms.size(); ++id) {
+    const auto& term = terms[id];
+    term_lengths_[id] = static_cast<std::uint32_t>(term.size());
+    if (term.empty()) {
+      empty_term_ = id;
+      continue;
+    }
+    std::uint32_t node{0};
+    for (unsigned char c : term) {
+      auto [iter, is_new] = trie[node].children.try_emplace(
+          c, static_cast<std::uint32_t>(trie.size()));
+      if (is_new) trie.emplace_back();
+      node = iter->second;
+    }
+    trie[node].term = id;
+  }
+  const auto num_nodes = trie.size();
+  first_edge_.reserve(num_nodes + 1);
+  node_term_.reserve(num_nodes);
+  for (const auto& trie_node : trie) {
+    first_edge_.push_back(static_cast<std::uint32_t>(edge_bytes_.size()));
+    node_term_.push_back(trie_node.term);
+    for (const auto& [c, child] : trie_node.children) {
+      edge_bytes_.push_back(c);
+      edge_targets_.push_back(child);
+    }
+  }
+  first_edge_.push_back(static_cast<std::uint32_t>(edge_bytes_.size()));
+  //
+  // Breadth-first traversal so that the links of shallower nodes are
+  // available when computing the links of deeper nodes
+  fail_.assign(num_nodes, 0);
+  dictionary_link_.assign(num_nodes, kNone);
+  root_next_.fill(0);
+  std::deque<std::uint32_t> queue;
+  for (auto e = first_edge_[0]; e < first_edge_[1]; ++e) {
+    root_next_[edge_bytes_[e]] = edge_targets_[e];
+    queue.push_back(edge_targets_[e]);
+  }
+  while (!queue.empty()) {
+    const auto node = queue.front();
+    queue.pop_front();
+    for (auto e = first_edge_[node]; e < first_edge_[node + 1]; ++e) {
+      const auto child = edge_targets_[e];
+      const auto fail = next_state(fail_[node], edge_bytes_[e]);
+      fail_[child] = fail;
+      dictionary_link_[child] =
+          (node_term_[fail] != kNone) ? fail : dictionary_link_[fail];
+      queue.push_back(child);
+    }
+  }
+}
+
+std::uint32_t TemplateMatcher::find_child(std::uint32_t node,
+                                          unsigned char c) const {
+  const auto begin = edge_bytes_.begin() + first_edge_[node];
+  const auto end = edge_bytes_.begin() + first_edge_[node + 1];
+  const auto iter = std::lower_bound(begin, end, c);
+  if (iter == end || *iter != c) return kNone;
+  return edge_targets_[iter - edge_bytes_.begin()];
+}
+
+std::uint32_t TemplateMatcher::next_state(std::uint32_t node,
+                                          unsigned char c) const {
+  while (node != 0) {
+    const auto child = find_child(node, c);
+    if (child != kNone) return child;
+    node = fail_[node];
+  }
+  return root_next_[c];
+}
+
+// Finds the terms that are contained in `name`. The original matcher used
+// std::string::find, so only the first occurrence of each term is checked
+// for word boundaries.
+void TemplateMatcher::find_satisfied_terms(
+    std::string_view name, std::vector<TermId>& satisfied) const {
+  struct Hit {
+    TermId term;
+    std::uint32_t position;
+  };
+  std::vector<Hit> hits;
+  std::uint32_t state{0};
+  for (std::uint32_t i{0}; i < name.size(); ++i) {
+    state = next_state(state, name[i]);
+    auto node = (node_term_[state] != kNone) ? state : dictionary_link_[state];
+    for (; node != kNone; node = dictionary_link_[node]) {
+      const auto term = node_term_[node];
+      hits.push_back({term, i + 1 - term_lengths_[term]});
+    }
+  }
+  // Hits for the same term are found in order of position
+  std::stable_sort(hits.begin(), hits.end(),
+                   [](const Hit& lhs, const Hit& rhs) {
+                     return lhs.term < rhs.term;
+                   });
+  for (size_t i{0}; i < hits.size(); ++i) {
+    if (i > 0 && hits[i].term == hits[i - 1].term) continue;
+    const auto pos = hits[i].position;
+    const auto end = pos + term_lengths_[hits[i].term];
+    const bool char_before_is_alphanumeric{
+        (pos != 0) && is_alphanumeric(name[pos - 1])};
+    const bool char_after_is_alphanumeric{
+        (end < name.size()) && is_alphanumeric(name[end])};
+    if (!char_before_is_alphanumeric && !char_after_is_alphanumeric)
+      satisfied.push_back(hits[i].term);
+  }
+  if (empty_term_ != kNone && (name.empty() || !is_alphanumeric(name[0])))
+    satisfied.push_back(empty_term_);
+  std::sort(satisfied.begin(), satisfied.end());
+}
+
+std::optional<TemplateMatcher::TemplateId> TemplateMatcher::match(
+    std::string_view normalized_name) const {
+  if (include_offsets_.size() <= 1) return std::nullopt;
+  std::vector<TermId> satisfied;
+  find_satisfied_terms(normalized_name, satisfied);
+  //
+  // A template is a candidate when all of its include terms were found
+  std::vector<TemplateId> hits;
+  for (auto term : satisfied) {
+    hits.insert(hits.end(), postings_.begin() + posting_offsets_[term],
+                postings_.begin() + posting_offsets_[term + 1]);
+  }
+  std::sort(hits.begin(), hits.end());
+  std::vector<TemplateId> candidates(unconditional_templates_);
+  for (size_t i{0}, run_end{0}; i < hits.size(); i = run_end) {
+    const auto t = hits[i];
+    run_end = i;
+    while (run_end < hits.size() && hits[run_end] == t) ++run_end;
+    if (run_end - i == include_offsets_[t + 1] - include_offsets_[t])
+      candidates.push_back(t);
+  }
+  std::sort(candidates.begin(), candidates.end());
+  //
+  // First match wins
+  auto is_satisfied = [&satisfied](TermId term) {
+    return std::binary_search(satisfied.begin(), satisfied.end(), term);
+  };
+  for (auto t : candidates) {
+    const auto begin = exclude_terms_.begin() + exclude_offsets_[t];
+    const auto end = exclude_terms_.begin() + exclude_offsets_[t + 1];
+    if (std::none_of(begin, end, is_satisfied)) return t;
+  }
+  return std::nullopt;
+}
+
+void TemplateMatcher::load(BlobReader& reader) {
+  reader.read_array(first_edge_);
+  reader.read_array(edge_bytes_);
+  reader.read_array(edge_targets_);
+  reader.read_array(fail_);
+  reader.read_array(node_term_);
+  reader.read_array(dictionary_link_);
+  const auto root_next = reader.view_array<std::uint32_t>();
+  if (root_next.size() != root_next_.size())
+    throw std::runtime_error("Invalid template matcher in cached data");
+  std::copy(root_next.begin(), root_next.end(), root_next_.begin());
+  reader.read_array(term_lengths_);
+  empty_term_ = reader.read<TermId>();
+  reader.read_array(include_offsets_);
+  reader.read_array(include_terms_);
+  reader.read_array(exclude_offsets_);
+  reader.read_array(exclude_terms_);
+  reader.read_array(posting_offsets_);
+  reader.read_array(postings_);
+  reader.read_array(unconditional_templates_);
+}
+
+void TemplateMatcher::save(BlobWriter& writer) const {
+  writer.write_array<std::uint32_t>(first_edge_);
+  writer.write_array<unsigned char>(edge_bytes_);
+  writer.write_array<std::uint32_t>(edge_targets_);
+  writer.write_array<std::uint32_t>(fail_);
+  writer.write_array<TermId>(node_term_);
+  writer.write_array<std::uint32_t>(dictionary_link_);
+  writer.write_array<std::uint32_t>(root_next_);
+  writer.write_array<std::uint32_t>(term_lengths_);
+  writer.write(empty_term_);
+  writer.write_array<std::uint32_t>(include_offsets_);
+  writer.write_array<TermId>(include_terms_);
+  writer.write_array<std::uint32_t>(exclude_offsets_);
+  writer.write_array<TermId>(exclude_terms_);
+  writer.write_array<std::uint32_t>(posting_offsets_);
+  writer.write_array<TemplateId>(postings_);
+  writer.write_array<TemplateId>(unconditional_templates_);
+}
+
+}  // namespace pefti
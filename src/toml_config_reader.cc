@@ -5,6 +5,7 @@
 #include "toml_config_reader.h"
 
 #include <exception>
+#include <fstream>
 #include <gsl/gsl>
 #include <ranges>
 #include <sstream>
@@ -17,12 +18,17 @@ using namespace std::literals;
 
 namespace pefti {
 
-TomlConfigReader::TomlConfigReader(std::string& filename) {
-  toml_config_ = toml::parse_file(filename);
+TomlConfigReader::TomlConfigReader(std::string& filename)
+    : filename_(filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) throw std::runtime_error(filename + ": failed to open"s);
+  std::ostringstream stream;
+  stream << file.rdbuf();
+  source_ = std::move(stream).str();
 }
 
 void TomlConfigReader::check_required_element(std::string_view path) {
-  auto node = toml_config_[toml::path{path}];
+  auto node = get_table()[toml::path{path}];
   if (!node) {
     std::ostringstream stream;
     stream << path << ": missing from config"s;
@@ -30,4 +36,9 @@ void TomlConfigReader::check_required_element(std::string_view path) {
   }
 }
 
+toml::table& TomlConfigReader::get_table() {
+  if (!toml_config_) toml_config_ = toml::parse(source_, filename_);
+  return *toml_config_;
+}
+
 }  // namespace pefti
@@ -0,0 +1,215 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "json.h"
+
+using namespace std::literals;
+
+namespace pefti {
+
+// A run is one process
+static constexpr int kProcessId{1};
+
+static constexpr std::array kClaimNames{"claim loader_parser"sv,
+                                        "claim parser_filter"sv,
+                                        "claim filter_transformer"sv};
+static constexpr std::array kWaitNames{"wait loader_parser"sv,
+                                       "wait parser_filter"sv,
+                                       "wait filter_transformer"sv};
+
+static_assert(kClaimNames.size() ==
+              static_cast<std::size_t>(Stats::Ring::kNumRings));
+static_assert(kWaitNames.size() ==
+              static_cast<std::size_t>(Stats::Ring::kNumRings));
+
+struct TraceEvent {
+  enum class Kind { kSpan, kThreadSpan, kDownload };
+  Kind kind;
+  std::string_view name;
+  std::string_view category;
+  std::uint64_t id;
+  std::uint32_t source;
+  std::uint32_t start_thread;
+  std::uint32_t end_thread;
+  Trace::Clock::time_point start;
+  Trace::Clock::time_point end;
+  std::string url;
+};
+
+// The events recorded by one thread. A deque does not move the events that
+// are already recorded when it grows.
+struct ThreadBuffer {
+  std::uint32_t thread_id;
+  std::deque<TraceEvent> events;
+};
+
+static Trace::Clock::time_point start_time;
+static std::atomic<std::uint32_t> next_thread_id{1};
+static std::atomic<std::uint64_t> next_download_id{0};
+static std::mutex buffers_mutex;
+// The buffers are owned here rather than by their threads, so the events of
+// the threads of a thread pool outlive the pool
+static std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+static thread_local ThreadBuffer* thread_buffer{nullptr};
+static thread_local std::uint32_t thread_id{0};
+
+static ThreadBuffer& get_buffer() {
+  if (!thread_buffer) {
+    auto buffer = std::make_unique<ThreadBuffer>();
+    buffer->thread_id = Trace::get_thread_id();
+    std::lock_guard lock{buffers_mutex};
+    thread_buffer = buffers.emplace_back(std::move(buffer)).get();
+  }
+  return *thread_buffer;
+}
+
+// The spans of a stage of a source share an async track
+static std::uint64_t get_track_id(Trace::Stage stage, std::uint32_t source) {
+  return std::uint64_t{source} *
+             static_cast<std::uint64_t>(Trace::Stage::kNumStages) +
+         static_cast<std::uint64_t>(stage);
+}
+
+static void write_microseconds(std::ostream& stream,
+                               std::chrono::nanoseconds time) {
+  const auto ns = std::max<long long>(time.count(), 0);
+  std::array<char, 32> text;
+  std::snprintf(text.data(), text.size(), "%lld.%03lld", ns / 1000,
+                ns % 1000);
+  stream << text.data();
+}
+
+// Timestamps are in microseconds since the trace was enabled
+static void write_timestamp(std::ostream& stream,
+                            Trace::Clock::time_point time) {
+  write_microseconds(stream, time - start_time);
+}
+
+static void write_event(std::ostream& stream, const TraceEvent& event) {
+  stream << "{\"name\": ";
+  write_json_string(stream, event.name);
+  stream << ", \"cat\": ";
+  write_json_string(stream, event.category);
+  if (event.kind == TraceEvent::Kind::kThreadSpan) {
+    stream << ", \"ph\": \"X\", \"pid\": " << kProcessId
+           << ", \"tid\": " << event.start_thread << ", \"ts\": ";
+    write_timestamp(stream, event.start);
+    stream << ", \"dur\": ";
+    write_microseconds(stream, event.end - event.start);
+    stream << ", \"args\": {\"source\": " << event.source << "}}";
+    return;
+  }
+  // An async span is a begin and an end event, which can be on different
+  // threads
+  stream << ", \"ph\": \"b\", \"id\": " << event.id
+         << ", \"pid\": " << kProcessId << ", \"tid\": " << event.start_thread
+         << ", \"ts\": ";
+  write_timestamp(stream, event.start);
+  stream << ", \"args\": {";
+  if (event.kind == TraceEvent::Kind::kDownload) {
+    stream << "\"url\": ";
+    write_json_string(stream, event.url);
+  } else {
+    stream << "\"source\": " << event.source
+           << ", \"start_thread\": " << event.start_thread
+           << ", \"end_thread\": " << event.end_thread;
+  }
+  stream << "}},\n{\"name\": ";
+  write_json_string(stream, event.name);
+  stream << ", \"cat\": ";
+  write_json_string(stream, event.category);
+  stream << ", \"ph\": \"e\", \"id\": " << event.id
+         << ", \"pid\": " << kProcessId << ", \"tid\": " << event.end_thread
+         << ", \"ts\": ";
+  write_timestamp(stream, event.end);
+  stream << '}';
+}
+
+void Trace::enable() noexcept {
+  start_time = Clock::now();
+  is_enabled_ = true;
+}
+
+std::uint32_t Trace::get_thread_id() noexcept {
+  if (thread_id == 0)
+    thread_id = next_thread_id.fetch_add(1, std::memory_order_relaxed);
+  return thread_id;
+}
+
+void Trace::add_span(Stage stage, std::uint32_t source,
+                     std::string_view name, Clock::time_point start,
+                     Clock::time_point end, std::uint32_t start_thread) {
+  get_buffer().events.push_back({TraceEvent::Kind::kSpan, name,
+                                 Stats::get_name(stage),
+                                 get_track_id(stage, source), source,
+                                 start_thread, get_thread_id(), start, end,
+                                 {}});
+}
+
+void Trace::add_thread_span(std::string_view name, std::uint32_t source,
+                            Clock::time_point start, Clock::time_point end) {
+  const auto thread = get_thread_id();
+  get_buffer().events.push_back({TraceEvent::Kind::kThreadSpan, name,
+                                 "thread"sv, 0, source, thread, thread, start,
+                                 end, {}});
+}
+
+void Trace::add_ring_wait(Stats::Ring ring, bool is_claim,
+                          std::uint32_t source, Clock::time_point start,
+                          Clock::time_point end, std::uint32_t start_thread) {
+  if (!is_enabled_) return;
+  const auto index = static_cast<std::size_t>(ring);
+  if (is_claim) {
+    add_span(Stats::get_producer(ring), source, kClaimNames[index], start,
+             end, start_thread);
+  } else {
+    add_span(Stats::get_consumer(ring), source, kWaitNames[index], start,
+             end, start_thread);
+  }
+}
+
+// Each download has a track of its own, they overlap on the thread that
+// runs them
+void Trace::add_download(std::string_view url, Clock::time_point start,
+                         Clock::time_point end) {
+  if (!is_enabled_) return;
+  const auto thread = get_thread_id();
+  get_buffer().events.push_back(
+      {TraceEvent::Kind::kDownload, "download"sv, "download"sv,
+       next_download_id.fetch_add(1, std::memory_order_relaxed), 0, thread,
+       thread, start, end, std::string{url}});
+}
+
+void Trace::write_json(std::ostream& stream) {
+  std::lock_guard lock{buffers_mutex};
+  stream << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+         << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": "
+         << kProcessId << ", \"args\": {\"name\": \"pefti\"}}";
+  for (const auto& buffer : buffers) {
+    stream << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": "
+           << kProcessId << ", \"tid\": " << buffer->thread_id
+           << ", \"args\": {\"name\": \"thread " << buffer->thread_id
+           << "\"}}";
+    for (const auto& event : buffer->events) {
+      stream << ",\n";
+      write_event(stream, event);
+    }
+  }
+  stream << "\n]}\n";
+}
+
+}  // namespace pefti
@@ -3,40 +3,62 @@
 #include <algorithm>
 #include <cppcoro/static_thread_pool.hpp>
 #include <cppcoro/task.hpp>
-#include <execution>
+#include <cppcoro/when_all.hpp>
 #include <vector>
 
 #include "config.h"
 #include "iptv_channel.h"
 #include "playlist.h"
+#include "stats.h"
+#include "trace.h"
 
 using namespace std::literals;
 
 namespace pefti {
 
-void Transformer::transform() {
-  if (config_.get_num_channels_templates() > 0) {
-    copy_group_title_tag();
-    order_by_sort_criteria();
+// The templates are independent of each other, so they are split into
+// contiguous ranges that are transformed concurrently on the thread pool.
+cppcoro::task<> Transformer::transform(cppcoro::static_thread_pool& tp) {
+  const IptvChannel::TemplateId num_templates =
+      config_.get_num_channels_templates();
+  if (num_templates == 0) co_return;
+  const IptvChannel::TemplateId num_tasks =
+      std::min<IptvChannel::TemplateId>(tp.thread_count(), num_templates);
+  std::vector<cppcoro::task<>> tasks;
+  tasks.reserve(num_tasks);
+  for (IptvChannel::TemplateId i{0}; i < num_tasks; ++i) {
+    tasks.push_back(transform_templates(tp, num_templates * i / num_tasks,
+                                        num_templates * (i + 1) / num_tasks));
   }
+  co_await cppcoro::when_all(std::move(tasks));
 }
 
+// The Filter has already resolved the template of each channel
 cppcoro::task<> Transformer::transform(
     cppcoro::static_thread_pool& tp, PlaylistFilterTransformerBuffer& buffer) {
+  const Stats::Timer timer(Stats::Stage::kTransformer);
+  const Trace::Span span(Trace::Stage::kTransformer, buffer.source_id);
   const auto kIndexMask = buffer.get_index_mask();
   size_t read_index{0};
   bool received_sentinel{false};
   while (!received_sentinel) {
     const size_t write_index =
-        co_await buffer.sequencer.wait_until_published(read_index, tp);
+        co_await buffer.wait_until_published(read_index, tp);
+    const Trace::Span batch_span(Trace::Stage::kTransformer, buffer.source_id,
+                                 "batch"sv);
     do {
       auto& channel = buffer.data[read_index & kIndexMask];
       const bool is_sentinel = channel.get_original_name() == kSentinel;
       if (!is_sentinel) {
-        copy_tags(channel);
         block_tags(channel);
-        set_name(channel);
-        co_await playlist_.push_back(std::move(channel));
+        if (channel.has_template()) {
+          const auto template_id = channel.get_template_id();
+          channel.set_tags(config_.get_tag_patch(template_id));
+          channel.set_quality_rank(
+              config_.get_quality_rank(channel.get_normalized_name()));
+          set_name(channel, config_.get_channel_template(template_id));
+        }
+        co_await playlist_.push_back(std::move(channel), buffer.source_id);
       } else {
         received_sentinel = true;
         break;
@@ -44,70 +66,38 @@ cppcoro::task<> Transformer::transform(
     } while (read_index++ != write_index);
     buffer.barrier.publish(read_index);
   }
+  Stats::add_items(Stats::Stage::kTransformer, read_index);
 }
 
 void Transformer::block_tags(IptvChannel& channel) {
   for (auto tag : config_.get_blocked_tags()) channel.delete_tag(tag);
 }
 
-// If enabled in the configuration, channels without a group-title tag entry
-// in the channel template will use the group-title from the previous template
-// in the channel templates list.
-void Transformer::copy_group_title_tag() {
-  if (!config_.get_copy_group_title_flag()) return;
-  std::string_view previous_group_title = ""sv;
-  auto channels_templates = config_.get_channels_templates();
-  for (auto& ct : channels_templates) {
-    auto group_title = previous_group_title;
-    for (auto& tag : ct.tags) {
-      if (tag.first == IptvChannel::kTagGroupTitle) {
-        group_title = tag.second;
-        break;
-      }
-    }
-    previous_group_title = group_title;
-    auto& channels = channels_mapper_.map_template_to_channel(ct);
-    for (auto channel : channels)
-      channel->set_tag(IptvChannel::kTagGroupTitle, group_title);
-  }
+// The channels in the playlist are not moved, the indexes of the channels in
+// channels_mapper are moved. The quality ranks were computed while streaming,
+// a stable sort keeps channels of equal rank in playlist order.
+void Transformer::order_by_sort_criteria(
+    std::vector<ChannelsMapper::ChannelIndex>& channels) {
+  std::ranges::stable_sort(
+      channels, {}, [this](ChannelsMapper::ChannelIndex channel) {
+        return playlist_.get_quality_rank(channel);
+      });
 }
 
-void Transformer::copy_tags(IptvChannel& channel) {
-  if (channels_mapper_.is_allowed_channel(channel))
-    channel.set_tags(channels_mapper_.get_channel_template(channel).tags);
+void Transformer::set_name(IptvChannel& channel,
+                           const ChannelTemplate& channel_template) {
+  channel.set_new_name(channel_template.new_name);
 }
 
-// The channels in the playlist are not moved, pointers to the channels in
-// channels_mapper are moved.
-void Transformer::order_by_sort_criteria() {
-  auto channels_templates = config_.get_channels_templates();
-  const auto sort_qualities = config_.get_sort_qualities();
-  for (auto& ct : channels_templates) {
-    auto& channels = channels_mapper_.map_template_to_channel(ct);
-    // Construct map
-    std::unordered_map<IptvChannel*, int> channel_to_priority_map;
-    for (auto channel : channels) {
-      auto& name = channel->get_original_name();
-      int i{};
-      for (auto quality : sort_qualities) {
-        if (name.find(quality) != std::string::npos) {
-          break;
-        }
-        ++i;
-      }
-      channel_to_priority_map[channel] = i;
-    }
-    std::ranges::sort(channels, [&channel_to_priority_map](IptvChannel* lhs,
-                                                           IptvChannel* rhs) {
-      return channel_to_priority_map[lhs] < channel_to_priority_map[rhs];
-    });
+// Transforms the templates in [begin, end) on a thread of the pool
+cppcoro::task<> Transformer::transform_templates(
+    cppcoro::static_thread_pool& tp, IptvChannel::TemplateId begin,
+    IptvChannel::TemplateId end) {
+  co_await tp.schedule();
+  for (auto template_id = begin; template_id < end; ++template_id) {
+    order_by_sort_criteria(
+        channels_mapper_.map_template_to_channel(template_id));
   }
 }
 
-void Transformer::set_name(IptvChannel& channel) {
-  if (channels_mapper_.is_allowed_channel(channel))
-    channel.set_new_name(
-        channels_mapper_.get_channel_template(channel).new_name);
-}
-
 }  // namespace pefti
@@ -0,0 +1,295 @@
+#include "xmltv_scanner.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+using namespace std::literals;
+
+namespace pefti {
+
+static constexpr auto kRoot = "tv"sv;
+static constexpr auto kChannel = "channel"sv;
+static constexpr auto kProgramme = "programme"sv;
+static constexpr auto kId = "id"sv;
+static constexpr auto kStart = "start"sv;
+static constexpr auto kStop = "stop"sv;
+
+// Character classes, looked up in a table because the scanner tests every
+// byte of names and attribute values
+enum CharClass : std::uint8_t {
+  kWhitespace = 1,
+  kEndOfName = 2,
+  // Characters that libxml2 would replace in attribute values
+  kReplacedInValue = 4,
+};
+
+static constexpr auto kCharClasses = []() {
+  std::array<std::uint8_t, 256> classes{};
+  for (unsigned char c : " \t\n\r"sv) classes[c] |= kWhitespace | kEndOfName;
+  for (unsigned char c : "\t\n\r&<"sv) classes[c] |= kReplacedInValue;
+  for (unsigned char c : "/>="sv) classes[c] |= kEndOfName;
+  return classes;
+}();
+
+static bool is_class(char c, CharClass char_class) {
+  return (kCharClasses[static_cast<unsigned char>(c)] & char_class) != 0;
+}
+
+static bool is_whitespace(char c) { return is_class(c, kWhitespace); }
+
+// Returns whether `name`, the text between '&' and ';', is a predefined
+// entity or a reference to a character that XML allows
+static bool is_valid_reference(std::string_view name) {
+  if (name == "lt"sv || name == "gt"sv || name == "amp"sv ||
+      name == "quot"sv || name == "apos"sv)
+    return true;
+  if (!name.starts_with('#')) return false;
+  name.remove_prefix(1);
+  const bool is_hexadecimal{name.starts_with('x')};
+  if (is_hexadecimal) name.remove_prefix(1);
+  if (name.empty()) return false;
+  std::uint32_t code{0};
+  for (const char c : name) {
+    std::uint32_t digit;
+    if (c >= '0' && c <= '9')
+      digit = c - '0';
+    else if (is_hexadecimal && c >= 'a' && c <= 'f')
+      digit = c - 'a' + 10;
+    else if (is_hexadecimal && c >= 'A' && c <= 'F')
+      digit = c - 'A' + 10;
+    else
+      return false;
+    code = code * (is_hexadecimal ? 16 : 10) + digit;
+    if (code > 0x10FFFF) return false;
+  }
+  return code == 0x9 || code == 0xA || code == 0xD ||
+         (code >= 0x20 && code <= 0xD7FF) ||
+         (code >= 0xE000 && code <= 0xFFFD) || code >= 0x10000;
+}
+
+// Returns whether every '&' in `text` starts a valid reference
+static bool has_valid_references(std::string_view text) {
+  auto ampersand = text.find('&');
+  while (ampersand != std::string_view::npos) {
+    const auto semicolon = text.find(';', ampersand + 1);
+    if (semicolon == std::string_view::npos) return false;
+    if (!is_valid_reference(
+            text.substr(ampersand + 1, semicolon - ampersand - 1)))
+      return false;
+    ampersand = text.find('&', semicolon + 1);
+  }
+  return true;
+}
+
+XmltvScanner::Result XmltvScanner::next(Element& element) {
+  bool is_empty{false};
+  if (state_ == State::kProlog) {
+    if (!skip_misc()) return Result::kUnsupported;
+    if (is_at("<!DOCTYPE"sv)) {
+      // An internal subset could declare entities
+      const auto end = find('>', position_);
+      if (end == std::string_view::npos) return Result::kUnsupported;
+      if (document_.substr(position_, end - position_).find('[') !=
+          std::string_view::npos)
+        return Result::kUnsupported;
+      position_ = end + 1;
+      if (!skip_misc()) return Result::kUnsupported;
+    }
+    const auto root_offset = position_;
+    if (!is_at("<"sv)) return Result::kUnsupported;
+    ++position_;
+    if (scan_name() != kRoot) return Result::kUnsupported;
+    prolog_ = document_.substr(prolog_begin_, root_offset - prolog_begin_);
+    if (!scan_start_tag(nullptr, is_empty)) return Result::kUnsupported;
+    state_ = State::kContent;
+    if (is_empty) {
+      if (!skip_misc() || position_ != document_.size())
+        return Result::kUnsupported;
+      state_ = State::kEnd;
+    }
+  }
+  if (state_ == State::kEnd) return Result::kEnd;
+  while (true) {
+    skip_whitespace();
+    // Text in the root element is not supported
+    if (!is_at("<"sv)) return Result::kUnsupported;
+    if (is_at("<!--"sv)) {
+      if (!skip_past("-->"sv)) return Result::kUnsupported;
+      continue;
+    }
+    if (is_at("</"sv)) {
+      position_ += 2;
+      if (scan_name() != kRoot) return Result::kUnsupported;
+      skip_whitespace();
+      if (!is_at(">"sv)) return Result::kUnsupported;
+      ++position_;
+      if (!skip_misc() || position_ != document_.size())
+        return Result::kUnsupported;
+      state_ = State::kEnd;
+      return Result::kEnd;
+    }
+    const auto offset = position_;
+    ++position_;
+    const auto name = scan_name();
+    if (name != kChannel && name != kProgramme) return Result::kUnsupported;
+    element = {};
+    element.offset = offset;
+    element.is_programme = (name == kProgramme);
+    if (!scan_start_tag(&element, is_empty)) return Result::kUnsupported;
+    if (!is_empty && !scan_element_content(name)) return Result::kUnsupported;
+    element.size = position_ - offset;
+    return Result::kElement;
+  }
+}
+
+// memchr() is vectorised by the common C libraries, so this is where the
+// scanner spends most of its time on large EPGs
+std::size_t XmltvScanner::find(char c, std::size_t position) const noexcept {
+  if (position >= document_.size()) return std::string_view::npos;
+  const auto begin = document_.data() + position;
+  const auto found = static_cast<const char*>(
+      std::memchr(begin, c, document_.size() - position));
+  return found ? std::size_t(found - document_.data())
+               : std::string_view::npos;
+}
+
+bool XmltvScanner::is_at(std::string_view text) const noexcept {
+  return document_.size() - position_ >= text.size() &&
+         std::memcmp(document_.data() + position_, text.data(),
+                     text.size()) == 0;
+}
+
+std::string_view XmltvScanner::scan_name() {
+  const auto begin = position_;
+  while (position_ < document_.size() &&
+         !is_class(document_[position_], kEndOfName))
+    ++position_;
+  return document_.substr(begin, position_ - begin);
+}
+
+// Scans to the end of the end tag of the element. Only '<' needs to be
+// looked for, because attribute values cannot contain '<'. Text may only
+// contain predefined entities and character references, and the end tags of
+// nested elements must match their start tags. Comments, CDATA sections and
+// processing instructions are not supported.
+bool XmltvScanner::scan_element_content(std::string_view name) {
+  open_elements_.clear();
+  open_elements_.push_back(name);
+  while (true) {
+    const auto tag = find('<', position_);
+    if (tag == std::string_view::npos) return false;
+    const auto text = document_.substr(position_, tag - position_);
+    if (!has_valid_references(text) ||
+        text.find("]]>"sv) != std::string_view::npos)
+      return false;
+    position_ = tag + 1;
+    if (position_ >= document_.size()) return false;
+    const char c = document_[position_];
+    if (c == '!' || c == '?') return false;
+    if (c == '/') {
+      ++position_;
+      if (scan_name() != open_elements_.back()) return false;
+      skip_whitespace();
+      if (!is_at(">"sv)) return false;
+      ++position_;
+      open_elements_.pop_back();
+      if (open_elements_.empty()) return true;
+      continue;
+    }
+    const auto inner_name = scan_name();
+    if (inner_name.empty()) return false;
+    bool is_empty{false};
+    if (!scan_start_tag(nullptr, is_empty)) return false;
+    if (!is_empty) open_elements_.push_back(inner_name);
+  }
+}
+
+// Scans the attributes of a start tag up to and including its '>' or "/>".
+// The attributes of interest are stored in `element` if it is not null.
+bool XmltvScanner::scan_start_tag(Element* element, bool& is_empty) {
+  attribute_names_.clear();
+  while (true) {
+    skip_whitespace();
+    if (is_at(">"sv)) {
+      ++position_;
+      is_empty = false;
+      return true;
+    }
+    if (is_at("/>"sv)) {
+      position_ += 2;
+      is_empty = true;
+      return true;
+    }
+    const auto name = scan_name();
+    if (name.empty() || std::ranges::find(attribute_names_, name) !=
+                            attribute_names_.end())
+      return false;
+    attribute_names_.push_back(name);
+    skip_whitespace();
+    if (!is_at("="sv)) return false;
+    ++position_;
+    skip_whitespace();
+    if (position_ >= document_.size()) return false;
+    const char quote = document_[position_];
+    if (quote != '"' && quote != '\'') return false;
+    const auto end = find(quote, position_ + 1);
+    if (end == std::string_view::npos) return false;
+    const auto value = document_.substr(position_ + 1, end - position_ - 1);
+    position_ = end + 1;
+    // The values of other elements are not indexed and only need to be
+    // well-formed
+    if (!element) {
+      if (value.find('<') != std::string_view::npos ||
+          !has_valid_references(value))
+        return false;
+      continue;
+    }
+    // libxml2 replaces references and normalizes whitespace in values
+    if (std::ranges::any_of(value, [](char c) {
+          return is_class(c, kReplacedInValue);
+        }))
+      return false;
+    if (element->is_programme) {
+      if (name == kChannel)
+        element->channel_id = value;
+      else if (name == kStart)
+        element->start = value;
+      else if (name == kStop)
+        element->stop = value;
+    } else if (name == kId) {
+      element->channel_id = value;
+    }
+  }
+}
+
+// Skips whitespace, comments and processing instructions
+bool XmltvScanner::skip_misc() {
+  while (true) {
+    skip_whitespace();
+    if (is_at("<!--"sv)) {
+      if (!skip_past("-->"sv)) return false;
+    } else if (is_at("<?"sv)) {
+      if (!skip_past("?>"sv)) return false;
+    } else {
+      return true;
+    }
+  }
+}
+
+bool XmltvScanner::skip_past(std::string_view text) {
+  const auto end = document_.find(text, position_);
+  if (end == std::string_view::npos) return false;
+  position_ = end + text.size();
+  return true;
+}
+
+void XmltvScanner::skip_whitespace() noexcept {
+  while (position_ < document_.size() && is_whitespace(document_[position_]))
+    ++position_;
+}
+
+}  // namespace pefti
@@ -0,0 +1,66 @@
+#include "xmltv_time.h"
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace pefti {
+
+// Parses `num_digits` digits at `pos`, returns -1 if they are not digits
+static int parse_digits(std::string_view text, std::size_t pos,
+                        std::size_t num_digits) noexcept {
+  if (pos + num_digits > text.size()) return -1;
+  int value{0};
+  for (std::size_t i{pos}; i < pos + num_digits; ++i) {
+    if (text[i] < '0' || text[i] > '9') return -1;
+    value = value * 10 + (text[i] - '0');
+  }
+  return value;
+}
+
+// Returns the number of days from 1970-01-01 to a date in the proleptic
+// Gregorian calendar
+static std::int64_t days_from_civil(int year, int month, int day) noexcept {
+  year -= month <= 2;
+  const std::int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int year_of_era = year - static_cast<int>(era * 400);
+  const int day_of_year =
+      (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const int day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+std::optional<std::int64_t> parse_xmltv_time(std::string_view text) noexcept {
+  const int year = parse_digits(text, 0, 4);
+  if (year < 0) return std::nullopt;
+  std::size_t pos{4};
+  // Month, day, hours, minutes and seconds are optional, in that order
+  int fields[5]{1, 1, 0, 0, 0};
+  for (auto& field : fields) {
+    const int value = parse_digits(text, pos, 2);
+    if (value < 0) break;
+    field = value;
+    pos += 2;
+  }
+  const auto [month, day, hours, minutes, seconds] = fields;
+  if (month < 1 || month > 12 || day < 1 || day > 31 || hours > 23 ||
+      minutes > 59 || seconds > 60)
+    return std::nullopt;
+  std::int64_t time = days_from_civil(year, month, day) * 86400 +
+                      hours * 3600 + minutes * 60 + seconds;
+  while (pos < text.size() && text[pos] == ' ') ++pos;
+  if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+    const int offset = parse_digits(text, pos + 1, 4);
+    if (offset < 0) return std::nullopt;
+    const int offset_seconds = (offset / 100) * 3600 + (offset % 100) * 60;
+    time -= (text[pos] == '+') ? offset_seconds : -offset_seconds;
+    pos += 5;
+  }
+  // Anything after the date and time zone other than spaces is not valid
+  while (pos < text.size() && text[pos] == ' ') ++pos;
+  if (pos < text.size()) return std::nullopt;
+  return time;
+}
+
+}  // namespace pefti
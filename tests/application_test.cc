@@ -0,0 +1,89 @@
+#include "application.h"
+
+#include <gtest/gtest.h>
+
+#include <cppcoro/static_thread_pool.hpp>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "generators.h"
+#include "http_client.h"
+#include "upstream_server.h"
+
+using namespace std::literals;
+namespace fs = std::filesystem;
+
+namespace pefti {
+namespace {
+
+// A playlist and an EPG served by an UpstreamServer, and a configuration
+// in a new directory without snapshots. The playlist can fail, the EPG
+// cannot.
+class ApplicationTest : public testing::Test {
+ protected:
+  ApplicationTest()
+      : directory_(fs::temp_directory_path() / "pefti_test_application") {
+    fs::remove_all(directory_);
+    fs::create_directories(directory_);
+    server_.add("/playlist.m3u"s, bench::generate_playlist(100), true);
+    server_.add("/epg.xml"s, bench::generate_epg(64 * 1024, 100), false);
+    bench::ConfigOptions options;
+    options.playlists = {server_.get_url("/playlist.m3u"sv)};
+    options.epgs = {server_.get_url("/epg.xml"sv)};
+    options.new_playlist = (directory_ / "new.m3u").string();
+    options.new_epg = (directory_ / "new.xml").string();
+    std::ofstream file(directory_ / "config.toml");
+    file << bench::generate_config(10, 1, options);
+  }
+  ~ApplicationTest() override { fs::remove_all(directory_); }
+
+  void set_failure_rate(double failure_rate) {
+    bench::NetworkShape shape;
+    shape.failure_rate = failure_rate;
+    server_.set_shape(shape);
+  }
+
+  std::string get_config_filename() const {
+    return (directory_ / "config.toml").string();
+  }
+
+  bool has_outputs() const {
+    return fs::exists(directory_ / "new.m3u") ||
+           fs::exists(directory_ / "new.xml");
+  }
+
+  fs::path directory_;
+  bench::UpstreamServer server_;
+};
+
+// A playlist that cannot be downloaded and has no snapshot fails the run
+// instead of leaving the EPG waiting for the channels
+TEST_F(ApplicationTest, PlaylistFailureWithoutSnapshotFailsRun) {
+  set_failure_rate(1.0);
+  Application application(get_config_filename());
+  EXPECT_THROW(application.run(), std::runtime_error);
+  EXPECT_FALSE(has_outputs());
+}
+
+// A failed refresh is followed by a refresh that waits for the channels of
+// its own playlist
+TEST_F(ApplicationTest, RefreshSucceedsAfterPlaylistFailure) {
+  cppcoro::static_thread_pool thread_pool;
+  HttpClient http_client;
+  Application application(get_config_filename());
+  set_failure_rate(1.0);
+  http_client.fetch(application.get_urls());
+  EXPECT_THROW(application.refresh(thread_pool, http_client),
+               std::runtime_error);
+  EXPECT_FALSE(has_outputs());
+  set_failure_rate(0.0);
+  http_client.fetch(application.get_urls());
+  application.refresh(thread_pool, http_client);
+  EXPECT_TRUE(fs::exists(directory_ / "new.m3u"));
+  EXPECT_TRUE(fs::exists(directory_ / "new.xml"));
+}
+
+}  // namespace
+}  // namespace pefti
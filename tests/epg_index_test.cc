@@ -0,0 +1,245 @@
+#include "epg_index.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+#include "xmltv_scanner.h"
+#include "xmltv_time.h"
+
+using namespace std::literals;
+
+namespace pefti {
+namespace {
+
+// An EPG and whether XmltvScanner supports it. The libxml2 path indexes
+// every document, so for supported documents the two paths are compared.
+struct EpgCase {
+  std::string_view name;
+  std::string_view epg;
+  bool is_scanned;
+};
+
+constexpr auto kBom = "\xEF\xBB\xBF"sv;
+
+const EpgCase kEpgCases[] = {
+    {"Sample",
+     "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+     "<!DOCTYPE tv SYSTEM \"xmltv.dtd\">\n"
+     "<tv generator-info-name=\"test\">\n"
+     "  <channel id=\"one.us\">\n"
+     "    <display-name lang=\"en\">One</display-name>\n"
+     "    <icon src=\"http://example.com/one.png\"/>\n"
+     "  </channel>\n"
+     "  <channel id=\"two.us\"><display-name>Two</display-name></channel>\n"
+     "  <programme start=\"20240101000000 +0000\" "
+     "stop=\"20240101010000 +0000\" channel=\"one.us\">\n"
+     "    <title lang=\"en\">News</title>\n"
+     "    <desc>Headlines &amp; weather</desc>\n"
+     "  </programme>\n"
+     "  <programme start=\"20240101010000 +0100\" channel=\"two.us\">"
+     "<title>Film</title></programme>\n"
+     "  <programme start=\"not a time\" stop=\"\" channel=\"one.us\">"
+     "<title>Late</title></programme>\n"
+     "</tv>\n"sv,
+     true},
+    {"ByteOrderMark",
+     "\xEF\xBB\xBF<?xml version=\"1.0\"?>\n<tv>"
+     "<channel id=\"a\"></channel>"
+     "<programme channel=\"a\" start=\"20240101000000\"></programme>"
+     "</tv>"sv,
+     true},
+    {"Comments",
+     "<?xml version=\"1.0\"?>\n<!-- before the DOCTYPE -->\n"
+     "<!DOCTYPE tv>\n<?xml-stylesheet href=\"tv.xsl\"?>\n<!-- <tv> -->\n"
+     "<tv>\n<!-- <channel id=\"hidden\"> -->\n"
+     "<channel id=\"a\"><display-name>A</display-name></channel>\n"
+     "<!-- between -->\n"
+     "<programme channel=\"a\" start=\"20240101000000\"></programme>\n"
+     "</tv>\n<!-- after the root -->\n"sv,
+     true},
+    {"CommentInElement",
+     "<tv><channel id=\"a\"><!-- <channel id=\"b\"> -->"
+     "<display-name>A</display-name></channel></tv>"sv,
+     false},
+    {"CData",
+     "<tv><channel id=\"a\"><display-name><![CDATA[</channel> & <]]>"
+     "</display-name></channel>"
+     "<programme channel=\"a\" start=\"20240101000000\"></programme></tv>"sv,
+     false},
+    {"SelfClosingElements",
+     "<tv><channel id=\"a\"/><channel id=\"b\" />"
+     "<programme channel=\"a\" start=\"20240101000000\"/>"
+     "<programme channel=\"b\" start=\"20240101000000\" "
+     "stop=\"20240101003000\"/></tv>"sv,
+     true},
+    {"EmptyRoot", "<?xml version=\"1.0\"?>\n<tv/>\n"sv, true},
+    {"SingleQuotes",
+     "<tv><channel id='a\"b'><display-name lang='en'>A</display-name>"
+     "</channel><programme channel='a\"b' start='20240101000000' "
+     "stop = '20240101010000'></programme></tv>"sv,
+     true},
+    {"GreaterThanInValues",
+     "<tv><channel id=\"a>b\"><display-name>A > B</display-name></channel>"
+     "<programme channel=\"a>b\" start=\"20240101000000\" "
+     "title=\">\"></programme></tv>"sv,
+     true},
+    {"EntitiesInContent",
+     "<tv><channel id=\"a\"><display-name>A &lt;&amp;&gt; &#66; &#x43;"
+     "</display-name></channel><programme channel=\"a\" "
+     "start=\"20240101000000\"><title>&quot;&apos;</title></programme>"
+     "</tv>"sv,
+     true},
+    {"ReferencesInOtherValues",
+     "<tv><channel id=\"a\"><icon src=\"http://a/?b=1&amp;c=2&#38;d\"/>"
+     "<display-name lang=\"e\tn\">A</display-name></channel></tv>"sv,
+     true},
+    {"NestedElements",
+     "<tv><channel id=\"a\"><channel><channel/></channel>"
+     "<display-name>A<b>B</b></display-name></channel></tv>"sv,
+     true},
+    {"EntitiesInValues",
+     "<tv><channel id=\"a&amp;b\"></channel><channel id=\"&#60;c\"></channel>"
+     "<programme channel=\"a&amp;b\" start=\"20240101000000\"></programme>"
+     "</tv>"sv,
+     false},
+    {"WhitespaceInValues",
+     "<tv><channel id=\"a\tb\"></channel></tv>"sv, false},
+    {"InternalSubset",
+     "<!DOCTYPE tv [<!ENTITY name \"Name\">]>\n"
+     "<tv><channel id=\"a\"><display-name>&name;</display-name></channel>"
+     "</tv>"sv,
+     false},
+    {"OtherElements",
+     "<tv><channel id=\"a\"></channel><review>x</review></tv>"sv, false},
+};
+
+std::string get_case_name(const testing::TestParamInfo<EpgCase>& info) {
+  return std::string{info.param.name};
+}
+
+std::size_t get_declaration_size(std::string_view epg) {
+  std::size_t begin{0};
+  if (epg.starts_with(kBom)) begin = kBom.size();
+  if (epg.substr(begin).starts_with("<?xml"sv))
+    return epg.find("?>"sv, begin) + 2;
+  return begin;
+}
+
+bool is_scanned(std::string_view epg) {
+  XmltvScanner scanner(epg, get_declaration_size(epg));
+  XmltvScanner::Element element;
+  while (true) {
+    switch (scanner.next(element)) {
+      case XmltvScanner::Result::kElement:
+        break;
+      case XmltvScanner::Result::kEnd:
+        return true;
+      case XmltvScanner::Result::kUnsupported:
+        return false;
+    }
+  }
+}
+
+auto get_fields(const EpgIndex::Element& element) {
+  return std::tuple{element.offset, element.size, element.channel_id,
+                    element.start, element.stop};
+}
+
+void expect_same_elements(std::span<const EpgIndex::Element> expected,
+                          std::span<const EpgIndex::Element> actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (std::size_t i{0}; i < expected.size(); ++i)
+    EXPECT_EQ(get_fields(expected[i]), get_fields(actual[i])) << i;
+}
+
+void expect_same_index(const EpgIndex& expected, const EpgIndex& actual) {
+  EXPECT_EQ(expected.get_prolog(), actual.get_prolog());
+  EXPECT_EQ(expected.get_channel_ids(), actual.get_channel_ids());
+  expect_same_elements(expected.get_channels(), actual.get_channels());
+  expect_same_elements(expected.get_programmes(), actual.get_programmes());
+}
+
+class EpgIndexDifferentialTest : public testing::TestWithParam<EpgCase> {};
+
+TEST_P(EpgIndexDifferentialTest, ScannerMatchesLibxml2) {
+  const auto& epg_case = GetParam();
+  EXPECT_EQ(is_scanned(epg_case.epg), epg_case.is_scanned);
+  EpgIndex parsed;
+  parsed.build(epg_case.epg, {}, false);
+  EpgIndex scanned;
+  scanned.build(epg_case.epg, {}, true);
+  expect_same_index(parsed, scanned);
+}
+
+TEST_P(EpgIndexDifferentialTest, ScannerMatchesLibxml2InTimeWindow) {
+  const auto& epg_case = GetParam();
+  const auto begin = parse_xmltv_time("20240101003000"sv);
+  ASSERT_TRUE(begin);
+  const TimeWindow time_window{*begin, *begin + 3600};
+  EpgIndex parsed;
+  parsed.build(epg_case.epg, time_window, false);
+  EpgIndex scanned;
+  scanned.build(epg_case.epg, time_window, true);
+  expect_same_index(parsed, scanned);
+}
+
+INSTANTIATE_TEST_SUITE_P(Epgs, EpgIndexDifferentialTest,
+                         testing::ValuesIn(kEpgCases), get_case_name);
+
+// Malformed documents are left to libxml2 by the scanner, so both paths
+// reject them
+const EpgCase kMalformedEpgCases[] = {
+    {"UndeclaredEntity",
+     "<tv><channel id=\"a\"><display-name>&undeclared;</display-name>"
+     "</channel></tv>"sv,
+     false},
+    {"BareAmpersand",
+     "<tv><channel id=\"a\"><display-name>A & B</display-name>"
+     "</channel></tv>"sv,
+     false},
+    {"InvalidCharacterReference",
+     "<tv><channel id=\"a\"><display-name>&#0;</display-name>"
+     "</channel></tv>"sv,
+     false},
+    {"UndeclaredEntityInValue",
+     "<tv><channel id=\"a\"><icon src=\"&undeclared;\"/></channel></tv>"sv,
+     false},
+    {"CDataEndInText",
+     "<tv><channel id=\"a\"><display-name>]]></display-name>"
+     "</channel></tv>"sv,
+     false},
+    {"DuplicateAttribute",
+     "<tv><channel id=\"a\" id=\"b\"></channel></tv>"sv, false},
+    {"DuplicateAttributeInContent",
+     "<tv><channel id=\"a\"><icon src=\"a\" src=\"b\"/></channel></tv>"sv,
+     false},
+    {"MismatchedTags",
+     "<tv><channel id=\"a\"><display-name>A</title></channel></tv>"sv,
+     false},
+    {"UnclosedTag",
+     "<tv><channel id=\"a\"><display-name>A</channel></tv>"sv, false},
+};
+
+class EpgIndexMalformedTest : public testing::TestWithParam<EpgCase> {};
+
+TEST_P(EpgIndexMalformedTest, BothPathsReject) {
+  const auto& epg_case = GetParam();
+  EXPECT_EQ(is_scanned(epg_case.epg), epg_case.is_scanned);
+  EpgIndex parsed;
+  EXPECT_THROW(parsed.build(epg_case.epg, {}, false), std::runtime_error);
+  EpgIndex scanned;
+  EXPECT_THROW(scanned.build(epg_case.epg, {}, true), std::runtime_error);
+}
+
+INSTANTIATE_TEST_SUITE_P(Epgs, EpgIndexMalformedTest,
+                         testing::ValuesIn(kMalformedEpgCases),
+                         get_case_name);
+
+}  // namespace
+}  // namespace pefti
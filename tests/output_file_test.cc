@@ -0,0 +1,126 @@
+#include "output_file.h"
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include <cppcoro/static_thread_pool.hpp>
+#include <cppcoro/sync_wait.hpp>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "file.h"
+#include "generators.h"
+
+using namespace std::literals;
+
+namespace pefti {
+namespace {
+
+// More than one block of OutputFile, with a partial last block
+constexpr std::size_t kDataSize{(5 << 20) / 2};
+
+// Decompresses a gzip file as a single gzip member, as HTTP clients do.
+// Returns an empty string if the member does not end at the end of the
+// file.
+std::string gunzip_member(std::string_view file) {
+  z_stream stream{};
+  if (inflateInit2(&stream, 15 + 16) != Z_OK) return {};
+  std::string output;
+  std::string buffer(1 << 16, '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(file.data()));
+  stream.avail_in = static_cast<uInt>(file.size());
+  int result{Z_OK};
+  while (result == Z_OK) {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+    stream.avail_out = static_cast<uInt>(buffer.size());
+    result = inflate(&stream, Z_NO_FLUSH);
+    output.append(buffer.data(), buffer.size() - stream.avail_out);
+  }
+  const bool is_whole_file{result == Z_STREAM_END && stream.avail_in == 0};
+  inflateEnd(&stream);
+  return is_whole_file ? output : std::string{};
+}
+
+std::string unzstd(std::string_view file) {
+  std::string output;
+  std::size_t offset{0};
+  // Each block is a frame of its own
+  while (offset < file.size()) {
+    const auto frame = file.substr(offset);
+    const auto frame_size =
+        ZSTD_findFrameCompressedSize(frame.data(), frame.size());
+    if (ZSTD_isError(frame_size)) return {};
+    const auto content_size =
+        ZSTD_getFrameContentSize(frame.data(), frame_size);
+    if (content_size == ZSTD_CONTENTSIZE_ERROR ||
+        content_size == ZSTD_CONTENTSIZE_UNKNOWN)
+      return {};
+    const auto begin = output.size();
+    output.resize(begin + content_size);
+    if (ZSTD_isError(ZSTD_decompress(output.data() + begin, content_size,
+                                     frame.data(), frame_size)))
+      return {};
+    offset += frame_size;
+  }
+  return output;
+}
+
+class OutputFileTest : public testing::Test {
+ protected:
+  ~OutputFileTest() override {
+    std::error_code error;
+    std::filesystem::remove(filename_, error);
+    std::filesystem::remove(filename_ + ".hash"s, error);
+  }
+
+  // Writes `data` to an output file named `name` and returns the file
+  std::string write(std::string_view name, std::string_view data) {
+    filename_ = (std::filesystem::temp_directory_path() / name).string();
+    OutputFile file(filename_);
+    file.get_stream() << data;
+    EXPECT_TRUE(cppcoro::sync_wait(file.close(tp_)));
+    return std::string{MappedFile(filename_).get_data()};
+  }
+
+  cppcoro::static_thread_pool tp_{4};
+  std::string filename_;
+};
+
+// The blocks are written in a single gzip member, so the data is
+// decompressed by clients that only decompress the first member
+TEST_F(OutputFileTest, WritesGzipAsSingleMember) {
+  const auto data = bench::generate_epg(kDataSize, 100);
+  EXPECT_EQ(gunzip_member(write("pefti_test_output.xml.gz"sv, data)), data);
+}
+
+TEST_F(OutputFileTest, WritesEmptyGzip) {
+  const auto file = write("pefti_test_empty.xml.gz"sv, {});
+  z_stream stream{};
+  ASSERT_EQ(inflateInit2(&stream, 15 + 16), Z_OK);
+  std::string buffer(16, '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(file.data()));
+  stream.avail_in = static_cast<uInt>(file.size());
+  stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+  stream.avail_out = static_cast<uInt>(buffer.size());
+  EXPECT_EQ(inflate(&stream, Z_FINISH), Z_STREAM_END);
+  EXPECT_EQ(stream.total_out, 0u);
+  EXPECT_EQ(stream.avail_in, 0u);
+  inflateEnd(&stream);
+}
+
+TEST_F(OutputFileTest, WritesZstdFrames) {
+  const auto data = bench::generate_epg(kDataSize, 100);
+  EXPECT_EQ(unzstd(write("pefti_test_output.xml.zst"sv, data)), data);
+}
+
+TEST_F(OutputFileTest, WritesUncompressed) {
+  const auto data = bench::generate_epg(kDataSize, 100);
+  EXPECT_EQ(write("pefti_test_output.xml"sv, data), data);
+}
+
+}  // namespace
+}  // namespace pefti
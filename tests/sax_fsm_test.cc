@@ -0,0 +1,216 @@
+#include "sax_fsm.h"
+
+#include <gtest/gtest.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include <cppcoro/static_thread_pool.hpp>
+#include <cppcoro/sync_wait.hpp>
+#include <cppcoro/task.hpp>
+#include <filesystem>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "config.h"
+#include "epg_index.h"
+#include "file.h"
+#include "filter.h"
+#include "generators.h"
+#include "iptv_channel.h"
+#include "mapper.h"
+#include "playlist.h"
+
+using namespace std::literals;
+
+namespace pefti {
+namespace {
+
+constexpr auto kChannelId = "a<b&c"sv;
+
+cppcoro::task<> push_back_channel(Playlist& playlist, std::string_view id) {
+  IptvChannel channel;
+  channel.set_original_name("Channel"sv);
+  channel.set_new_name("Channel"sv);
+  channel.set_url("http://stream.example.com/1.ts"sv);
+  channel.set_tag(IptvChannel::kTagTvgId, id);
+  co_await playlist.push_back(std::move(channel));
+}
+
+// Copies the nodes of `epg` with SaxFsm and returns them as a document
+std::string copy_nodes(const Playlist& playlist, std::string_view epg) {
+  std::ostringstream channel_stream;
+  std::ostringstream programme_stream;
+  SaxFsm fsm(channel_stream, programme_stream, playlist);
+  fsm.parse(epg);
+  return "<tv>"s + channel_stream.str() + programme_stream.str() +
+         "\n</tv>\n"s;
+}
+
+struct XmlDocDeleter {
+  void operator()(xmlDoc* doc) const { xmlFreeDoc(doc); }
+};
+
+std::string get_property(xmlNode* node, const char* name) {
+  auto* value = xmlGetProp(node, reinterpret_cast<const xmlChar*>(name));
+  if (!value) return {};
+  std::string text{reinterpret_cast<const char*>(value)};
+  xmlFree(value);
+  return text;
+}
+
+xmlNode* get_first_element(xmlNode* node) {
+  for (; node; node = node->next)
+    if (node->type == XML_ELEMENT_NODE) return node;
+  return nullptr;
+}
+
+std::string get_text(xmlNode* node) {
+  auto* content = xmlNodeGetContent(node);
+  if (!content) return {};
+  std::string text{reinterpret_cast<const char*>(content)};
+  xmlFree(content);
+  return text;
+}
+
+class SaxFsmTest : public testing::Test {
+ protected:
+  SaxFsmTest()
+      : config_filename_(bench::write_temp_file("pefti_test_sax_fsm.toml"sv,
+                                                bench::generate_config(1))),
+        config_(config_filename_),
+        playlist_(config_) {
+    cppcoro::sync_wait(push_back_channel(playlist_, kChannelId));
+    playlist_.freeze_tvg_ids();
+  }
+
+  // Copies the nodes of `epg` and parses the output as a document
+  std::unique_ptr<xmlDoc, XmlDocDeleter> copy_and_parse(std::string_view epg) {
+    output_ = copy_nodes(playlist_, epg);
+    return std::unique_ptr<xmlDoc, XmlDocDeleter>{
+        xmlReadMemory(output_.data(), static_cast<int>(output_.size()),
+                      nullptr, nullptr, 0)};
+  }
+
+  // Filters `epgs` in verbatim mode and parses the new EPG
+  std::unique_ptr<xmlDoc, XmlDocDeleter> filter_verbatim_and_parse(
+      std::initializer_list<std::string_view> epgs, bool is_merge_enabled) {
+    auto config_filename = bench::write_temp_file(
+        "pefti_test_sax_fsm_verbatim.toml"sv,
+        bench::generate_config(1) + "[epg]\noutput = \"verbatim\"\nmerge = "s +
+            (is_merge_enabled ? "true\n"s : "false\n"s));
+    ConfigType config(config_filename);
+    ChannelsMapper channels_mapper;
+    Filter filter(config, playlist_, channels_mapper);
+    std::vector<EpgIndex> epg_indexes(epgs.size());
+    auto epg = epgs.begin();
+    for (auto& index : epg_indexes) index.build(*epg++);
+    const auto new_epg_filename = (std::filesystem::temp_directory_path() /
+                                   "pefti_test_sax_fsm_verbatim.xml")
+                                      .string();
+    cppcoro::static_thread_pool tp{2};
+    cppcoro::sync_wait(
+        filter.filter(tp, epg_indexes, new_epg_filename, nullptr));
+    output_ = std::string{MappedFile(new_epg_filename).get_data()};
+    std::error_code error;
+    std::filesystem::remove(config_filename, error);
+    std::filesystem::remove(new_epg_filename, error);
+    return std::unique_ptr<xmlDoc, XmlDocDeleter>{
+        xmlReadMemory(output_.data(), static_cast<int>(output_.size()),
+                      nullptr, nullptr, 0)};
+  }
+
+  std::string config_filename_;
+  ConfigType config_;
+  Playlist playlist_;
+  std::string output_;
+};
+
+// The attribute values of the copied nodes are escaped, so the output
+// parses again and has the values of the input
+TEST_F(SaxFsmTest, EscapesAttributeValues) {
+  const auto doc = copy_and_parse(
+      "<?xml version=\"1.0\"?>\n<tv>\n"
+      "<channel id=\"a&lt;b&amp;c\"><display-name lang='x\"&lt;&amp;y'>"
+      "A &amp; B</display-name></channel>\n"
+      "<programme channel=\"a&lt;b&amp;c\" start=\"20240101000000 +0000\" "
+      "title=\"1 &lt; 2 &#38; 3\"><title>T</title></programme>\n"
+      "<channel id=\"other\"><display-name>Other</display-name></channel>\n"
+      "</tv>\n"sv);
+  ASSERT_NE(doc, nullptr) << output_;
+  auto* channel = get_first_element(xmlDocGetRootElement(doc.get())->children);
+  ASSERT_NE(channel, nullptr);
+  EXPECT_EQ(get_property(channel, "id"), kChannelId);
+  auto* display_name = get_first_element(channel->children);
+  ASSERT_NE(display_name, nullptr);
+  EXPECT_EQ(get_property(display_name, "lang"), "x\"<&y");
+  auto* programme = get_first_element(channel->next);
+  ASSERT_NE(programme, nullptr);
+  EXPECT_EQ(get_property(programme, "channel"), kChannelId);
+  EXPECT_EQ(get_property(programme, "title"), "1 < 2 & 3");
+  EXPECT_EQ(get_first_element(programme->next), nullptr);
+  // Copying the output again gives the same output
+  EXPECT_EQ(copy_nodes(playlist_, output_), output_);
+}
+
+// The output does not declare the entities of the internal subset of the
+// input, so they are replaced
+TEST_F(SaxFsmTest, ReplacesDeclaredEntities) {
+  const auto doc = copy_and_parse(
+      "<!DOCTYPE tv [<!ENTITY name \"Name\">]>\n<tv>\n"
+      "<channel id=\"a&lt;b&amp;c\"><display-name lang=\"&name;\">"
+      "&name; &amp; &name;</display-name></channel>\n"
+      "</tv>\n"sv);
+  ASSERT_NE(doc, nullptr) << output_;
+  auto* channel = get_first_element(xmlDocGetRootElement(doc.get())->children);
+  ASSERT_NE(channel, nullptr);
+  auto* display_name = get_first_element(channel->children);
+  ASSERT_NE(display_name, nullptr);
+  EXPECT_EQ(get_property(display_name, "lang"), "Name");
+  EXPECT_EQ(get_text(display_name), "Name & Name");
+}
+
+// The new EPG does not declare the entities of the internal subset of an
+// input either in verbatim mode, so the elements of that input are rebuilt
+TEST_F(SaxFsmTest, ReplacesDeclaredEntitiesInVerbatimMode) {
+  constexpr auto kEpgWithEntities =
+      "<!DOCTYPE tv [<!ENTITY name \"Name\">]>\n<tv>\n"
+      "<channel id=\"a&lt;b&amp;c\"><display-name>&name; &amp; &name;"
+      "</display-name></channel>\n"
+      "<programme channel=\"a&lt;b&amp;c\" start=\"20240101000000 +0000\" "
+      "stop=\"20240101003000 +0000\"><title>&name;</title></programme>\n"
+      "</tv>\n"sv;
+  constexpr auto kEpg =
+      "<tv>\n<programme channel=\"a&lt;b&amp;c\" "
+      "start=\"20240101010000 +0000\"><title>Verbatim</title></programme>\n"
+      "</tv>\n"sv;
+  for (const bool is_merge_enabled : {false, true}) {
+    SCOPED_TRACE(is_merge_enabled);
+    const auto doc =
+        filter_verbatim_and_parse({kEpgWithEntities, kEpg}, is_merge_enabled);
+    ASSERT_NE(doc, nullptr) << output_;
+    auto* channel =
+        get_first_element(xmlDocGetRootElement(doc.get())->children);
+    ASSERT_NE(channel, nullptr);
+    EXPECT_EQ(get_text(get_first_element(channel->children)), "Name & Name");
+    auto* programme = get_first_element(channel->next);
+    ASSERT_NE(programme, nullptr);
+    EXPECT_EQ(get_text(get_first_element(programme->children)), "Name");
+    programme = get_first_element(programme->next);
+    ASSERT_NE(programme, nullptr);
+    EXPECT_EQ(get_text(get_first_element(programme->children)), "Verbatim");
+  }
+}
+
+TEST_F(SaxFsmTest, ThrowsOnMalformedDocument) {
+  EXPECT_THROW(copy_nodes(playlist_, "<tv><channel id=\"a\"></tv>"sv),
+               std::runtime_error);
+}
+
+}  // namespace
+}  // namespace pefti
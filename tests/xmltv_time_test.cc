@@ -0,0 +1,44 @@
+#include "xmltv_time.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+using namespace std::literals;
+
+namespace pefti {
+namespace {
+
+// 2024-01-01 00:00:00 UTC
+constexpr std::int64_t kNewYear{1704067200};
+
+TEST(XmltvTimeTest, ParsesDates) {
+  EXPECT_EQ(parse_xmltv_time("20240101000000 +0000"sv), kNewYear);
+  EXPECT_EQ(parse_xmltv_time("20240101083015"sv), kNewYear + 30615);
+  EXPECT_EQ(parse_xmltv_time("20240101080000 +0100"sv), kNewYear + 25200);
+  EXPECT_EQ(parse_xmltv_time("20240101080000 -0130"sv), kNewYear + 34200);
+  EXPECT_EQ(parse_xmltv_time("20240101080000+0100"sv), kNewYear + 25200);
+  EXPECT_EQ(parse_xmltv_time("20240101000000 +0000 "sv), kNewYear);
+}
+
+TEST(XmltvTimeTest, ParsesDatesWithoutTrailingFields) {
+  EXPECT_EQ(parse_xmltv_time("2024"sv), kNewYear);
+  EXPECT_EQ(parse_xmltv_time("202401"sv), kNewYear);
+  EXPECT_EQ(parse_xmltv_time("2024010108"sv), kNewYear + 28800);
+  EXPECT_EQ(parse_xmltv_time("2024010108 +0100"sv), kNewYear + 25200);
+}
+
+TEST(XmltvTimeTest, RejectsInvalidDates) {
+  for (const auto text :
+       {""sv, "not a time"sv, "202"sv, "2024-01-01"sv, "202401011.00"sv,
+        "2024010108.0 +0000"sv, "20240101080000 +01"sv,
+        "20240101080000 +01:0"sv, "20240101080000 UTC"sv,
+        "20240101080000x"sv, "20241301000000"sv, "20240100000000"sv,
+        "20240101240000"sv, "20240101006000"sv, "2024/101000000"sv})
+    EXPECT_EQ(parse_xmltv_time(text), std::nullopt) << text;
+}
+
+}  // namespace
+}  // namespace pefti